@@ -0,0 +1,460 @@
+#pragma once
+#ifndef hugebenchmark_h__
+#define hugebenchmark_h__
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDataStream>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+/*
+   The same workloads timed against every backend. Each backend builds an
+   executable of its own around Suite, handing it one adapter per element
+   type, and the reports of all of them share their columns:
+   backend, workload, type, size, ops, seconds, ops_per_sec, p50_ns, p99_ns.
+   Every run starts from the same seed, so the indices and values used are
+   the same from one run to the next and from one backend to the other.
+*/
+namespace HugeBenchmark
+{
+	//! 64 bytes of plain data, stored as fixed-width records by the HugeContainer backends
+	struct Pod64
+	{
+		qint64 m_values[8];
+	};
+
+	inline QDataStream& operator<<(QDataStream& out, const Pod64& pod)
+	{
+		for (const qint64 val : pod.m_values)
+			out << val;
+		return out;
+	}
+
+	inline QDataStream& operator>>(QDataStream& in, Pod64& pod)
+	{
+		for (qint64& val : pod.m_values)
+			in >> val;
+		return in;
+	}
+
+	/* what the workloads store, and a checksum so reading them cannot be optimized away */
+	template <class ValueType>
+	struct Values;
+
+	template <>
+	struct Values<qreal>
+	{
+		static QString name() { return QStringLiteral("qreal"); }
+		static qreal make(qint64 i) { return qreal(i) * 0.5; }
+		static quint64 checksum(qreal val) { return quint64(val); }
+	};
+
+	template <>
+	struct Values<Pod64>
+	{
+		static QString name() { return QStringLiteral("pod64"); }
+		static Pod64 make(qint64 i)
+		{
+			Pod64 result;
+			for (int k = 0; k < 8; ++k)
+				result.m_values[k] = i + k;
+			return result;
+		}
+		static quint64 checksum(const Pod64& val) { return quint64(val.m_values[0] ^ val.m_values[7]); }
+	};
+
+	//! From one to a few hundred characters
+	template <>
+	struct Values<QString>
+	{
+		static QString name() { return QStringLiteral("qstring"); }
+		static QString make(qint64 i) { return QString::number(i).repeated(1 + int(i % 32)); }
+		static quint64 checksum(const QString& val) { return quint64(val.size()); }
+	};
+
+	enum class Workload {
+		PushBack,	//!< size push_back() calls on an empty container
+		RandomAt,	//!< at() on random indices
+		MidInsert,	//!< insert() in the middle
+		RemoveChurn,	//!< removeAt() on a random index followed by push_back(), the size stays the same
+		FullScan,	//!< every element, in order
+		CopyDetach	//!< copy of the container followed by a change of the copy
+	};
+
+	//! Items of a comma separated list, empty ones left out
+	inline QStringList splitList(const QString& list)
+	{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+		return list.split(QLatin1Char(','), Qt::SkipEmptyParts);
+#else
+		return list.split(QLatin1Char(','), QString::SkipEmptyParts);
+#endif
+	}
+
+	inline QString workloadName(Workload workload)
+	{
+		switch (workload) {
+		case Workload::PushBack: return QStringLiteral("push_back");
+		case Workload::RandomAt: return QStringLiteral("random_at");
+		case Workload::MidInsert: return QStringLiteral("mid_insert");
+		case Workload::RemoveChurn: return QStringLiteral("remove_churn");
+		case Workload::FullScan: return QStringLiteral("full_scan");
+		case Workload::CopyDetach: return QStringLiteral("copy_detach");
+		}
+		return QString();
+	}
+
+	/*
+	   Adapter of the HugeContainer backends, which share their interface.
+	   An adapter for another backend provides the same members and returns
+	   false from supports() for the workloads it cannot run.
+	*/
+	template <template <class> class Container, class ValueType>
+	class ContainerBackend
+	{
+	public:
+		class Scanner
+		{
+		public:
+			explicit Scanner(const Container<ValueType>& container)
+				: m_iter(container.begin())
+				, m_end(container.end())
+			{}
+			bool next(ValueType& out)
+			{
+				if (m_iter == m_end)
+					return false;
+				out = *m_iter;
+				++m_iter;
+				return true;
+			}
+		private:
+			typename Container<ValueType>::const_iterator m_iter;
+			typename Container<ValueType>::const_iterator m_end;
+		};
+
+		static bool supports(Workload) { return true; }
+		void fill(const QVector<ValueType>& values) { m_container.append(values); }
+		void push_back(const ValueType& val) { m_container.push_back(val); }
+		ValueType at(qint64 index) const { return m_container.at(uint(index)); }
+		void insert(qint64 index, const ValueType& val) { m_container.insert(uint(index), val); }
+		void removeAt(qint64 index) { m_container.removeAt(uint(index)); }
+		qint64 size() const { return m_container.size(); }
+		Scanner scan() const { return Scanner(m_container); }
+		void copyThenDetach(const ValueType& val) const
+		{
+			Container<ValueType> copy(m_container);
+			copy.push_back(val);
+		}
+
+	private:
+		Container<ValueType> m_container;
+	};
+
+	struct Result
+	{
+		QString m_backend;
+		QString m_workload;
+		QString m_type;
+		qint64 m_size;
+		qint64 m_ops;
+		double m_seconds;
+		qint64 m_p50;	//!< nanoseconds
+		qint64 m_p99;
+
+		double opsPerSecond() const { return m_seconds > 0 ? m_ops / m_seconds : 0.0; }
+	};
+
+	class Suite
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		enum {
+			MaxSamples = 1 << 20,	//!< latencies kept per workload, longer ones time every n-th operation
+			PoolValues = 1 << 12,	//!< distinct values cycled through by the workloads
+			FillChunk = 1 << 16	//!< elements appended at once while filling a container
+		};
+
+	public:
+		Suite()
+			: m_randomOps(100000)
+			, m_editOps(1000)
+			, m_copies(3)
+			, m_seed(42)
+			, m_format(QStringLiteral("csv"))
+			, m_sink(0)
+		{
+			for (qint64 size = 1000; size <= 100000000; size *= 10)
+				m_sizes.append(size);
+		}
+
+		//! false when the command line asks for help or is wrong, the caller then exits
+		bool parse(const QCoreApplication& app)
+		{
+			QCommandLineParser parser;
+			parser.setApplicationDescription(QStringLiteral("Times the same workloads against a HugeVector backend"));
+			parser.addHelpOption();
+			const QCommandLineOption sizes(QStringLiteral("sizes"), QStringLiteral("Comma separated element counts, 1e3,1e4,... up to 1e8 by default."), QStringLiteral("list"));
+			const QCommandLineOption workloads(QStringLiteral("workloads"), QStringLiteral("Comma separated workloads: push_back, random_at, mid_insert, remove_churn, full_scan, copy_detach. All of them by default."), QStringLiteral("list"));
+			const QCommandLineOption types(QStringLiteral("types"), QStringLiteral("Comma separated element types: qreal, pod64, qstring. All of them by default."), QStringLiteral("list"));
+			const QCommandLineOption randomOps(QStringLiteral("random-ops"), QStringLiteral("at() calls of random_at."), QStringLiteral("count"), QString::number(m_randomOps));
+			const QCommandLineOption editOps(QStringLiteral("edit-ops"), QStringLiteral("Operations of mid_insert and remove_churn."), QStringLiteral("count"), QString::number(m_editOps));
+			const QCommandLineOption copies(QStringLiteral("copies"), QStringLiteral("Copies made by copy_detach."), QStringLiteral("count"), QString::number(m_copies));
+			const QCommandLineOption seed(QStringLiteral("seed"), QStringLiteral("Seed of the random indices."), QStringLiteral("value"), QString::number(m_seed));
+			const QCommandLineOption format(QStringLiteral("format"), QStringLiteral("csv or json."), QStringLiteral("format"), m_format);
+			const QCommandLineOption output(QStringLiteral("output"), QStringLiteral("Report file, standard output by default."), QStringLiteral("file"));
+			parser.addOptions({ sizes, workloads, types, randomOps, editOps, copies, seed, format, output });
+			if (!parser.parse(app.arguments())) {
+				qWarning().noquote() << parser.errorText();
+				return false;
+			}
+			if (parser.isSet(QStringLiteral("help"))) {
+				qInfo().noquote() << parser.helpText();
+				return false;
+			}
+
+			if (parser.isSet(sizes)) {
+				m_sizes.clear();
+				for (const QString& size : splitList(parser.value(sizes))) {
+					bool ok = false;
+					const qint64 count = qint64(size.toDouble(&ok));
+					if (!ok || count <= 0) {
+						qWarning().noquote() << "Invalid size" << size;
+						return false;
+					}
+					m_sizes.append(count);
+				}
+			}
+			m_workloads = splitList(parser.value(workloads));
+			m_types = splitList(parser.value(types));
+			m_randomOps = qMax<qint64>(parser.value(randomOps).toLongLong(), 1);
+			m_editOps = qMax<qint64>(parser.value(editOps).toLongLong(), 1);
+			m_copies = qMax(parser.value(copies).toInt(), 1);
+			m_seed = parser.value(seed).toULongLong();
+			m_format = parser.value(format);
+			m_output = parser.value(output);
+			if (m_format != QLatin1String("csv") && m_format != QLatin1String("json")) {
+				qWarning().noquote() << "Unknown format" << m_format;
+				return false;
+			}
+			return true;
+		}
+
+		/*
+		  runs the workloads the backend supports for every size, makeBackend()
+		  returning a new empty adapter held by a std::unique_ptr. The workloads
+		  after push_back reuse the container it filled, the ones changing it
+		  run last.
+		*/
+		template <class ValueType, class MakeBackend>
+		void run(const QString& backend, MakeBackend makeBackend)
+		{
+			typedef typename std::remove_reference<decltype(*makeBackend())>::type Backend;
+			const QString type = Values<ValueType>::name();
+			if (!m_types.isEmpty() && !m_types.contains(type))
+				return;
+			QVector<ValueType> pool;
+			pool.reserve(PoolValues);
+			for (int i = 0; i < PoolValues; ++i)
+				pool.append(Values<ValueType>::make(i));
+
+			for (const qint64 size : m_sizes) {
+				auto container = makeBackend();
+				if (selected<Backend>(Workload::PushBack)) {
+					report(backend, Workload::PushBack, type, 0, measure(size, [&container, &pool](qint64 i) {
+						container->push_back(pool.at(int(i % PoolValues)));
+					}));
+				}
+				else {
+					fill(*container, pool, size);
+				}
+
+				std::mt19937_64 random(m_seed);
+				std::uniform_int_distribution<qint64> anyIndex(0, size - 1);
+				quint64 checksum = 0;
+
+				if (selected<Backend>(Workload::RandomAt)) {
+					const std::vector<qint64> indices = randomIndices(random, anyIndex, m_randomOps);
+					report(backend, Workload::RandomAt, type, size, measure(m_randomOps, [&container, &indices, &checksum](qint64 i) {
+						checksum += Values<ValueType>::checksum(container->at(indices[size_t(i)]));
+					}));
+				}
+				if (selected<Backend>(Workload::FullScan)) {
+					auto scanner = container->scan();
+					ValueType val;
+					report(backend, Workload::FullScan, type, size, measure(size, [&scanner, &val, &checksum](qint64) {
+						if (scanner.next(val))
+							checksum += Values<ValueType>::checksum(val);
+					}));
+				}
+				if (selected<Backend>(Workload::CopyDetach)) {
+					report(backend, Workload::CopyDetach, type, size, measure(m_copies, [&container, &pool](qint64 i) {
+						container->copyThenDetach(pool.at(int(i % PoolValues)));
+					}));
+				}
+				if (selected<Backend>(Workload::RemoveChurn)) {
+					const std::vector<qint64> indices = randomIndices(random, anyIndex, m_editOps);
+					report(backend, Workload::RemoveChurn, type, size, measure(m_editOps, [&container, &indices, &pool](qint64 i) {
+						container->removeAt(indices[size_t(i)]);
+						container->push_back(pool.at(int(i % PoolValues)));
+					}));
+				}
+				if (selected<Backend>(Workload::MidInsert)) {
+					report(backend, Workload::MidInsert, type, size, measure(m_editOps, [&container, &pool](qint64 i) {
+						container->insert(container->size() / 2, pool.at(int(i % PoolValues)));
+					}));
+				}
+				m_sink = m_sink ^ checksum;
+			}
+		}
+
+		//! Writes every result in the chosen format, false if the report cannot be written
+		bool write() const
+		{
+			QFile file(m_output);
+			bool opened = false;
+			if (m_output.isEmpty())
+				opened = file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+			else
+				opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text);
+			if (!opened) {
+				qWarning().noquote() << "Unable to write" << m_output;
+				return false;
+			}
+			if (m_format == QLatin1String("json"))
+				return file.write(toJson()) >= 0;
+			QTextStream out(&file);
+			out << "backend,workload,type,size,ops,seconds,ops_per_sec,p50_ns,p99_ns\n";
+			for (const Result& result : m_results) {
+				out << result.m_backend << ',' << result.m_workload << ',' << result.m_type << ','
+					<< result.m_size << ',' << result.m_ops << ',' << QString::number(result.m_seconds, 'g', 9) << ','
+					<< QString::number(result.opsPerSecond(), 'f', 1) << ',' << result.m_p50 << ',' << result.m_p99 << '\n';
+			}
+			out.flush();
+			return out.status() == QTextStream::Ok;
+		}
+
+	private:
+		template <class Backend>
+		bool selected(Workload workload) const
+		{
+			return Backend::supports(workload) && (m_workloads.isEmpty() || m_workloads.contains(workloadName(workload)));
+		}
+
+		template <class Backend, class ValueType>
+		static void fill(Backend& container, const QVector<ValueType>& pool, qint64 size)
+		{
+			QVector<ValueType> chunk;
+			for (qint64 done = 0; done < size; done += chunk.size()) {
+				chunk.resize(int(qMin<qint64>(size - done, FillChunk)));
+				for (int i = 0; i < chunk.size(); ++i)
+					chunk[i] = pool.at(int((done + i) % PoolValues));
+				container.fill(chunk);
+			}
+		}
+
+		static std::vector<qint64> randomIndices(std::mt19937_64& random, std::uniform_int_distribution<qint64>& distribution, qint64 count)
+		{
+			std::vector<qint64> indices(static_cast<size_t>(count));
+			for (qint64& index : indices)
+				index = distribution(random);
+			return indices;
+		}
+
+		/*
+		  times ops calls of op(i). The total gives the throughput, the
+		  latencies of up to MaxSamples calls evenly spread give the percentiles.
+		*/
+		template <class Op>
+		static Result measure(qint64 ops, Op op)
+		{
+			const qint64 stride = qMax<qint64>(1, ops / MaxSamples);
+			std::vector<qint64> samples;
+			samples.reserve(size_t(ops / stride + 1));
+			const Clock::time_point start = Clock::now();
+			for (qint64 i = 0; i < ops; ++i) {
+				if (i % stride != 0) {
+					op(i);
+					continue;
+				}
+				const Clock::time_point before = Clock::now();
+				op(i);
+				samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count());
+			}
+			Result result;
+			result.m_ops = ops;
+			result.m_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			result.m_p50 = percentile(samples, 0.50);
+			result.m_p99 = percentile(samples, 0.99);
+			return result;
+		}
+
+		static qint64 percentile(std::vector<qint64>& samples, double rank)
+		{
+			if (samples.empty())
+				return 0;
+			const auto nth = samples.begin() + qMin<size_t>(samples.size() - 1, size_t(rank * samples.size()));
+			std::nth_element(samples.begin(), nth, samples.end());
+			return *nth;
+		}
+
+		//! size is the one before the workload, 0 for push_back which starts empty
+		void report(const QString& backend, Workload workload, const QString& type, qint64 size, Result result)
+		{
+			result.m_backend = backend;
+			result.m_workload = workloadName(workload);
+			result.m_type = type;
+			result.m_size = (workload == Workload::PushBack) ? result.m_ops : size;
+			qInfo().noquote() << backend << result.m_workload << type << result.m_size
+				<< QString::number(result.opsPerSecond(), 'f', 1) << "ops/s";
+			m_results.append(result);
+		}
+
+		QByteArray toJson() const
+		{
+			QJsonArray rows;
+			for (const Result& result : m_results) {
+				QJsonObject row;
+				row.insert(QStringLiteral("backend"), result.m_backend);
+				row.insert(QStringLiteral("workload"), result.m_workload);
+				row.insert(QStringLiteral("type"), result.m_type);
+				row.insert(QStringLiteral("size"), result.m_size);
+				row.insert(QStringLiteral("ops"), result.m_ops);
+				row.insert(QStringLiteral("seconds"), result.m_seconds);
+				row.insert(QStringLiteral("ops_per_sec"), result.opsPerSecond());
+				row.insert(QStringLiteral("p50_ns"), result.m_p50);
+				row.insert(QStringLiteral("p99_ns"), result.m_p99);
+				rows.append(row);
+			}
+			return QJsonDocument(rows).toJson();
+		}
+
+		QVector<qint64> m_sizes;
+		QStringList m_workloads;	//!< every workload when empty
+		QStringList m_types;	//!< every type when empty
+		qint64 m_randomOps;
+		qint64 m_editOps;
+		int m_copies;
+		quint64 m_seed;
+		QString m_format;
+		QString m_output;
+		QVector<Result> m_results;
+		volatile quint64 m_sink;	//!< checksums of what was read, so the reads are not optimized away
+	};
+}
+
+#endif // hugebenchmark_h__
@@ -0,0 +1,78 @@
+#include "SQLiteDataBase.h"
+#include "BenchmarkSuite.h"
+
+using namespace HugeBenchmark;
+
+/*
+  the SQLite backend stores qreal values only and has neither insert() nor
+  removeAt(), its adapter leaves those workloads out
+*/
+class SQLiteBackend
+{
+public:
+	class Scanner
+	{
+	public:
+		explicit Scanner(SQLiteDataBase& dataBase)
+			: m_dataBase(dataBase)
+			, m_next(0)
+			, m_read(0)
+		{}
+		bool next(qreal& out)
+		{
+			if (m_next == m_values.size()) {
+				m_values = m_dataBase.readRange(m_read + 1, SQLiteDataBase::ChunkValues);
+				m_read += m_values.size();
+				m_next = 0;
+				if (m_values.isEmpty())
+					return false;
+			}
+			out = m_values.at(m_next++);
+			return true;
+		}
+	private:
+		SQLiteDataBase& m_dataBase;
+		QVector<qreal> m_values;
+		int m_next;
+		qint64 m_read;
+	};
+
+	explicit SQLiteBackend(SQLiteDataBase::Schema schema)
+		: m_dataBase(schema)
+	{}
+
+	static bool supports(Workload workload)
+	{
+		return workload == Workload::PushBack || workload == Workload::RandomAt || workload == Workload::FullScan;
+	}
+	void fill(const QVector<qreal>& values)
+	{
+		for (const qreal val : values)
+			m_dataBase.push_back(val);
+		m_dataBase.commit();
+	}
+	void push_back(qreal val) { m_dataBase.push_back(val); }
+	/* rowids count from 1 */
+	qreal at(qint64 index) { return m_dataBase.at(index + 1); }
+	qint64 size() const { return m_dataBase.size(); }
+	Scanner scan() { return Scanner(m_dataBase); }
+
+	/* never called, see supports() */
+	void insert(qint64, qreal) {}
+	void removeAt(qint64) {}
+	void copyThenDetach(qreal) {}
+
+private:
+	SQLiteDataBase m_dataBase;
+};
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	Suite suite;
+	if (!suite.parse(app))
+		return 1;
+	suite.run<qreal>(QStringLiteral("sqlite"), [] { return std::make_unique<SQLiteBackend>(SQLiteDataBase::RowPerValue); });
+	suite.run<qreal>(QStringLiteral("sqlite_chunked"), [] { return std::make_unique<SQLiteBackend>(SQLiteDataBase::ChunkedBlob); });
+	return suite.write() ? 0 : 1;
+}
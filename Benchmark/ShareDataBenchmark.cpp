@@ -0,0 +1,16 @@
+#include "HugeVector.h"
+#include "BenchmarkSuite.h"
+
+using namespace HugeBenchmark;
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	Suite suite;
+	if (!suite.parse(app))
+		return 1;
+	suite.run<qreal>(QStringLiteral("sharedata"), [] { return std::make_unique<ContainerBackend<HugeContainers::HugeContainer, qreal>>(); });
+	suite.run<Pod64>(QStringLiteral("sharedata"), [] { return std::make_unique<ContainerBackend<HugeContainers::HugeContainer, Pod64>>(); });
+	suite.run<QString>(QStringLiteral("sharedata"), [] { return std::make_unique<ContainerBackend<HugeContainers::HugeContainer, QString>>(); });
+	return suite.write() ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+#pragma once
+#ifndef hugecontainer_algorithms_h__
+#define hugecontainer_algorithms_h__
+
+/*
+   Algorithms working through the public API of HugeContainer, the same for
+   every backend. Included at the end of each backend's HugeVector.h, once
+   HugeContainer is defined.
+*/
+#include "HugeContainerCommon.h"
+
+
+namespace HugeContainers {
+	/*
+	   Elements each call of the parallel algorithms below reads and processes
+	   at once: enough for a read to cover many of them, few enough for the
+	   threads to share out the work evenly.
+	*/
+	enum { ParallelChunk = 1 << 14 };
+
+	/*
+	   calls fn(index, value) for every element of container, on up to threads
+	   threads. Each thread reads a chunk of elements at a time into a buffer
+	   of its own; the files are read with positional reads, so the threads
+	   share no file offset and decode nothing through a shared buffer. fn
+	   runs on several threads at once, in no particular order, and the
+	   container must not change meanwhile. False if a read failed.
+	*/
+	template <class ValueType, class Fn>
+	bool parallelForEach(const HugeContainer<ValueType>& container, Fn fn, int threads = QThread::idealThreadCount())
+	{
+		const int total = container.size();
+		const int chunks = (total + ParallelChunk - 1) / ParallelChunk;
+		return runParallelWith<QVector<ValueType> >(chunks, threads, [&container, &fn, total](int chunk, QVector<ValueType>& values) -> bool {
+			const int first = chunk * ParallelChunk;
+			values.resize(qMin(int(ParallelChunk), total - first));
+			if (!container.readRange(first, values.size(), values.begin()))
+				return false;
+			for (int i = 0; i < values.size(); ++i)
+				fn(first + i, values.at(i));
+			return true;
+		});
+	}
+
+	/*
+	   folds every element into a copy of init with acc = op(acc, value), a
+	   chunk of elements per call on up to threads threads, then folds the
+	   results of the chunks, in index order, into init with
+	   combine(acc, chunkResult). init must leave the result alone when
+	   combined (0 for a sum, 1 for a product): every chunk starts from it.
+	   Since the chunks do not depend on the threads, the result is the same
+	   from one run to the next, floating point sums included.
+	   *ok, when given, tells whether every read succeeded.
+	*/
+	template <class ValueType, class T, class Op, class Combine>
+	T parallelReduce(const HugeContainer<ValueType>& container, T init, Op op, Combine combine, bool* ok = nullptr, int threads = QThread::idealThreadCount())
+	{
+		const int total = container.size();
+		const int chunks = (total + ParallelChunk - 1) / ParallelChunk;
+		std::vector<T> partials(size_t(chunks), init);
+		const bool read = runParallelWith<QVector<ValueType> >(chunks, threads, [&](int chunk, QVector<ValueType>& values) -> bool {
+			const int first = chunk * ParallelChunk;
+			values.resize(qMin(int(ParallelChunk), total - first));
+			if (!container.readRange(first, values.size(), values.begin()))
+				return false;
+			T& acc = partials[size_t(chunk)];
+			for (const ValueType& val : values)
+				acc = op(acc, val);
+			return true;
+		});
+		if (ok)
+			*ok = read;
+		for (const T& partial : partials)
+			init = combine(init, partial);
+		return init;
+	}
+
+	//! Same as above when op also combines the results of the chunks, as a sum or a max does
+	template <class ValueType, class T, class Op>
+	T parallelReduce(const HugeContainer<ValueType>& container, T init, Op op, bool* ok = nullptr, int threads = QThread::idealThreadCount())
+	{
+		return parallelReduce(container, init, op, op, ok, threads);
+	}
+
+	/*
+	   replaces the content of dst with fn(value) for every element of src,
+	   in the same order. The threads read and transform a batch of chunks,
+	   a chunk per call with a read buffer per thread, then the batch is
+	   appended to dst in one go and the next one starts: at most threads
+	   chunks of results are held in RAM. fn runs on several threads at once
+	   and src must not change meanwhile; dst must be another container.
+	   False if a read or a write failed, dst then holds the batches done so far.
+	*/
+	template <class ValueType, class OutputType, class Fn>
+	bool parallelTransform(const HugeContainer<ValueType>& src, HugeContainer<OutputType>& dst, Fn fn, int threads = QThread::idealThreadCount())
+	{
+		Q_ASSERT_X(static_cast<const void*>(&src) != static_cast<const void*>(&dst), "parallelTransform", "src and dst must be different containers");
+		dst.clear();
+		threads = qMax(threads, 1);
+		const int total = src.size();
+		const int chunks = (total + ParallelChunk - 1) / ParallelChunk;
+		std::vector<QVector<OutputType> > batch(static_cast<size_t>(threads));
+		for (int batchFirst = 0; batchFirst < chunks; batchFirst += threads) {
+			const int batchChunks = qMin(threads, chunks - batchFirst);
+			const bool read = runParallelWith<QVector<ValueType> >(batchChunks, threads, [&](int slot, QVector<ValueType>& values) -> bool {
+				const int first = (batchFirst + slot) * ParallelChunk;
+				values.resize(qMin(int(ParallelChunk), total - first));
+				if (!src.readRange(first, values.size(), values.begin()))
+					return false;
+				QVector<OutputType>& results = batch[size_t(slot)];
+				results.resize(values.size());
+				for (int i = 0; i < values.size(); ++i)
+					results[i] = fn(values.at(i));
+				return true;
+			});
+			if (!read)
+				return false;
+			for (int slot = 0; slot < batchChunks; ++slot) {
+				if (!dst.append(batch[size_t(slot)]))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	enum {
+		SortMemoryBytes = 256 << 20,	//!< default budget of sort() and stableSort()
+		MinMergeBuffer = 1 << 10	//!< elements read at once from every run while merging, at least
+	};
+
+	/*
+	   sorts run with comp: slices sorted on up to threads threads, then
+	   merged pairwise, the merges of a round running side by side as well
+	*/
+	template <class ValueType, class Compare>
+	void sortRun(QVector<ValueType>& run, Compare comp, bool stable, int threads)
+	{
+		const int slices = qBound(1, threads, qMax(1, run.size() / int(ParallelChunk)));
+		QVector<int> bounds;
+		for (int slice = 0; slice <= slices; ++slice)
+			bounds.append(int(qint64(run.size()) * slice / slices));
+		ValueType* data = run.data();
+		runParallel(slices, threads, [&](int slice) {
+			if (stable)
+				std::stable_sort(data + bounds.at(slice), data + bounds.at(slice + 1), comp);
+			else
+				std::sort(data + bounds.at(slice), data + bounds.at(slice + 1), comp);
+			return true;
+		});
+		for (int width = 1; width < slices; width *= 2) {
+			runParallel((slices + 2 * width - 1) / (2 * width), threads, [&](int merge) {
+				const int low = 2 * width * merge;
+				const int middle = low + width;
+				const int high = qMin(low + 2 * width, slices);
+				if (middle < high)
+					std::inplace_merge(data + bounds.at(low), data + bounds.at(middle), data + bounds.at(high), comp);
+				return true;
+			});
+		}
+	}
+
+	/*
+	   external merge sort. The elements are read in index order into runs of
+	   about memoryBytes (as counted by ElementFootprint), each run is sorted
+	   in RAM on up to threads threads and written to a temporary container,
+	   then the runs are merged with a heap into an emptyCopy() of the
+	   container, every run read and the result appended a buffer of
+	   memoryBytes / (runs + 1) at a time: the reads and the writes are large
+	   and sequential, and the container ends up with a new data file and
+	   index laid out in the sorted order. When everything fits in one run
+	   nothing is written twice. The sorted copy only replaces the content
+	   once it is complete, so the disk briefly holds the original, the runs
+	   and the result, and a failed read or write leaves the container as it
+	   was.
+	   Copies sharing the storage keep the old order, the settings of the
+	   container stay.
+	*/
+	template <class ValueType, class Compare>
+	bool sortContainer(HugeContainer<ValueType>& container, Compare comp, bool stable, qint64 memoryBytes, int threads)
+	{
+		const int total = container.size();
+		if (total < 2)
+			return true;
+		threads = qMax(threads, 1);
+		memoryBytes = qMax<qint64>(memoryBytes, 1);
+
+		/* runs follow each other in index order, which the merge relies on for stability */
+		std::vector<std::unique_ptr<HugeContainer<ValueType> > > runs;
+		QVector<ValueType> run;
+		qint64 footprint = 0;
+		for (int first = 0; first < total;) {
+			run.clear();
+			qint64 runBytes = 0;
+			while (first < total && runBytes < memoryBytes) {
+				const int count = qMin(int(ParallelChunk), total - first);
+				const int start = run.size();
+				if (!container.readRange(first, count, std::back_inserter(run)))
+					return false;
+				for (int i = start; i < run.size(); ++i)
+					runBytes += ElementFootprint<ValueType>::bytes(run.at(i));
+				first += count;
+			}
+			footprint += runBytes;
+			sortRun(run, comp, stable, threads);
+			if (first == total && runs.empty()) {
+				/* a single run is the result */
+				HugeContainer<ValueType> sorted = container.emptyCopy();
+				if (!sorted.append(run))
+					return false;
+				container.swap(sorted);
+				return true;
+			}
+			runs.push_back(std::make_unique<HugeContainer<ValueType> >());
+			if (!runs.back()->append(run))
+				return false;
+		}
+		run = QVector<ValueType>();
+
+		const int runCount = int(runs.size());
+		const qint64 averageBytes = qMax<qint64>(footprint / total, 1);
+		const int bufferElements = int(qBound<qint64>(MinMergeBuffer, memoryBytes / (runCount + 1) / averageBytes, ParallelChunk * 16));
+		struct Cursor
+		{
+			QVector<ValueType> m_buffer;
+			int m_next;
+			int m_read;	//!< elements of the run read so far
+		};
+		std::vector<Cursor> cursors(static_cast<size_t>(runCount));
+		auto refill = [&runs, &cursors, bufferElements](int index) {
+			Cursor& cursor = cursors[size_t(index)];
+			const HugeContainer<ValueType>& source = *runs[size_t(index)];
+			const int count = qMin(bufferElements, source.size() - cursor.m_read);
+			cursor.m_buffer.clear();
+			cursor.m_next = 0;
+			if (count <= 0 || !source.readRange(uint(cursor.m_read), count, std::back_inserter(cursor.m_buffer)))
+				return false;
+			cursor.m_read += count;
+			return true;
+		};
+
+		/* the heap holds the runs not yet exhausted, the one with the smallest head on top; ties go to the earlier run */
+		auto later = [&cursors, &comp](int left, int right) {
+			const ValueType& leftHead = cursors[size_t(left)].m_buffer.at(cursors[size_t(left)].m_next);
+			const ValueType& rightHead = cursors[size_t(right)].m_buffer.at(cursors[size_t(right)].m_next);
+			if (comp(rightHead, leftHead))
+				return true;
+			if (comp(leftHead, rightHead))
+				return false;
+			return left > right;
+		};
+		std::vector<int> heap;
+		heap.reserve(size_t(runCount));
+		for (int index = 0; index < runCount; ++index) {
+			cursors[size_t(index)].m_read = 0;
+			if (!refill(index))
+				return false;
+			heap.push_back(index);
+		}
+		std::make_heap(heap.begin(), heap.end(), later);
+
+		HugeContainer<ValueType> sorted = container.emptyCopy();
+		QVector<ValueType> output;
+		output.reserve(bufferElements);
+		while (!heap.empty()) {
+			std::pop_heap(heap.begin(), heap.end(), later);
+			const int index = heap.back();
+			Cursor& cursor = cursors[size_t(index)];
+			output.append(cursor.m_buffer.at(cursor.m_next++));
+			if (output.size() == bufferElements) {
+				if (!sorted.append(output))
+					return false;
+				output.clear();
+			}
+			if (cursor.m_next == cursor.m_buffer.size() && cursor.m_read < runs[size_t(index)]->size()) {
+				if (!refill(index))
+					return false;
+			}
+			if (cursor.m_next < cursor.m_buffer.size())
+				std::push_heap(heap.begin(), heap.end(), later);
+			else
+				heap.pop_back();
+		}
+		if (!sorted.append(output))
+			return false;
+		container.swap(sorted);
+		return true;
+	}
+
+	//! Sorts container with comp, see sortContainer(); equal elements may change order
+	template <class ValueType, class Compare>
+	bool sort(HugeContainer<ValueType>& container, Compare comp, qint64 memoryBytes = SortMemoryBytes, int threads = QThread::idealThreadCount())
+	{
+		return sortContainer(container, comp, false, memoryBytes, threads);
+	}
+
+	template <class ValueType>
+	bool sort(HugeContainer<ValueType>& container)
+	{
+		return sort(container, std::less<ValueType>());
+	}
+
+	//! Same as sort() with equal elements kept in their order
+	template <class ValueType, class Compare>
+	bool stableSort(HugeContainer<ValueType>& container, Compare comp, qint64 memoryBytes = SortMemoryBytes, int threads = QThread::idealThreadCount())
+	{
+		return sortContainer(container, comp, true, memoryBytes, threads);
+	}
+
+	template <class ValueType>
+	bool stableSort(HugeContainer<ValueType>& container)
+	{
+		return stableSort(container, std::less<ValueType>());
+	}
+
+}
+
+//! Writes the size and then every element, as QDataStream does for a QVector
+template <class ValueType>
+QDataStream& operator<<(QDataStream &out, const HugeContainers::HugeContainer<ValueType>& cont)
+{
+	out << quint32(cont.size());
+	for (const ValueType& val : cont)
+		out << val;
+	return out;
+}
+
+template <class ValueType>
+QDataStream& operator>>(QDataStream &in, HugeContainers::HugeContainer<ValueType>& cont)
+{
+	cont.clear();
+	quint32 count = 0;
+	in >> count;
+	QVector<ValueType> chunk;
+	while (count > 0 && in.status() == QDataStream::Ok) {
+		/* elements go in a chunk at a time so only one chunk is ever held in RAM */
+		chunk.resize(int(qMin<quint32>(count, 1 << 16)));
+		for (ValueType& val : chunk)
+			in >> val;
+		if (in.status() != QDataStream::Ok)
+			break;
+		if (!cont.append(chunk)) {
+			in.setStatus(QDataStream::WriteFailed);
+			break;
+		}
+		count -= chunk.size();
+	}
+	if (in.status() != QDataStream::Ok)
+		cont.clear();
+	return in;
+}
+#endif // hugecontainer_algorithms_h__
@@ -0,0 +1,1734 @@
+#pragma once
+#ifndef hugecontainer_common_h__
+#define hugecontainer_common_h__
+
+/*
+   What the TempFile and ShareData backends have in common: the files behind
+   the containers, the statistics, the element cache, the thread pool helpers
+   and the layout of the files written by save(). Each backend's HugeVector.h
+   includes it and adds its own storage and HugeContainer.
+*/
+
+#include <QDataStream>
+#include <QBuffer>
+#include <QDir>
+#include <QDirIterator>
+#include <qvector.h>
+#include <QSharedData>
+#include <QSharedDataPointer>
+#include <QExplicitlySharedDataPointer>
+#include <QTemporaryFile>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QHash>
+#include <QDebug>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <initializer_list>
+#include <iterator>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#if defined(Q_OS_UNIX)
+#include <cerrno>
+#include <unistd.h>
+#endif
+#if defined(Q_OS_LINUX)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+
+namespace HugeContainers {
+	template <class ValueType>
+	class HugeContainer;
+}
+
+template <class ValueType>
+QDataStream& operator<<(QDataStream &out, const HugeContainers::HugeContainer<ValueType>& cont);
+
+template <class ValueType>
+QDataStream& operator>>(QDataStream &in, HugeContainers::HugeContainer<ValueType>& cont);
+
+
+namespace HugeContainers {
+	//! Removes any leftover data from previous crashes
+	inline void cleanUp() {
+		QDirIterator cleanIter{ QDir::tempPath(), QStringList(QStringLiteral("HugeContainerData*")), QDir::Files | QDir::Writable | QDir::CaseSensitive | QDir::NoDotAndDotDot };
+		while (cleanIter.hasNext()) {
+			cleanIter.next();
+			QFile::remove(cleanIter.filePath());
+		}
+
+	}
+
+	//! A function run by a thread of QThreadPool::globalInstance()
+	class PoolTask : public QRunnable
+	{
+	public:
+		explicit PoolTask(std::function<void()> task)
+			: m_task(std::move(task))
+		{
+		}
+
+		void run() override
+		{
+			m_task();
+		}
+
+	private:
+		std::function<void()> m_task;
+	};
+
+	inline void startInPool(std::function<void()> task)
+	{
+		QThreadPool::globalInstance()->start(new PoolTask(std::move(task)));
+	}
+
+	/*
+	   calls work(i, state) for every i below count. The calling thread takes
+	   part, helped by up to threads - 1 tasks of QThreadPool::globalInstance()
+	   which each take the next i as soon as they are free, so no thread is
+	   created per call and a single call runs inline. Helpers the pool only
+	   starts once the calls ran out leave without touching work, which keeps
+	   a caller running on the pool itself from waiting on queued tasks.
+	   state is a default-constructed State belonging to the thread making
+	   the call, so what is kept there (a read buffer...) is reused from one
+	   call to the next and never shared. False if any call returned false,
+	   the calls not started yet are then skipped.
+	*/
+	template <class State, class Work>
+	bool runParallelWith(int count, int threads, Work work)
+	{
+		struct Progress
+		{
+			std::atomic<int> m_next{ 0 };
+			std::atomic<bool> m_failed{ false };
+			std::mutex m_mutex;
+			std::condition_variable m_idle;
+			int m_helping = 0;	//!< helpers still taking calls
+			bool m_closed = false;	//!< set once the caller is done, later helpers leave at once
+		};
+		const std::shared_ptr<Progress> progress = std::make_shared<Progress>();
+		auto drain = [&work, count](Progress& shared) {
+			State state = State();
+			for (int i = shared.m_next++; i < count && !shared.m_failed; i = shared.m_next++) {
+				if (!work(i, state))
+					shared.m_failed = true;
+			}
+		};
+		for (int i = 1; i < qMin(threads, count); ++i) {
+			startInPool([progress, drain]() {
+				{
+					std::lock_guard<std::mutex> lock(progress->m_mutex);
+					if (progress->m_closed)
+						return;
+					++progress->m_helping;
+				}
+				drain(*progress);
+				std::lock_guard<std::mutex> lock(progress->m_mutex);
+				if (--progress->m_helping == 0)
+					progress->m_idle.notify_all();
+			});
+		}
+		drain(*progress);
+		std::unique_lock<std::mutex> lock(progress->m_mutex);
+		progress->m_closed = true;
+		progress->m_idle.wait(lock, [&progress]() { return progress->m_helping == 0; });
+		return !progress->m_failed;
+	}
+
+	//! Same as runParallelWith() for calls work(i) needing no state of their own
+	template <class Work>
+	bool runParallel(int count, int threads, Work work)
+	{
+		return runParallelWith<int>(count, threads, [&work](int i, int&) { return work(i); });
+	}
+
+	/*
+	   Latencies counted in buckets of powers of two: bucket b holds the calls
+	   that took from 2^b up to 2^(b+1) nanoseconds, the last one everything
+	   longer than that.
+	*/
+	struct LatencyHistogram
+	{
+		enum { Buckets = 40 };
+
+		LatencyHistogram()
+		{
+			std::fill(m_counts, m_counts + Buckets, qint64(0));
+		}
+
+		qint64 count() const
+		{
+			return std::accumulate(m_counts, m_counts + Buckets, qint64(0));
+		}
+
+		//! Upper bound in nanoseconds of the bucket reached by rank (0.5, 0.99...) of the calls, 0 without calls
+		qint64 percentile(double rank) const
+		{
+			const double wanted = rank * count();
+			qint64 seen = 0;
+			for (int bucket = 0; bucket < Buckets; ++bucket) {
+				seen += m_counts[bucket];
+				if (seen > 0 && seen >= wanted)
+					return qint64(1) << (bucket + 1);
+			}
+			return 0;
+		}
+
+		qint64 m_counts[Buckets];
+	};
+
+	/*
+	   Snapshot returned by HugeContainer::stats(). The calls are those reaching
+	   the operating system: staged appends and accesses to mapped files are
+	   not counted.
+	*/
+	struct ContainerStats
+	{
+		ContainerStats()
+			: m_readCalls(0), m_readBytes(0), m_writeCalls(0), m_writeBytes(0), m_seeks(0)
+			, m_indexBytes(0), m_indexReadBytes(0), m_indexWriteBytes(0)
+			, m_liveBytes(0), m_deadBytes(0), m_cacheHits(0), m_cacheMisses(0)
+			, m_detachCopies(0), m_detachBytes(0)
+		{}
+
+		qint64 m_readCalls;	//!< of the data and index files together
+		qint64 m_readBytes;
+		qint64 m_writeCalls;
+		qint64 m_writeBytes;
+		qint64 m_seeks;
+		qint64 m_indexBytes;	//!< the index file of TempFile, the RAM of the block index of ShareData
+		qint64 m_indexReadBytes;	//!< share of m_readBytes read from an index file, none in ShareData
+		qint64 m_indexWriteBytes;
+		qint64 m_liveBytes;	//!< data bytes still referenced
+		qint64 m_deadBytes;	//!< data bytes left behind by removals, until compact() (TempFile) or new elements (ShareData) take them back
+		qint64 m_cacheHits;	//!< lookups of the element cache, while it is enabled
+		qint64 m_cacheMisses;
+		qint64 m_detachCopies;	//!< copies of the storage made by a change to a shared container
+		qint64 m_detachBytes;	//!< bytes of the segments shared with other copies that writes had to copy first
+		LatencyHistogram m_at;
+		LatencyHistogram m_pushBack;
+		LatencyHistogram m_insert;
+	};
+
+	/*
+	   Live counters behind ContainerStats. Concurrent readers update them at
+	   once, so they are relaxed atomics: they count, they order nothing.
+	   Defining HUGECONTAINER_NO_STATS compiles every update out.
+	*/
+	class FileCounters
+	{
+	public:
+		FileCounters()
+			: m_readCalls(0), m_readBytes(0), m_writeCalls(0), m_writeBytes(0), m_seeks(0), m_copyBytes(0)
+		{}
+
+		void read(qint64 bytes)
+		{
+			m_readCalls.fetch_add(1, std::memory_order_relaxed);
+			m_readBytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		void write(qint64 bytes)
+		{
+			m_writeCalls.fetch_add(1, std::memory_order_relaxed);
+			m_writeBytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		void seek()
+		{
+			m_seeks.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		//! Bytes of shared segments copied before a write, see ContainerFile
+		void copy(qint64 bytes)
+		{
+			m_copyBytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+
+		void addTo(ContainerStats& stats) const
+		{
+			stats.m_readCalls += m_readCalls.load(std::memory_order_relaxed);
+			stats.m_readBytes += m_readBytes.load(std::memory_order_relaxed);
+			stats.m_writeCalls += m_writeCalls.load(std::memory_order_relaxed);
+			stats.m_writeBytes += m_writeBytes.load(std::memory_order_relaxed);
+			stats.m_seeks += m_seeks.load(std::memory_order_relaxed);
+			stats.m_detachBytes += m_copyBytes.load(std::memory_order_relaxed);
+		}
+
+		qint64 readBytes() const { return m_readBytes.load(std::memory_order_relaxed); }
+		qint64 writeBytes() const { return m_writeBytes.load(std::memory_order_relaxed); }
+		qint64 copyBytes() const { return m_copyBytes.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<qint64> m_readCalls;
+		std::atomic<qint64> m_readBytes;
+		std::atomic<qint64> m_writeCalls;
+		std::atomic<qint64> m_writeBytes;
+		std::atomic<qint64> m_seeks;
+		std::atomic<qint64> m_copyBytes;
+	};
+
+	class LatencyRecorder
+	{
+	public:
+		LatencyRecorder()
+		{
+			for (std::atomic<qint64>& count : m_counts)
+				count.store(0, std::memory_order_relaxed);
+		}
+
+		void record(qint64 nanoseconds)
+		{
+			const int bucket = 63 - qCountLeadingZeroBits(quint64(qMax<qint64>(nanoseconds, 1)));
+			m_counts[qMin(bucket, int(LatencyHistogram::Buckets) - 1)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		LatencyHistogram snapshot() const
+		{
+			LatencyHistogram result;
+			for (int bucket = 0; bucket < LatencyHistogram::Buckets; ++bucket)
+				result.m_counts[bucket] = m_counts[bucket].load(std::memory_order_relaxed);
+			return result;
+		}
+
+	private:
+		std::atomic<qint64> m_counts[LatencyHistogram::Buckets];
+	};
+
+	/*
+	   Element types stored as raw fixed-width records: element i lives at
+	   i * sizeof(ValueType) in the data file and needs no entry in the index.
+	   Specialize to std::false_type for trivially copyable types that must
+	   still go through their QDataStream operators.
+	*/
+	template <class ValueType>
+	struct UseFixedWidthStorage : std::integral_constant<bool, std::is_trivially_copyable<ValueType>::value> {};
+
+	/*
+	   Approximate bytes an element takes in RAM, what the memory budget of
+	   HugeContainer counts. Specialize for types owning memory on the heap.
+	*/
+	template <class ValueType>
+	struct ElementFootprint
+	{
+		static qint64 bytes(const ValueType&) { return sizeof(ValueType); }
+	};
+
+	template <>
+	struct ElementFootprint<QString>
+	{
+		static qint64 bytes(const QString& val) { return sizeof(QString) + qint64(val.size()) * sizeof(QChar); }
+	};
+
+	template <>
+	struct ElementFootprint<QByteArray>
+	{
+		static qint64 bytes(const QByteArray& val) { return sizeof(QByteArray) + val.size(); }
+	};
+
+	/*
+	   Decoded elements kept in RAM under a byte budget, keyed by the offset
+	   of their record in the data file. Eviction follows the CLOCK policy:
+	   the hand skips (and clears) recently referenced entries and drops the
+	   first one that was not read since the hand last passed over it.
+	   Costs are approximate: the slot itself plus the size of the record.
+	*/
+	template <class ValueType>
+	class ElementCache
+	{
+	public:
+		ElementCache()
+			: m_budget(0)
+			, m_used(0)
+			, m_hand(0)
+		{}
+
+		qint64 budget() const { return m_budget; }
+		qint64 usedBytes() const { return m_used; }
+		bool isEnabled() const { return m_budget > 0; }
+
+		void setBudget(qint64 bytes)
+		{
+			m_budget = qMax<qint64>(bytes, 0);
+			while (m_used > m_budget && !m_slots.isEmpty())
+				evictOne();
+		}
+
+		//! Cost charged against the budget for a record of recordSize bytes
+		static qint64 cost(qint64 recordSize)
+		{
+			return qint64(sizeof(Slot)) + recordSize;
+		}
+
+		bool find(qint64 key, ValueType& val)
+		{
+			const auto slotIter = m_lookup.constFind(key);
+			if (slotIter == m_lookup.constEnd())
+				return false;
+			Slot& slot = m_slots[slotIter.value()];
+			slot.m_referenced = true;
+			val = slot.m_value;
+			return true;
+		}
+
+		void insert(qint64 key, const ValueType& val, qint64 cost)
+		{
+			if (cost > m_budget)
+				return;
+			remove(key);
+			while (m_used + cost > m_budget && !m_slots.isEmpty())
+				evictOne();
+			m_lookup.insert(key, m_slots.size());
+			m_slots.append(Slot(key, cost, val));
+			m_used += cost;
+		}
+
+		void remove(qint64 key)
+		{
+			const auto slotIter = m_lookup.constFind(key);
+			if (slotIter != m_lookup.constEnd())
+				removeSlot(slotIter.value());
+		}
+
+		//! Drops every entry whose record starts at or after key
+		void removeFrom(qint64 key)
+		{
+			for (int i = m_slots.size() - 1; i >= 0; --i) {
+				if (m_slots.at(i).m_key >= key)
+					removeSlot(i);
+			}
+		}
+
+		void clear()
+		{
+			m_slots.clear();
+			m_lookup.clear();
+			m_used = 0;
+			m_hand = 0;
+		}
+
+	private:
+		struct Slot
+		{
+			Slot()
+				: m_key(-1), m_cost(0), m_referenced(false)
+			{}
+			Slot(qint64 key, qint64 cost, const ValueType& val)
+				: m_key(key), m_cost(cost), m_referenced(false), m_value(val)
+			{}
+			qint64 m_key;
+			qint64 m_cost;
+			bool m_referenced;
+			ValueType m_value;
+		};
+
+		void evictOne()
+		{
+			for (;;) {
+				if (m_hand >= m_slots.size())
+					m_hand = 0;
+				Slot& slot = m_slots[m_hand];
+				if (!slot.m_referenced) {
+					removeSlot(m_hand);
+					return;
+				}
+				slot.m_referenced = false;
+				++m_hand;
+			}
+		}
+
+		/* the last slot takes the place of the removed one so the ring stays dense */
+		void removeSlot(int index)
+		{
+			m_used -= m_slots.at(index).m_cost;
+			m_lookup.remove(m_slots.at(index).m_key);
+			const int last = m_slots.size() - 1;
+			if (index != last) {
+				m_slots[index] = m_slots.at(last);
+				m_lookup.insert(m_slots.at(index).m_key, index);
+			}
+			m_slots.removeLast();
+		}
+
+		QVector<Slot> m_slots;
+		QHash<qint64, int> m_lookup;
+		qint64 m_budget;
+		qint64 m_used;
+		int m_hand;
+	};
+
+	//! How a HugeContainer accesses its files
+	enum class StorageMode {
+		Buffered,	//!< every access is a read or write call on the file
+		Mapped		//!< files are memory-mapped and grown in large extents
+	};
+
+	/*
+	   Backing file of a HugeContainer. The content is a run of segments of
+	   SegmentBytes, each kept in a slot of a file: normally the temporary file
+	   of this ContainerFile, where segment i sits in slot i so the content is
+	   laid out as is. Every slot counts the ContainerFiles holding it, and
+	   copyFrom() makes a copy hold the slots of the original instead of
+	   copying any byte. Before writing to a segment another ContainerFile
+	   still holds, a file copies that segment to a slot of its own temporary
+	   file (cloned or copied by the kernel where the system can), so after a
+	   copy each side pays for the segments it changes and nothing more, and
+	   appends go to its own file. The content can also be a section of
+	   another file, see attach().
+	   In Mapped mode the own file is memory-mapped and grown in large
+	   extents, so it is accessed without any syscall. In Buffered mode appends
+	   are staged in RAM and written in one go once the write buffer fills up,
+	   reads of staged bytes are served from it. Slots of other files are read
+	   with positional reads, which need no lock against their owner: nobody
+	   writes to a slot somebody else holds.
+	*/
+	class ContainerFile
+	{
+	public:
+		enum { SegmentBytes = 64 << 10 };
+
+		explicit ContainerFile(StorageMode mode = StorageMode::Buffered)
+			: m_storages(1, std::make_shared<Storage>())
+			, m_held(1, 0)
+			, m_size(0)
+			, m_mode(StorageMode::Buffered)
+			, m_mapped(nullptr)
+			, m_capacity(0)
+			, m_written(0)
+			, m_flushed(0)
+			, m_bufferLimit(DefaultWriteBufferSize)
+			, m_counters(nullptr)
+		{
+			QTemporaryFile* file = new QTemporaryFile(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX"));
+			own().m_file.reset(file);
+			if (!file->open())
+				Q_ASSERT_X(false, "ContainerFile::ContainerFile", "Unable to create a temporary file");
+			setMode(mode);
+		}
+		/* staged bytes are dropped on purpose: nobody else holds them and the temporary file goes away with the last holder */
+		~ContainerFile()
+		{
+			releaseRefs(0);
+			unmapFile();
+		}
+		ContainerFile(const ContainerFile&) = delete;
+		ContainerFile& operator=(const ContainerFile&) = delete;
+
+		StorageMode mode() const { return m_mode; }
+
+		bool setMode(StorageMode mode)
+		{
+			if (mode == m_mode)
+				return true;
+			if (!flush())
+				return false;
+			if (mode == StorageMode::Mapped) {
+				m_mode = StorageMode::Mapped;
+				if (m_written > 0 && !reserve(m_written)) {
+					unmapFile();
+					m_mode = StorageMode::Buffered;
+					ownFile().resize(m_written);
+					return false;
+				}
+				return true;
+			}
+			/* back to plain file access: drop the mapping and the unused extent */
+			unmapFile();
+			m_mode = StorageMode::Buffered;
+			m_flushed = m_written;
+			return ownFile().resize(m_written);
+		}
+
+		qint64 writeBufferSize() const { return m_bufferLimit; }
+
+		//! Appends are staged until bytes are pending, 0 writes every append straight away
+		bool setWriteBufferSize(qint64 bytes)
+		{
+			m_bufferLimit = qMax<qint64>(bytes, 0);
+			if (m_pending.size() > m_bufferLimit)
+				return flush();
+			return true;
+		}
+
+		//! Writes the staged appends to the file, the content stays the same
+		bool flush() const
+		{
+			if (m_pending.isEmpty())
+				return true;
+			QMutexLocker locker(&own().m_seekLock);
+			countSeek();
+			if (!ownFile().seek(m_flushed))
+				return false;
+			/* Qt buffers writes too, they have to reach the file for the positional reads */
+			countWrite(m_pending.size());
+			if (ownFile().write(m_pending) != m_pending.size() || !ownFile().flush())
+				return false;
+			m_flushed += m_pending.size();
+			m_pending.clear();
+			return true;
+		}
+
+		bool isReadable() const { return ownFile().isReadable(); }
+		bool isWritable() const { return ownFile().isWritable(); }
+
+		//! Logical size in bytes, the extent reserved by Mapped mode is not counted
+		qint64 size() const { return m_size; }
+
+		bool resize(qint64 newSize)
+		{
+			if (Q_UNLIKELY(newSize < 0))
+				return false;
+			if (newSize <= m_size) {
+				if (!releaseSegments(int((newSize + SegmentBytes - 1) / SegmentBytes)))
+					return false;
+				m_size = newSize;
+				return true;
+			}
+			/* the new bytes read as zeros */
+			const QByteArray zeros(int(qMin<qint64>(newSize - m_size, ChunkSize)), '\0');
+			while (m_size < newSize) {
+				if (!write(m_size, zeros.constData(), qMin<qint64>(zeros.size(), newSize - m_size)))
+					return false;
+			}
+			return true;
+		}
+
+		bool read(qint64 pos, char* data, qint64 len) const
+		{
+			if (Q_UNLIKELY(pos < 0 || len < 0 || pos + len > m_size))
+				return false;
+			return forEachRun(pos, len, [this, &data](int storage, qint64 at, qint64 step) {
+				if (!readSlots(storage, at, data, step))
+					return false;
+				data += step;
+				return true;
+			});
+		}
+
+		QByteArray read(qint64 pos, qint64 len) const
+		{
+			QByteArray result;
+			result.resize(int(len));
+			if (!read(pos, result.data(), len))
+				result.clear();
+			return result;
+		}
+
+		//! Direct pointer to the len bytes at pos, nullptr unless they lie in one mapped run of slots
+		const char* mappedData(qint64 pos, qint64 len) const
+		{
+			if (m_mode != StorageMode::Mapped || pos < 0 || len <= 0 || pos + len > m_size)
+				return nullptr;
+			const char* result = nullptr;
+			const bool single = forEachRun(pos, len, [this, &result, len](int storage, qint64 at, qint64 step) {
+				if (step != len)
+					return false;
+				result = mappedSlots(storage, at, len);
+				return true;
+			});
+			return single ? result : nullptr;
+		}
+
+		bool write(qint64 pos, const char* data, qint64 len)
+		{
+			if (Q_UNLIKELY(pos < 0 || pos > m_size || len < 0))
+				return false;
+			if (len == 0)
+				return true;
+			if (!ownSegments(pos, len, true))
+				return false;
+			const bool written = forEachRun(pos, len, [this, &data](int storage, qint64 at, qint64 step) {
+				Q_ASSERT(storage == 0);
+				Q_UNUSED(storage);
+				if (!writeOwn(at, data, step))
+					return false;
+				data += step;
+				return true;
+			});
+			if (!written)
+				return false;
+			m_size = qMax(m_size, pos + len);
+			return true;
+		}
+
+		//! Writes at the end of the file and returns where the block starts, -1 on failure
+		qint64 append(const char* data, qint64 len)
+		{
+			const qint64 pos = m_size;
+			if (!write(pos, data, len))
+				return -1;
+			return pos;
+		}
+		qint64 append(const QByteArray& block)
+		{
+			return append(block.constData(), block.size());
+		}
+
+		//! Copies len bytes from "from" to "to", the ranges may overlap
+		bool move(qint64 from, qint64 to, qint64 len)
+		{
+			if (from == to || len <= 0)
+				return true;
+			if (Q_UNLIKELY(from < 0 || to < 0 || from + len > m_size || to > m_size))
+				return false;
+			if (m_mode == StorageMode::Mapped) {
+				/* both ranges in one run of the own mapping: a single memmove, the ranges may share segments */
+				if (!ownSegments(to, len, false))
+					return false;
+				const qint64 target = ownRun(to, len);
+				if (target >= 0 && (target + len <= m_capacity || reserve(target + len))) {
+					const qint64 source = ownRun(from, len);
+					if (source >= 0) {
+						std::memmove(m_mapped + target, m_mapped + source, len);
+						m_written = qMax(m_written, target + len);
+						m_size = qMax(m_size, to + len);
+						return true;
+					}
+				}
+			}
+			if (!flush())
+				return false;
+			/* walk backwards when shifting right so that no byte is read after being overwritten */
+			QByteArray buffer;
+			const qint64 chunk = qMin(len, qint64(ChunkSize));
+			buffer.resize(chunk);
+			for (qint64 done = 0; done < len; done += chunk) {
+				const qint64 step = qMin(chunk, len - done);
+				const qint64 offset = (to > from) ? (len - done - step) : done;
+				if (!read(from + offset, buffer.data(), step))
+					return false;
+				if (!write(to + offset, buffer.constData(), step))
+					return false;
+			}
+			return true;
+		}
+
+		//! Hints the system that the file is about to be read front to back
+		void adviseSequential() const
+		{
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+			if (m_mapped)
+				::madvise(m_mapped, size_t(m_capacity), MADV_SEQUENTIAL);
+			else
+				::posix_fadvise(ownFile().handle(), 0, m_written, POSIX_FADV_SEQUENTIAL);
+			for (int i = 1; i < m_storages.size(); ++i) {
+				if (m_storages.at(i))
+					::posix_fadvise(m_storages.at(i)->m_file->handle(), m_storages.at(i)->m_origin, 0, POSIX_FADV_SEQUENTIAL);
+			}
+#endif
+		}
+
+		/*
+		  replaces the content with the one of other by holding its slots: no
+		  byte is copied, other only writes out what it staged. It costs
+		  O(segments) in RAM, each side then copies the segments it writes to.
+		*/
+		bool copyFrom(const ContainerFile& other)
+		{
+			if (&other == this)
+				return true;
+			if (!other.flush() || !releaseSegments(0))
+				return false;
+			QVector<int> storageOf(other.m_storages.size(), -1);
+			for (int i = 0; i < other.m_storages.size(); ++i) {
+				if (other.m_held.at(i) > 0)
+					storageOf[i] = holdStorage(other.m_storages.at(i));
+			}
+			m_segments.reserve(other.m_segments.size());
+			for (const Segment& segment : other.m_segments)
+				m_segments.append(Segment{ storageOf.at(segment.m_storage), segment.m_slot });
+			for (int i = 0; i < m_storages.size(); ++i) {
+				if (!m_storages.at(i))
+					continue;
+				Storage& storage = *m_storages.at(i);
+				QMutexLocker locker(&storage.m_lock);
+				for (const Segment& segment : m_segments) {
+					if (segment.m_storage == i) {
+						++storage.m_refs[int(segment.m_slot)];
+						++m_held[i];
+					}
+				}
+			}
+			m_size = other.m_size;
+			return true;
+		}
+
+		/*
+		  takes the len bytes at origin in fileName as the content, without
+		  copying them. That file is only ever read: a change copies the
+		  segments it touches to the temporary file
+		*/
+		bool attach(const QString& fileName, qint64 origin, qint64 len)
+		{
+			const std::shared_ptr<Storage> source = std::make_shared<Storage>();
+			source->m_file.reset(new QFile(fileName));
+			if (!source->m_file->open(QIODevice::ReadOnly))
+				return false;
+			if (origin < 0 || len < 0 || source->m_file->size() < origin + len)
+				return false;
+			if (!releaseSegments(0))
+				return false;
+			const int segments = int((len + SegmentBytes - 1) / SegmentBytes);
+			source->m_origin = origin;
+			source->m_length = len;
+			source->m_refs.fill(1, segments);
+			const int index = holdStorage(source);
+			for (int slot = 0; slot < segments; ++slot)
+				m_segments.append(Segment{ index, slot });
+			m_held[index] = segments;
+			m_size = len;
+			return true;
+		}
+
+		//! Where the calls reaching the file are counted, nullptr counts nothing
+		void setCounters(FileCounters* counters) { m_counters = counters; }
+
+	private:
+		enum : qint64 {
+			DefaultWriteBufferSize = 1 << 20,
+			ChunkSize = 1 << 20,
+			MinExtent = 1 << 20,
+			MaxExtent = 64 << 20
+		};
+
+		/* a file holding slots, shared by every ContainerFile holding some of them */
+		struct Storage
+		{
+			Storage() : m_origin(0), m_length(-1), m_mapped(nullptr) {}
+			~Storage()
+			{
+				if (m_mapped)
+					m_file->unmap(m_mapped);
+			}
+
+			std::unique_ptr<QFile> m_file;
+			qint64 m_origin;	//!< where slot 0 starts in the file
+			qint64 m_length;	//!< bytes of a section given to attach(), -1 for a temporary file
+			QVector<int> m_refs;	//!< ContainerFiles holding every slot, 0 for the free ones
+			QVector<qint64> m_freeSlots;
+			uchar* m_mapped;	//!< read-only mapping of an attached section, made once and never moved
+			QMutex m_lock;	//!< guards the counts, the free slots and the mapping
+			QMutex m_seekLock;	//!< seek and read or write must go together without positional reads
+		};
+
+		struct Segment
+		{
+			int m_storage;	//!< in m_storages
+			qint64 m_slot;
+		};
+
+		Storage& own() const { return *m_storages.first(); }
+		QFile& ownFile() const { return *own().m_file; }
+
+		/* grows the own file and its mapping: doubling up to MaxExtent, then MaxExtent at a time */
+		bool reserve(qint64 minCapacity)
+		{
+			Q_ASSERT(m_mode == StorageMode::Mapped);
+			if (minCapacity <= m_capacity && m_mapped)
+				return true;
+			qint64 newCapacity = qMax(m_capacity, qint64(MinExtent));
+			while (newCapacity < minCapacity)
+				newCapacity += qMin(newCapacity, qint64(MaxExtent));
+			unmapFile();
+			if (!ownFile().resize(newCapacity))
+				return false;
+			m_mapped = ownFile().map(0, newCapacity);
+			if (!m_mapped)
+				return false;
+			m_capacity = newCapacity;
+			return true;
+		}
+
+		void unmapFile()
+		{
+			if (m_mapped)
+				ownFile().unmap(m_mapped);
+			m_mapped = nullptr;
+			m_capacity = 0;
+		}
+
+		/*
+		  calls visit(storage, at, step) for the pieces of [pos, pos + len) lying
+		  in one run of consecutive slots of a file, at being the position in
+		  that file past its origin. False as soon as visit returns false.
+		*/
+		template <class Visit>
+		bool forEachRun(qint64 pos, qint64 len, Visit visit) const
+		{
+			while (len > 0) {
+				const int first = int(pos / SegmentBytes);
+				const Segment& segment = m_segments.at(first);
+				qint64 step = qMin<qint64>(len, SegmentBytes - pos % SegmentBytes);
+				for (int next = first + 1; step < len; ++next) {
+					const Segment& following = m_segments.at(next);
+					if (following.m_storage != segment.m_storage || following.m_slot != segment.m_slot + (next - first))
+						break;
+					step += qMin<qint64>(len - step, SegmentBytes);
+				}
+				if (!visit(segment.m_storage, segment.m_slot * SegmentBytes + pos % SegmentBytes, step))
+					return false;
+				pos += step;
+				len -= step;
+			}
+			return true;
+		}
+
+		//! Where [pos, pos + len) starts in the own file if it lies there in one run, else -1
+		qint64 ownRun(qint64 pos, qint64 len) const
+		{
+			qint64 result = -1;
+			const bool single = forEachRun(pos, len, [&result, len](int storage, qint64 at, qint64 step) {
+				if (storage != 0 || step != len)
+					return false;
+				result = at;
+				return true;
+			});
+			return single ? result : -1;
+		}
+
+		bool readSlots(int storage, qint64 at, char* data, qint64 len) const
+		{
+			if (storage != 0)
+				return readFile(*m_storages.at(storage), at, data, len);
+			if (m_mapped) {
+				std::memcpy(data, m_mapped + at, len);
+				return true;
+			}
+			/* the part past m_flushed is still in the write buffer */
+			const qint64 fromFile = qBound<qint64>(0, m_flushed - at, len);
+			if (fromFile > 0 && !readFile(own(), at, data, fromFile))
+				return false;
+			if (fromFile < len)
+				std::memcpy(data + fromFile, m_pending.constData() + (at + fromFile - m_flushed), len - fromFile);
+			return true;
+		}
+
+		/* the own mapping, or the one of an attached section, which is made on first use */
+		const char* mappedSlots(int storage, qint64 at, qint64 len) const
+		{
+			if (storage == 0)
+				return m_mapped ? reinterpret_cast<const char*>(m_mapped) + at : nullptr;
+			Storage& source = *m_storages.at(storage);
+			if (source.m_length < 0)
+				return nullptr;
+			QMutexLocker locker(&source.m_lock);
+			if (!source.m_mapped && source.m_length > 0)
+				source.m_mapped = source.m_file->map(source.m_origin, source.m_length);
+			if (!source.m_mapped || at + len > source.m_length)
+				return nullptr;
+			return reinterpret_cast<const char*>(source.m_mapped) + at;
+		}
+
+		/* positional reads leave the offset of the file alone, so any number of readers can run at once */
+		bool readFile(Storage& storage, qint64 pos, char* data, qint64 len) const
+		{
+			QFile& file = *storage.m_file;
+			pos += storage.m_origin;
+			countRead(len);
+#if defined(Q_OS_UNIX)
+			while (len > 0) {
+				const ssize_t done = ::pread(file.handle(), data, size_t(len), off_t(pos));
+				if (done < 0 && errno == EINTR)
+					continue;
+				if (done <= 0)
+					return false;
+				data += done;
+				pos += done;
+				len -= done;
+			}
+			return true;
+#else
+			QMutexLocker locker(&storage.m_seekLock);
+			countSeek();
+			return file.seek(pos) && file.read(data, len) == len;
+#endif
+		}
+
+		/* writes to slots of the own file nobody else holds, see ownSegments() */
+		bool writeOwn(qint64 pos, const char* data, qint64 len)
+		{
+			if (m_mode == StorageMode::Mapped) {
+				if (pos + len > m_capacity && !reserve(pos + len))
+					return false;
+				std::memcpy(m_mapped + pos, data, len);
+			}
+			else if (pos == m_written && len < m_bufferLimit) {
+				if (m_pending.size() + len > m_bufferLimit && !flush())
+					return false;
+				m_pending.append(data, int(len));
+			}
+			else if (pos >= m_flushed && pos + len <= m_written) {
+				/* lands on bytes still staged, they are updated in place */
+				std::memcpy(m_pending.data() + (pos - m_flushed), data, len);
+			}
+			else {
+				/* anything but a small append goes to the file, after what is staged */
+				if (!flush())
+					return false;
+				QMutexLocker locker(&own().m_seekLock);
+				countSeek();
+				if (!ownFile().seek(pos))
+					return false;
+				countWrite(len);
+				if (ownFile().write(data, len) != len || !ownFile().flush())
+					return false;
+				m_flushed = qMax(m_flushed, pos + len);
+			}
+			m_written = qMax(m_written, pos + len);
+			return true;
+		}
+
+		/*
+		  gives the segments [pos, pos + len) touches slots of the own file
+		  nobody else holds: segments past the end get new ones, shared or
+		  attached ones are copied first, unless replaced tells that all of
+		  [pos, pos + len) gets written before any of it is read again
+		*/
+		bool ownSegments(qint64 pos, qint64 len, bool replaced)
+		{
+			const int last = int((pos + len - 1) / SegmentBytes);
+			for (int segment = int(pos / SegmentBytes); segment <= last; ++segment) {
+				if (segment == m_segments.size()) {
+					m_segments.append(Segment{ 0, allocateSlot(segment) });
+					++m_held[0];
+					continue;
+				}
+				if (isExclusive(m_segments.at(segment)))
+					continue;
+				const qint64 begin = qint64(segment) * SegmentBytes;
+				const qint64 used = qMin<qint64>(SegmentBytes, m_size - begin);
+				const bool covered = replaced && pos <= begin && pos + len >= begin + used;
+				if (!copySegment(segment, covered ? 0 : used))
+					return false;
+			}
+			return true;
+		}
+
+		bool isExclusive(const Segment& segment) const
+		{
+			if (segment.m_storage != 0)
+				return false;
+			/* nobody else holding the own file holds none of its slots either */
+			if (m_storages.first().use_count() == 1)
+				return true;
+			QMutexLocker locker(&own().m_lock);
+			return own().m_refs.at(int(segment.m_slot)) == 1;
+		}
+
+		/* a free slot of the own file for segment, the one keeping the layout as is if it can */
+		qint64 allocateSlot(int segment)
+		{
+			Storage& storage = own();
+			QMutexLocker locker(&storage.m_lock);
+			qint64 slot = segment;
+			if (slot < storage.m_refs.size() && storage.m_refs.at(segment) == 0)
+				storage.m_freeSlots.removeOne(slot);
+			else if (slot != storage.m_refs.size())
+				slot = storage.m_freeSlots.isEmpty() ? storage.m_refs.size() : storage.m_freeSlots.takeLast();
+			if (slot == storage.m_refs.size())
+				storage.m_refs.append(0);
+			storage.m_refs[int(slot)] = 1;
+			return slot;
+		}
+
+		/* moves segment to a slot of its own, with a copy of the first used bytes it held */
+		bool copySegment(int segment, qint64 used)
+		{
+			const Segment old = m_segments.at(segment);
+			const qint64 slot = allocateSlot(segment);
+			if (used > 0 && !copySlot(old, slot * SegmentBytes, used)) {
+				releaseSlot(0, slot);
+				return false;
+			}
+			m_segments[segment] = Segment{ 0, slot };
+			++m_held[0];
+			releaseSlot(old.m_storage, old.m_slot);
+			--m_held[old.m_storage];
+			if (old.m_storage != 0 && m_held.at(old.m_storage) == 0)
+				m_storages[old.m_storage].reset();
+			countCopy(used);
+			return true;
+		}
+
+		/* copies len bytes of the slot of from to the own file at to, by the kernel when it can */
+		bool copySlot(const Segment& from, qint64 to, qint64 len)
+		{
+			if (m_mode == StorageMode::Buffered) {
+				if (!flush())
+					return false;
+				if (cloneSlot(*m_storages.at(from.m_storage), from.m_slot * SegmentBytes, to, len)) {
+					m_written = qMax(m_written, to + len);
+					m_flushed = m_written;
+					return true;
+				}
+			}
+			QByteArray buffer;
+			buffer.resize(int(len));
+			return readSlots(from.m_storage, from.m_slot * SegmentBytes, buffer.data(), len)
+				&& writeOwn(to, buffer.constData(), len);
+		}
+
+		/*
+		  shares the blocks on filesystems that can (btrfs, XFS), which only
+		  works on whole blocks, else has the kernel copy them. False if neither
+		  did, the caller then copies through a buffer.
+		*/
+		bool cloneSlot(Storage& source, qint64 pos, qint64 to, qint64 len) const
+		{
+#if defined(Q_OS_LINUX)
+			const int sourceHandle = source.m_file->handle();
+			const int target = ownFile().handle();
+			pos += source.m_origin;
+#ifdef FICLONERANGE
+			if (len == SegmentBytes) {
+				struct file_clone_range range;
+				range.src_fd = sourceHandle;
+				range.src_offset = quint64(pos);
+				range.src_length = quint64(len);
+				range.dest_offset = quint64(to);
+				if (::ioctl(target, FICLONERANGE, &range) == 0)
+					return true;
+			}
+#endif
+#ifdef SYS_copy_file_range
+			qint64 sourcePos = pos;
+			qint64 targetPos = to;
+			while (targetPos < to + len) {
+				if (::syscall(SYS_copy_file_range, sourceHandle, &sourcePos, target, &targetPos, size_t(to + len - targetPos), 0u) <= 0)
+					return false;
+			}
+			return true;
+#endif
+#else
+			Q_UNUSED(source);
+			Q_UNUSED(pos);
+			Q_UNUSED(to);
+			Q_UNUSED(len);
+#endif
+			return false;
+		}
+
+		int holdStorage(const std::shared_ptr<Storage>& storage)
+		{
+			int free = -1;
+			for (int i = 0; i < m_storages.size(); ++i) {
+				if (m_storages.at(i) == storage)
+					return i;
+				if (!m_storages.at(i) && free < 0)
+					free = i;
+			}
+			if (free >= 0) {
+				m_storages[free] = storage;
+				return free;
+			}
+			m_storages.append(storage);
+			m_held.append(0);
+			return m_storages.size() - 1;
+		}
+
+		void releaseSlot(int storage, qint64 slot)
+		{
+			Storage& owner = *m_storages.at(storage);
+			QMutexLocker locker(&owner.m_lock);
+			if (--owner.m_refs[int(slot)] == 0)
+				owner.m_freeSlots.append(slot);
+		}
+
+		/* lets go of the segments from keep on, without touching any file */
+		void releaseRefs(int keep)
+		{
+			for (int i = 0; i < m_storages.size(); ++i) {
+				if (!m_storages.at(i))
+					continue;
+				Storage& storage = *m_storages.at(i);
+				QMutexLocker locker(&storage.m_lock);
+				for (int segment = keep; segment < m_segments.size(); ++segment) {
+					const Segment& held = m_segments.at(segment);
+					if (held.m_storage == i && --storage.m_refs[int(held.m_slot)] == 0)
+						storage.m_freeSlots.append(held.m_slot);
+					if (held.m_storage == i)
+						--m_held[i];
+				}
+			}
+			m_segments.resize(keep);
+		}
+
+		/* same, then drops the files nothing is held from and gives back the free end of the own one */
+		bool releaseSegments(int keep)
+		{
+			releaseRefs(keep);
+			for (int i = 1; i < m_storages.size(); ++i) {
+				if (m_held.at(i) == 0)
+					m_storages[i].reset();
+			}
+			return trimOwn();
+		}
+
+		bool trimOwn()
+		{
+			Storage& storage = own();
+			qint64 end = 0;
+			{
+				QMutexLocker locker(&storage.m_lock);
+				int slots = storage.m_refs.size();
+				while (slots > 0 && storage.m_refs.at(slots - 1) == 0)
+					--slots;
+				if (slots == storage.m_refs.size())
+					return true;
+				storage.m_refs.resize(slots);
+				storage.m_freeSlots.erase(std::remove_if(storage.m_freeSlots.begin(), storage.m_freeSlots.end(),
+					[slots](qint64 slot) { return slot >= slots; }), storage.m_freeSlots.end());
+				end = qMin(m_written, qint64(slots) * SegmentBytes);
+			}
+			if (end >= m_written)
+				return true;
+			m_written = end;
+			/* a mapped file keeps its extent, staged bytes past the end are dropped */
+			if (m_mode == StorageMode::Mapped)
+				return true;
+			if (end >= m_flushed) {
+				m_pending.truncate(int(end - m_flushed));
+				return true;
+			}
+			m_pending.clear();
+			m_flushed = end;
+			QMutexLocker locker(&storage.m_seekLock);
+			return ownFile().resize(end);
+		}
+
+#ifndef HUGECONTAINER_NO_STATS
+		void countRead(qint64 bytes) const { if (m_counters) m_counters->read(bytes); }
+		void countWrite(qint64 bytes) const { if (m_counters) m_counters->write(bytes); }
+		void countSeek() const { if (m_counters) m_counters->seek(); }
+		void countCopy(qint64 bytes) const { if (m_counters) m_counters->copy(bytes); }
+#else
+		void countRead(qint64) const {}
+		void countWrite(qint64) const {}
+		void countSeek() const {}
+		void countCopy(qint64) const {}
+#endif
+
+		QVector<std::shared_ptr<Storage> > m_storages;	//!< the own temporary file first, then the files slots are held from; null once none is
+		QVector<qint64> m_held;	//!< segments held from every file of m_storages
+		QVector<Segment> m_segments;
+		qint64 m_size;
+		StorageMode m_mode;
+		uchar* m_mapped;	//!< mapping of the own file
+		qint64 m_capacity;
+		qint64 m_written;	//!< end of what was written to the own file, staged bytes included
+		mutable QByteArray m_pending;
+		mutable qint64 m_flushed;
+		qint64 m_bufferLimit;
+		FileCounters* m_counters;	//!< owned by the container, null while its statistics are off
+	};
+
+	/*
+	   Sequence of fixed-size records split into pages, with an order-statistic
+	   B+tree on top. The internal nodes live in RAM and count the records
+	   below every child, the pages themselves belong to the PageStore. Reading,
+	   inserting or removing the record at a position walks O(log n) nodes and
+	   touches one page, two when the page has to be split or merged. A copy
+	   clones the nodes and copies the PageStore.
+	*/
+	template <class Record, class PageStore>
+	class PagedSequence
+	{
+	public:
+		enum {
+			PageRecords = PageStore::PageRecords,
+			Fanout = 64		//!< children of an internal node before it splits
+		};
+
+		explicit PagedSequence(PageStore store = PageStore())
+			: m_store(std::move(store))
+			, m_root(new Node(true))
+		{
+		}
+		PagedSequence(const PagedSequence& other)
+			: m_store(other.m_store)
+			, m_root(other.m_root->clone(nullptr))
+		{
+		}
+		PagedSequence& operator=(const PagedSequence&) = delete;
+
+		qint64 size() const { return m_root->m_total; }
+
+		const PageStore& store() const { return m_store; }
+		PageStore& store() { return m_store; }
+
+		bool get(qint64 index, Record& record) const
+		{
+			Q_ASSERT(index >= 0 && index < size());
+			Node* node;
+			int slot, offset;
+			locate(index, node, slot, offset);
+			return m_store.read(node->m_pages.at(slot), offset, 1, &record);
+		}
+
+		bool set(qint64 index, const Record& record)
+		{
+			Q_ASSERT(index >= 0 && index < size());
+			Node* node;
+			int slot, offset;
+			locate(index, node, slot, offset);
+			return m_store.write(node->m_pages.at(slot), offset, 1, &record);
+		}
+
+		//! Copies the count records starting at first to out, one page read at a time
+		bool read(qint64 first, qint64 count, Record* out) const
+		{
+			if (count <= 0)
+				return true;
+			Q_ASSERT(first >= 0 && first + count <= size());
+			Node* node;
+			int slot, offset;
+			locate(first, node, slot, offset);
+			for (;;) {
+				const int step = int(qMin<qint64>(count, node->m_counts.at(slot) - offset));
+				if (!m_store.read(node->m_pages.at(slot), offset, step, out))
+					return false;
+				out += step;
+				count -= step;
+				if (count == 0)
+					return true;
+				offset = 0;
+				if (!nextPage(node, slot))
+					return false;
+			}
+		}
+
+		bool insert(qint64 index, const Record& record)
+		{
+			Q_ASSERT(index >= 0 && index <= size());
+			if (index == size())
+				return append(&record, 1);
+
+			Node* node;
+			int slot, offset;
+			locate(index, node, slot, offset);
+			if (node->m_counts.at(slot) == PageRecords) {
+				if (!splitPage(node, slot))
+					return false;
+				locate(index, node, slot, offset);
+			}
+
+			/* shift the rest of the page by one record */
+			const qint64 page = node->m_pages.at(slot);
+			const int tail = node->m_counts.at(slot) - offset;
+			m_buffer.resize(tail);
+			if (!m_store.read(page, offset, tail, m_buffer.data()) || !m_store.write(page, offset + 1, tail, m_buffer.data()))
+				return false;
+			if (!m_store.write(page, offset, 1, &record))
+				return false;
+			++node->m_counts[slot];
+			addToPath(node, 1);
+			return true;
+		}
+
+		//! Appends count records, filling the last page before starting new ones
+		bool append(const Record* records, qint64 count)
+		{
+			while (count > 0) {
+				Node* node = lastNode();
+				if (node->m_pages.isEmpty() || node->m_counts.last() == PageRecords) {
+					const qint64 page = m_store.allocatePage();
+					if (page < 0)
+						return false;
+					node->m_pages.append(page);
+					node->m_counts.append(0);
+					if (node->width() > Fanout) {
+						splitNode(node);
+						node = lastNode();
+					}
+				}
+				const int used = node->m_counts.last();
+				const int step = int(qMin<qint64>(count, PageRecords - used));
+				if (!m_store.write(node->m_pages.last(), used, step, records))
+					return false;
+				node->m_counts.last() += step;
+				addToPath(node, step);
+				records += step;
+				count -= step;
+			}
+			return true;
+		}
+
+		bool remove(qint64 index)
+		{
+			Q_ASSERT(index >= 0 && index < size());
+			Node* node;
+			int slot, offset;
+			locate(index, node, slot, offset);
+
+			const qint64 page = node->m_pages.at(slot);
+			const int tail = node->m_counts.at(slot) - offset - 1;
+			if (tail > 0) {
+				m_buffer.resize(tail);
+				if (!m_store.read(page, offset + 1, tail, m_buffer.data()) || !m_store.write(page, offset, tail, m_buffer.data()))
+					return false;
+			}
+			--node->m_counts[slot];
+			addToPath(node, -1);
+
+			if (node->m_counts.at(slot) == 0) {
+				m_store.releasePage(page);
+				node->m_pages.remove(slot);
+				node->m_counts.remove(slot);
+				pruneNode(node);
+			}
+			else if (node->m_counts.at(slot) < PageRecords / 4) {
+				/* a page running empty is folded into a neighbour with room for it */
+				if (slot + 1 < node->width() && node->m_counts.at(slot) + node->m_counts.at(slot + 1) <= PageRecords / 2)
+					return mergePages(node, slot);
+				if (slot > 0 && node->m_counts.at(slot - 1) + node->m_counts.at(slot) <= PageRecords / 2)
+					return mergePages(node, slot - 1);
+			}
+			return true;
+		}
+
+		void clear()
+		{
+			m_store.clear();
+			m_root.reset(new Node(true));
+		}
+
+		/*
+		  takes over count records the store already holds in order, PageRecords
+		  to a page from page 0 on. Only the nodes are built, no page is read.
+		*/
+		void adopt(qint64 count)
+		{
+			std::vector<std::unique_ptr<Node> > level;
+			for (qint64 page = 0; page * PageRecords < count; ++page) {
+				if (level.empty() || level.back()->width() == Fanout)
+					level.emplace_back(new Node(true));
+				Node* node = level.back().get();
+				const int records = int(qMin<qint64>(PageRecords, count - page * PageRecords));
+				node->m_pages.append(page);
+				node->m_counts.append(records);
+				node->m_total += records;
+			}
+			while (level.size() > 1) {
+				std::vector<std::unique_ptr<Node> > parents;
+				for (auto& child : level) {
+					if (parents.empty() || parents.back()->width() == Fanout)
+						parents.emplace_back(new Node(false));
+					child->m_parent = parents.back().get();
+					parents.back()->m_total += child->m_total;
+					parents.back()->m_children.push_back(std::move(child));
+				}
+				level.swap(parents);
+			}
+			if (level.empty())
+				m_root.reset(new Node(true));
+			else
+				m_root = std::move(level.front());
+		}
+
+	private:
+		struct Node
+		{
+			explicit Node(bool bottom)
+				: m_parent(nullptr)
+				, m_bottom(bottom)
+				, m_total(0)
+			{
+			}
+
+			int width() const { return m_bottom ? m_pages.size() : int(m_children.size()); }
+
+			int childIndex(const Node* child) const
+			{
+				for (int i = 0; i < int(m_children.size()); ++i) {
+					if (m_children[i].get() == child)
+						return i;
+				}
+				Q_UNREACHABLE();
+				return -1;
+			}
+
+			std::unique_ptr<Node> clone(Node* parent) const
+			{
+				std::unique_ptr<Node> result(new Node(m_bottom));
+				result->m_parent = parent;
+				result->m_total = m_total;
+				result->m_pages = m_pages;
+				result->m_counts = m_counts;
+				for (const auto& child : m_children)
+					result->m_children.push_back(child->clone(result.get()));
+				return result;
+			}
+
+			Node* m_parent;
+			bool m_bottom;		//!< the children are pages rather than nodes
+			qint64 m_total;		//!< records below this node
+			std::vector<std::unique_ptr<Node> > m_children;
+			QVector<qint64> m_pages;
+			QVector<int> m_counts;	//!< records in every page
+		};
+
+		/* bottom node, page slot and offset in the page of the record at index */
+		void locate(qint64 index, Node*& node, int& slot, int& offset) const
+		{
+			node = m_root.get();
+			while (!node->m_bottom) {
+				int child = 0;
+				const int last = int(node->m_children.size()) - 1;
+				while (child < last && index >= node->m_children[child]->m_total) {
+					index -= node->m_children[child]->m_total;
+					++child;
+				}
+				node = node->m_children[child].get();
+			}
+			slot = 0;
+			const int last = node->m_pages.size() - 1;
+			while (slot < last && index >= node->m_counts.at(slot)) {
+				index -= node->m_counts.at(slot);
+				++slot;
+			}
+			offset = int(index);
+		}
+
+		Node* lastNode() const
+		{
+			Node* node = m_root.get();
+			while (!node->m_bottom)
+				node = node->m_children.back().get();
+			return node;
+		}
+
+		bool nextPage(Node*& node, int& slot) const
+		{
+			if (slot + 1 < node->width()) {
+				++slot;
+				return true;
+			}
+			for (Node* child = node; child->m_parent; child = child->m_parent) {
+				Node* parent = child->m_parent;
+				const int next = parent->childIndex(child) + 1;
+				if (next < int(parent->m_children.size())) {
+					node = parent->m_children[next].get();
+					while (!node->m_bottom)
+						node = node->m_children.front().get();
+					slot = 0;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		static void addToPath(Node* node, qint64 delta)
+		{
+			for (; node; node = node->m_parent)
+				node->m_total += delta;
+		}
+
+		/* moves the upper half of a full page to a new page right after it */
+		bool splitPage(Node* node, int slot)
+		{
+			const qint64 page = node->m_pages.at(slot);
+			const int count = node->m_counts.at(slot);
+			const int half = count / 2;
+			const qint64 newPage = m_store.allocatePage();
+			if (newPage < 0)
+				return false;
+			m_buffer.resize(count - half);
+			if (!m_store.read(page, half, count - half, m_buffer.data()) || !m_store.write(newPage, 0, count - half, m_buffer.data())) {
+				m_store.releasePage(newPage);
+				return false;
+			}
+			node->m_counts[slot] = half;
+			node->m_pages.insert(slot + 1, newPage);
+			node->m_counts.insert(slot + 1, count - half);
+			if (node->width() > Fanout)
+				splitNode(node);
+			return true;
+		}
+
+		/* appends the page after slot to the one at slot, both are in the same node */
+		bool mergePages(Node* node, int slot)
+		{
+			const qint64 page = node->m_pages.at(slot);
+			const qint64 rightPage = node->m_pages.at(slot + 1);
+			const int count = node->m_counts.at(slot);
+			const int nextCount = node->m_counts.at(slot + 1);
+			m_buffer.resize(nextCount);
+			if (!m_store.read(rightPage, 0, nextCount, m_buffer.data()) || !m_store.write(page, count, nextCount, m_buffer.data()))
+				return false;
+			node->m_counts[slot] = count + nextCount;
+			node->m_pages.remove(slot + 1);
+			node->m_counts.remove(slot + 1);
+			m_store.releasePage(rightPage);
+			return true;
+		}
+
+		void splitNode(Node* node)
+		{
+			const int half = node->width() / 2;
+			std::unique_ptr<Node> sibling(new Node(node->m_bottom));
+			if (node->m_bottom) {
+				sibling->m_pages = node->m_pages.mid(half);
+				sibling->m_counts = node->m_counts.mid(half);
+				node->m_pages.resize(half);
+				node->m_counts.resize(half);
+				for (const int count : sibling->m_counts)
+					sibling->m_total += count;
+			}
+			else {
+				for (auto childIter = node->m_children.begin() + half; childIter != node->m_children.end(); ++childIter) {
+					(*childIter)->m_parent = sibling.get();
+					sibling->m_total += (*childIter)->m_total;
+					sibling->m_children.push_back(std::move(*childIter));
+				}
+				node->m_children.resize(half);
+			}
+			node->m_total -= sibling->m_total;
+
+			if (!node->m_parent) {
+				/* the root splits: the tree grows one level */
+				std::unique_ptr<Node> newRoot(new Node(false));
+				newRoot->m_total = node->m_total + sibling->m_total;
+				node->m_parent = newRoot.get();
+				sibling->m_parent = newRoot.get();
+				newRoot->m_children.push_back(std::move(m_root));
+				newRoot->m_children.push_back(std::move(sibling));
+				m_root = std::move(newRoot);
+				return;
+			}
+			Node* parent = node->m_parent;
+			sibling->m_parent = parent;
+			parent->m_children.insert(parent->m_children.begin() + parent->childIndex(node) + 1, std::move(sibling));
+			if (parent->width() > Fanout)
+				splitNode(parent);
+		}
+
+		/* drops nodes left without children and collapses a root with a single child */
+		void pruneNode(Node* node)
+		{
+			while (node->width() == 0 && node->m_parent) {
+				Node* parent = node->m_parent;
+				parent->m_children.erase(parent->m_children.begin() + parent->childIndex(node));
+				node = parent;
+			}
+			while (!m_root->m_bottom && m_root->m_children.size() == 1) {
+				std::unique_ptr<Node> child = std::move(m_root->m_children.front());
+				child->m_parent = nullptr;
+				m_root = std::move(child);
+			}
+			if (!m_root->m_bottom && m_root->m_children.empty())
+				m_root.reset(new Node(true));
+		}
+
+		PageStore m_store;
+		std::unique_ptr<Node> m_root;
+		std::vector<Record> m_buffer;
+	};
+
+
+	/*
+	   Header of a file written by HugeContainer::save(). It is followed by the
+	   index, one (position, size) pair of qint64 per element in the byte order
+	   of the machine that wrote it, padded to whole pages of IndexRecords
+	   entries, then by the data. Both sections start on a HeaderBytes boundary
+	   so they can be mapped, or cloned, straight from the file.
+	   Fixed-width elements have no index, their records make up the data.
+	*/
+	struct ContainerFileHeader
+	{
+		enum : quint32 {
+			Magic = 0x48554745,	//!< "HUGE"
+			Version = 1
+		};
+		enum {
+			HeaderBytes = 4096,
+			IndexRecords = 1024,
+			IndexEntryBytes = 2 * sizeof(qint64)
+		};
+
+		ContainerFileHeader()
+			: m_version(Version)
+			, m_littleEndian(Q_BYTE_ORDER == Q_LITTLE_ENDIAN)
+			, m_streamVersion(QDataStream().version())
+			, m_recordSize(0)
+			, m_count(0)
+			, m_indexOffset(HeaderBytes)
+			, m_indexBytes(0)
+			, m_dataOffset(HeaderBytes)
+			, m_dataBytes(0)
+		{}
+
+		//! Places the sections for count elements, recordSize is 0 unless they are stored as fixed-width records
+		void layOut(qint64 count, qint32 recordSize)
+		{
+			m_count = count;
+			m_recordSize = recordSize;
+			m_indexOffset = HeaderBytes;
+			const qint64 pages = recordSize > 0 ? 0 : (count + IndexRecords - 1) / IndexRecords;
+			m_indexBytes = pages * IndexRecords * IndexEntryBytes;
+			m_dataOffset = m_indexOffset + m_indexBytes;
+		}
+
+		bool write(QFileDevice& file) const
+		{
+			QByteArray block;
+			{
+				QDataStream writerStream(&block, QIODevice::WriteOnly);
+				writerStream << quint32(Magic) << m_version << m_littleEndian << m_streamVersion << m_recordSize
+					<< m_count << m_indexOffset << m_indexBytes << m_dataOffset << m_dataBytes;
+			}
+			block.append(QByteArray(HeaderBytes - block.size(), '\0'));
+			return file.seek(0) && file.write(block) == block.size();
+		}
+
+		/* false unless file starts with a header this build can use as it is */
+		bool read(QFileDevice& file)
+		{
+			if (!file.seek(0))
+				return false;
+			const QByteArray block = file.read(HeaderBytes);
+			QDataStream readerStream(block);
+			quint32 magic = 0;
+			readerStream >> magic >> m_version >> m_littleEndian >> m_streamVersion >> m_recordSize
+				>> m_count >> m_indexOffset >> m_indexBytes >> m_dataOffset >> m_dataBytes;
+			if (readerStream.status() != QDataStream::Ok || magic != Magic || m_version != Version)
+				return false;
+			/* the index is used in place, elements are decoded with the current stream version */
+			if (m_littleEndian != (Q_BYTE_ORDER == Q_LITTLE_ENDIAN) || m_streamVersion != QDataStream().version())
+				return false;
+			if (m_count < 0 || m_indexBytes < (m_recordSize > 0 ? 0 : m_count * IndexEntryBytes))
+				return false;
+			return m_indexOffset >= HeaderBytes && m_dataOffset >= m_indexOffset + m_indexBytes
+				&& m_dataBytes >= 0 && file.size() >= m_dataOffset + m_dataBytes;
+		}
+
+		quint32 m_version;
+		bool m_littleEndian;
+		qint32 m_streamVersion;
+		qint32 m_recordSize;	//!< sizeof the element for fixed-width records, 0 when they are serialized
+		qint64 m_count;
+		qint64 m_indexOffset;
+		qint64 m_indexBytes;
+		qint64 m_dataOffset;
+		qint64 m_dataBytes;
+	};
+}
+#endif // hugecontainer_common_h__
@@ -0,0 +1,100 @@
+#pragma once
+#ifndef hugechunkedlayouttests_h__
+#define hugechunkedlayouttests_h__
+
+#include "ContainerTests.h"
+#include <QTemporaryDir>
+
+/*
+   Cases of the chunked layout of TempFile: the count tree of the chunk
+   directory, and edits that cross chunk boundaries.
+*/
+namespace HugeTest
+{
+	//! Sums and lookups against running sums, through appends, changes and a rebuild
+	inline void testCountTree()
+	{
+		HugeContainers::CountTree tree;
+		HUGE_COMPARE(tree.locate(0), 0);
+		QVector<qint64> counts;
+		std::mt19937 generator(15);
+		for (int i = 0; i < 300; ++i) {
+			counts.append(qint64(generator() % 4));
+			tree.append(counts.last());
+		}
+		auto matches = [&tree, &counts]() -> bool {
+			if (tree.size() != counts.size())
+				return false;
+			qint64 sum = 0;
+			for (int slot = 0; slot < counts.size(); ++slot) {
+				if (tree.before(slot) != sum)
+					return false;
+				for (qint64 unit = sum; unit < sum + counts.at(slot); ++unit) {
+					if (tree.locate(unit) != slot)
+						return false;
+				}
+				sum += counts.at(slot);
+			}
+			return tree.total() == sum && tree.before(counts.size()) == sum;
+		};
+		HUGE_CHECK(matches());
+		for (int i = 0; i < 1000; ++i) {
+			const int slot = int(generator() % uint(counts.size()));
+			const qint64 delta = qint64(generator() % 5) - qMin<qint64>(counts.at(slot), 2);
+			counts[slot] += delta;
+			tree.add(slot, delta);
+		}
+		HUGE_CHECK(matches());
+		counts.remove(17);
+		counts.insert(120, 9);
+		tree.assign(counts);
+		HUGE_CHECK(matches());
+		tree.clear();
+		HUGE_COMPARE(tree.size(), 0);
+		HUGE_COMPARE(tree.total(), qint64(0));
+	}
+
+	//! Edits crossing chunk boundaries, then a round trip through save() and open()
+	inline void testChunkedLayout()
+	{
+		QVector<QString> expected = makeValues<QString>(0, 40000);
+		HugeContainer<QString> container = filled(expected);
+		HUGE_CHECK(container.setChunkedLayout(true));
+		HUGE_CHECK(container.chunkedLayout());
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(!container.setCompression(true));
+
+		applyEdits(container, expected, 4000, 11);
+		HUGE_CHECK(sameContent(container, expected));
+		for (int i = 0; i < 1500; ++i) {
+			container.removeAt(0);
+			expected.remove(0);
+		}
+		for (int i = 0; i < 1500; ++i) {
+			container.insert(uint(expected.size() / 2), Values<QString>::make(i));
+			expected.insert(expected.size() / 2, Values<QString>::make(i));
+		}
+		HUGE_CHECK(sameContent(container, expected));
+
+		const HugeContainer<QString> copy(container);
+		QVector<QString> copyExpected = expected;
+		applyEdits(container, expected, 500, 12);
+		HUGE_CHECK(sameContent(copy, copyExpected));
+		HUGE_CHECK(sameContent(container, expected));
+
+		QTemporaryDir dir;
+		const QString fileName = dir.filePath(QStringLiteral("chunked.huge"));
+		HUGE_CHECK(container.save(fileName));
+		HugeContainer<QString> opened;
+		HUGE_CHECK(opened.open(fileName));
+		HUGE_CHECK(sameContent(opened, expected));
+
+		HUGE_CHECK(container.setChunkedLayout(false));
+		HUGE_CHECK(sameContent(container, expected));
+
+		HugeContainer<qreal> fixedWidth;
+		HUGE_CHECK(!fixedWidth.setChunkedLayout(true));
+	}
+}
+
+#endif // hugechunkedlayouttests_h__
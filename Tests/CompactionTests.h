@@ -0,0 +1,68 @@
+#pragma once
+#ifndef hugecompactiontests_h__
+#define hugecompactiontests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Cases of the compaction of the TempFile data file: removals only count
+   dead bytes, and compact() rewrites the file when asked.
+*/
+namespace HugeTest
+{
+	//! Dead bytes stay until compact(), which leaves copies sharing the storage alone
+	inline void testCompaction()
+	{
+		QVector<QString> expected = makeValues<QString>(0, 20000);
+		HugeContainer<QString> container = filled(expected);
+		for (int i = expected.size() - 1; i >= 0; i -= 2) {
+			container.removeAt(uint(i));
+			expected.remove(i);
+		}
+		HUGE_CHECK(container.deadBytes() > 0);
+		HUGE_CHECK(container.fragmentation() > 0.4);
+		HUGE_CHECK(sameContent(container, expected));
+
+		const HugeContainer<QString> copy(container);
+		HUGE_CHECK(container.compact());
+		HUGE_COMPARE(container.deadBytes(), qint64(0));
+		HUGE_CHECK(container.fragmentation() == 0.0);
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(sameContent(copy, expected));
+
+		applyEdits(container, expected, 2000, 10);
+		HUGE_CHECK(container.compact());
+		HUGE_CHECK(sameContent(container, expected));
+
+		HugeContainer<QString> empty;
+		HUGE_CHECK(empty.compact());
+		HUGE_CHECK(!empty.compactionDue());
+	}
+
+	//! Removals past the threshold only report it, the rewrite waits for compact()
+	inline void testCompactionThreshold()
+	{
+		QVector<QString> expected;
+		for (int i = 0; i < 2000; ++i)
+			expected.append(QString::number(i).repeated(1000 / QString::number(i).size()));
+		HugeContainer<QString> container = filled(expected);
+		container.setCompactionThreshold(0.25);
+		HUGE_CHECK(!container.compactionDue());
+		while (expected.size() > 1000) {
+			container.removeAt(0);
+			expected.removeFirst();
+		}
+		HUGE_CHECK(container.fragmentation() > 0.25);
+		HUGE_CHECK(container.compactionDue());
+		HUGE_CHECK(sameContent(container, expected));
+
+		container.setCompactionThreshold(0);
+		HUGE_CHECK(!container.compactionDue());
+		container.setCompactionThreshold(0.25);
+		HUGE_CHECK(container.compact());
+		HUGE_CHECK(!container.compactionDue());
+		HUGE_CHECK(sameContent(container, expected));
+	}
+}
+
+#endif // hugecompactiontests_h__
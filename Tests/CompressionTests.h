@@ -0,0 +1,31 @@
+#pragma once
+#ifndef hugecompressiontests_h__
+#define hugecompressiontests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Cases of the block compression of TempFile: the data file shrinks and
+   the content reads back the same, with compression on or off.
+*/
+namespace HugeTest
+{
+	//! Stores fewer bytes than the elements take, through edits and back to plain blocks
+	inline void testCompression()
+	{
+		QVector<QString> expected = makeValues<QString>(0, 20000);
+		HugeContainer<QString> container = filled(expected);
+		HUGE_CHECK(container.setCompression(true));
+		HUGE_CHECK(container.compression());
+		HUGE_CHECK(container.storedBytes() < container.liveBytes());
+		applyEdits(container, expected, 1000, 13);
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(container.setCompression(false));
+		HUGE_CHECK(sameContent(container, expected));
+
+		HugeContainer<qreal> fixedWidth;
+		HUGE_CHECK(!fixedWidth.setCompression(true));
+	}
+}
+
+#endif // hugecompressiontests_h__
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef hugeconcurrencytests_h__
+#define hugeconcurrencytests_h__
+
+#include "ContainerTests.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+   Cases of the concurrent access mode: readers on other threads see every
+   element whole while one thread keeps writing.
+*/
+namespace HugeTest
+{
+	//! Readers check every value they see while one thread appends
+	inline void testConcurrentAccess()
+	{
+		HugeContainer<qreal> container;
+		container.setConcurrentAccess(true);
+		container.append(makeValues<qreal>(0, 1000));
+
+		const int total = 40000;
+		std::atomic<bool> done(false);
+		std::atomic<int> mismatches(0);
+		std::vector<std::thread> readers;
+		for (int reader = 0; reader < 4; ++reader) {
+			readers.emplace_back([&, reader] {
+				std::mt19937 generator(static_cast<quint32>(reader));
+				while (!done.load()) {
+					const int size = container.size();
+					const int index = int(generator() % uint(size));
+					if (container.value(uint(index), -1.0) != Values<qreal>::make(index))
+						mismatches.fetch_add(1);
+					const int first = qMax(0, index - 10);
+					QVector<qreal> range = container.mid(uint(first), 10);
+					for (int i = 0; i < range.size(); ++i) {
+						if (range.at(i) != Values<qreal>::make(first + i))
+							mismatches.fetch_add(1);
+					}
+					QVector<qreal> picked;
+					if (!container.multiGet(QVector<uint>{ uint(index), 0 }, std::back_inserter(picked)) || picked.at(0) != Values<qreal>::make(index))
+						mismatches.fetch_add(1);
+				}
+			});
+		}
+		for (int next = 1000; next < total;) {
+			if (next % 2) {
+				container.push_back(Values<qreal>::make(next));
+				++next;
+			}
+			else {
+				container.append(makeValues<qreal>(next, 99));
+				next += 99;
+			}
+		}
+		done.store(true);
+		for (std::thread& reader : readers)
+			reader.join();
+		HUGE_COMPARE(mismatches.load(), 0);
+		HUGE_CHECK(sameContent(container, makeValues<qreal>(0, total)));
+	}
+}
+
+#endif // hugeconcurrencytests_h__
@@ -0,0 +1,222 @@
+#pragma once
+#ifndef hugecontainertests_h__
+#define hugecontainertests_h__
+
+#include "TestSuite.h"
+#include <QDataStream>
+#include <QVector>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <random>
+#if defined(Q_OS_UNIX)
+#include <csignal>
+#include <sys/resource.h>
+#endif
+
+/*
+   Cases every HugeContainer backend passes and the helpers of the cases of
+   each feature, which have a header of their own. Included after the
+   HugeVector.h of the backend under test. Each case checks the container
+   against a QVector that went through the same changes.
+*/
+namespace HugeTest
+{
+	using HugeContainers::HugeContainer;
+	using HugeContainers::StorageMode;
+
+	/*
+	   Caps the size of any file the process writes while it is in scope, so
+	   writes past it fail as they do on a full disk. Inactive where the
+	   system has no such limit.
+	*/
+	class FileSizeLimit
+	{
+	public:
+		explicit FileSizeLimit(qint64 bytes)
+			: m_active(false)
+		{
+#if defined(Q_OS_UNIX)
+			if (::getrlimit(RLIMIT_FSIZE, &m_saved) != 0)
+				return;
+			/* the signal would end the process instead of failing the write */
+			m_signal = std::signal(SIGXFSZ, SIG_IGN);
+			struct rlimit limit = m_saved;
+			limit.rlim_cur = rlim_t(bytes);
+			m_active = ::setrlimit(RLIMIT_FSIZE, &limit) == 0;
+#else
+			Q_UNUSED(bytes);
+#endif
+		}
+		~FileSizeLimit()
+		{
+#if defined(Q_OS_UNIX)
+			if (m_active)
+				::setrlimit(RLIMIT_FSIZE, &m_saved);
+			std::signal(SIGXFSZ, m_signal);
+#endif
+		}
+		FileSizeLimit(const FileSizeLimit&) = delete;
+		FileSizeLimit& operator=(const FileSizeLimit&) = delete;
+
+		bool isActive() const { return m_active; }
+
+	private:
+		bool m_active;
+#if defined(Q_OS_UNIX)
+		struct rlimit m_saved;
+		void (*m_signal)(int) = SIG_DFL;
+#endif
+	};
+
+	//! Serialized element that stops decoding once decodesLeft() reaches 0, -1 never does
+	struct Fragile
+	{
+		QString m_text;
+	};
+
+	inline std::atomic<int>& decodesLeft()
+	{
+		static std::atomic<int> left(-1);
+		return left;
+	}
+
+	inline bool operator==(const Fragile& left, const Fragile& right) { return left.m_text == right.m_text; }
+	inline bool operator<(const Fragile& left, const Fragile& right) { return left.m_text < right.m_text; }
+
+	inline QDataStream& operator<<(QDataStream& out, const Fragile& fragile)
+	{
+		return out << fragile.m_text;
+	}
+
+	inline QDataStream& operator>>(QDataStream& in, Fragile& fragile)
+	{
+		int left = decodesLeft().load();
+		while (left > 0 && !decodesLeft().compare_exchange_weak(left, left - 1)) {}
+		if (left == 0) {
+			in.setStatus(QDataStream::ReadCorruptData);
+			return in;
+		}
+		return in >> fragile.m_text;
+	}
+
+	template <class ValueType>
+	struct Values;
+
+	template <>
+	struct Values<qreal>
+	{
+		static qreal make(int i) { return qreal(i) * 0.5; }
+		//! What the stable sort orders by, shared by many values
+		static int key(qreal val) { return int(val) % 97; }
+	};
+
+	//! From one to a few dozen characters, so the elements differ in size
+	template <>
+	struct Values<QString>
+	{
+		static QString make(int i) { return QString::number(i).repeated(1 + i % 7); }
+		static int key(const QString& val) { return val.size(); }
+	};
+
+	template <class ValueType>
+	QVector<ValueType> makeValues(int first, int count)
+	{
+		QVector<ValueType> result;
+		result.reserve(count);
+		for (int i = first; i < first + count; ++i)
+			result.append(Values<ValueType>::make(i));
+		return result;
+	}
+
+	template <class ValueType>
+	HugeContainer<ValueType> filled(const QVector<ValueType>& values)
+	{
+		HugeContainer<ValueType> container;
+		container.append(values);
+		return container;
+	}
+
+	//! Whether container holds expected, read back element by element, by range and by iterator
+	template <class ValueType>
+	bool sameContent(const HugeContainer<ValueType>& container, const QVector<ValueType>& expected)
+	{
+		if (container.size() != expected.size())
+			return false;
+		for (int i = 0; i < expected.size(); ++i) {
+			if (!(container.at(i) == expected.at(i)))
+				return false;
+		}
+		if (!(container.mid(0) == expected))
+			return false;
+		QVector<ValueType> iterated;
+		std::copy(container.begin(), container.end(), std::back_inserter(iterated));
+		return iterated == expected;
+	}
+
+	//! Random appends, inserts and removals, done to the container and to expected alike
+	template <class ValueType>
+	void applyEdits(HugeContainer<ValueType>& container, QVector<ValueType>& expected, int edits, quint32 seed)
+	{
+		std::mt19937 generator(seed);
+		for (int i = 0; i < edits; ++i) {
+			const ValueType val = Values<ValueType>::make(int(generator() % 100000));
+			switch (generator() % 4) {
+			case 0:
+				container.push_back(val);
+				expected.append(val);
+				break;
+			case 1: {
+				const int index = int(generator() % uint(expected.size() + 1));
+				container.insert(uint(index), val);
+				expected.insert(index, val);
+				break;
+			}
+			default:
+				if (expected.isEmpty())
+					break;
+				const int index = int(generator() % uint(expected.size()));
+				container.removeAt(uint(index));
+				expected.remove(index);
+				break;
+			}
+		}
+	}
+
+	template <class ValueType>
+	void testEdits()
+	{
+		HugeContainer<ValueType> container;
+		ValueType out;
+		HUGE_CHECK(container.isEmpty());
+		HUGE_CHECK(container.mid(0).isEmpty());
+		HUGE_CHECK(!container.get(0, out));
+		HUGE_CHECK(!container.removeAt(0));
+		HUGE_CHECK(container.value(3) == ValueType());
+		HUGE_CHECK(container.value(3, Values<ValueType>::make(7)) == Values<ValueType>::make(7));
+		HUGE_CHECK(container.begin() == container.end());
+
+		QVector<ValueType> expected = makeValues<ValueType>(0, 3000);
+		container.append(expected);
+		applyEdits(container, expected, 3000, 1);
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(!container.removeAt(uint(expected.size())));
+		HUGE_CHECK(container.mid(uint(expected.size())).isEmpty());
+		HUGE_CHECK(container.mid(uint(expected.size() - 5)) == expected.mid(expected.size() - 5));
+		HUGE_CHECK(container.first() == expected.first());
+		HUGE_CHECK(container.last() == expected.last());
+
+		QVector<ValueType> reversed;
+		std::copy(std::make_reverse_iterator(container.end()), std::make_reverse_iterator(container.begin()), std::back_inserter(reversed));
+		std::reverse(reversed.begin(), reversed.end());
+		HUGE_CHECK(reversed == expected);
+
+		container.clear();
+		HUGE_CHECK(container.isEmpty());
+		expected = makeValues<ValueType>(10, 100);
+		container.append(expected);
+		HUGE_CHECK(sameContent(container, expected));
+	}
+}
+
+#endif // hugecontainertests_h__
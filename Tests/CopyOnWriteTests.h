@@ -0,0 +1,112 @@
+#pragma once
+#ifndef hugecopyonwritetests_h__
+#define hugecopyonwritetests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Cases of the copies: a copy shares the files of the original, and a
+   change made after the copy copies only what it touches.
+*/
+namespace HugeTest
+{
+	//! Both copies change after the copy and neither sees the changes of the other
+	template <class ValueType>
+	void testCopyDetach()
+	{
+		QVector<ValueType> expected = makeValues<ValueType>(0, 5000);
+		HugeContainer<ValueType> original = filled(expected);
+		HugeContainer<ValueType> copy(original);
+		QVector<ValueType> copyExpected = expected;
+		applyEdits(copy, copyExpected, 500, 4);
+		HUGE_CHECK(sameContent(original, expected));
+		HUGE_CHECK(sameContent(copy, copyExpected));
+
+		applyEdits(original, expected, 500, 5);
+		HUGE_CHECK(sameContent(original, expected));
+		HUGE_CHECK(sameContent(copy, copyExpected));
+
+		HugeContainer<ValueType> assigned;
+		assigned = original;
+		original.clear();
+		HUGE_CHECK(original.isEmpty());
+		HUGE_CHECK(sameContent(assigned, expected));
+
+		assigned.swap(copy);
+		HUGE_CHECK(sameContent(assigned, copyExpected));
+		HUGE_CHECK(sameContent(copy, expected));
+	}
+
+	//! Copies share the files: a change made after the copy only copies the segments it touches
+	template <class ValueType>
+	void testCopyCost()
+	{
+		const qint64 bound = 4 * qint64(HugeContainers::ContainerFile::SegmentBytes);
+		QVector<ValueType> expected = makeValues<ValueType>(0, 100000);
+		HugeContainer<ValueType> original = filled(expected);
+		original.setStatsEnabled(true);
+		HugeContainer<ValueType> copy(original);
+		QVector<ValueType> copyExpected = expected;
+		copy.push_back(Values<ValueType>::make(1));
+		copyExpected.append(Values<ValueType>::make(1));
+		const HugeContainers::ContainerStats detached = copy.stats();
+		HUGE_COMPARE(detached.m_detachCopies, qint64(1));
+		HUGE_CHECK(detached.m_detachBytes <= bound);
+		HUGE_CHECK(detached.m_writeBytes <= bound);
+
+		original.push_back(Values<ValueType>::make(2));
+		expected.append(Values<ValueType>::make(2));
+		HUGE_CHECK(original.stats().m_detachBytes <= bound);
+		HUGE_CHECK(sameContent(original, expected));
+		HUGE_CHECK(sameContent(copy, copyExpected));
+
+		/* the mapping of each side never shows the writes of the other */
+		HUGE_CHECK(copy.setStorageMode(StorageMode::Mapped));
+		applyEdits(copy, copyExpected, 300, 19);
+		applyEdits(original, expected, 300, 20);
+		HUGE_CHECK(sameContent(original, expected));
+		HUGE_CHECK(sameContent(copy, copyExpected));
+	}
+
+	//! Copies share the pages of the map, a change copies the pages it writes and no more
+	inline void testSharedIndex()
+	{
+		QVector<QString> expected = makeValues<QString>(0, 50000);
+		HugeContainer<QString> original = filled(expected);
+		original.setStatsEnabled(true);
+		const qint64 indexBytes = original.stats().m_indexBytes;
+
+		HugeContainer<QString> copy(original);
+		QVector<QString> copyExpected = expected;
+		copy.insert(10, Values<QString>::make(1));
+		copyExpected.insert(10, Values<QString>::make(1));
+		const HugeContainers::ContainerStats detached = copy.stats();
+		HUGE_COMPARE(detached.m_detachCopies, qint64(1));
+		HUGE_CHECK(detached.m_indexBytes < indexBytes + indexBytes / 10);
+		HUGE_CHECK(sameContent(original, expected));
+		HUGE_CHECK(sameContent(copy, copyExpected));
+
+		applyEdits(copy, copyExpected, 3000, 16);
+		applyEdits(original, expected, 3000, 17);
+		HUGE_CHECK(sameContent(original, expected));
+		HUGE_CHECK(sameContent(copy, copyExpected));
+
+		{
+			/* a third copy cleared and dropped while the others still share pages with it */
+			HugeContainer<QString> third(copy);
+			third.removeAt(0);
+			third.clear();
+			third.append(makeValues<QString>(0, 5000));
+			HUGE_CHECK(sameContent(third, makeValues<QString>(0, 5000)));
+			HUGE_CHECK(sameContent(copy, copyExpected));
+		}
+		original.clear();
+		HUGE_CHECK(original.isEmpty());
+		applyEdits(copy, copyExpected, 3000, 18);
+		HUGE_CHECK(sameContent(copy, copyExpected));
+		HUGE_CHECK(copy.setStorageMode(StorageMode::Mapped));
+		HUGE_CHECK(sameContent(copy, copyExpected));
+	}
+}
+
+#endif // hugecopyonwritetests_h__
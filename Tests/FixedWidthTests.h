@@ -0,0 +1,55 @@
+#pragma once
+#ifndef hugefixedwidthtests_h__
+#define hugefixedwidthtests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Trivially copyable elements, stored as fixed-width records. Besides the
+   case below, the shared cases run with Record as the element type.
+*/
+namespace HugeTest
+{
+	//! Plain data, stored as fixed-width records
+	struct Record
+	{
+		qint64 m_id;
+		double m_weight;
+	};
+
+	inline bool operator==(const Record& left, const Record& right)
+	{
+		return left.m_id == right.m_id && left.m_weight == right.m_weight;
+	}
+
+	inline QDataStream& operator<<(QDataStream& out, const Record& record)
+	{
+		return out << record.m_id << record.m_weight;
+	}
+
+	inline QDataStream& operator>>(QDataStream& in, Record& record)
+	{
+		return in >> record.m_id >> record.m_weight;
+	}
+
+	template <>
+	struct Values<Record>
+	{
+		static Record make(int i) { return Record{ i, i * 0.25 }; }
+	};
+
+	//! The data file holds the records and nothing else, whatever the edits
+	inline void testFixedWidth()
+	{
+		QVector<Record> expected = makeValues<Record>(0, 5000);
+		HugeContainer<Record> container = filled(expected);
+		applyEdits(container, expected, 2000, 21);
+		HUGE_CHECK(sameContent(container, expected));
+		const HugeContainers::ContainerStats stats = container.stats();
+		HUGE_COMPARE(stats.m_liveBytes, expected.size() * qint64(sizeof(Record)));
+		HUGE_COMPARE(stats.m_deadBytes, qint64(0));
+		HUGE_COMPARE(stats.m_indexBytes, qint64(0));
+	}
+}
+
+#endif // hugefixedwidthtests_h__
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef hugeholereusetests_h__
+#define hugeholereusetests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Cases of the free-space allocator of ShareData: removals leave holes
+   that later writes fill before the data file grows.
+*/
+namespace HugeTest
+{
+	//! Elements written after removals fill the holes instead of growing the data file
+	inline void testHoleReuse()
+	{
+		QVector<QString> expected = makeValues<QString>(0, 10000);
+		HugeContainer<QString> container = filled(expected);
+		HUGE_COMPARE(container.stats().m_deadBytes, qint64(0));
+
+		QVector<QString> removed;
+		for (int i = 0; i < 2000; ++i) {
+			removed.append(expected.at(3000));
+			container.removeAt(3000);
+			expected.remove(3000);
+		}
+		const HugeContainers::ContainerStats holes = container.stats();
+		HUGE_CHECK(holes.m_deadBytes > 0);
+		HUGE_CHECK(sameContent(container, expected));
+
+		for (const QString& val : removed) {
+			container.push_back(val);
+			expected.append(val);
+		}
+		const HugeContainers::ContainerStats reused = container.stats();
+		HUGE_CHECK(reused.m_deadBytes < holes.m_deadBytes);
+		HUGE_CHECK(reused.m_liveBytes + reused.m_deadBytes <= holes.m_liveBytes + holes.m_deadBytes);
+		HUGE_CHECK(sameContent(container, expected));
+	}
+}
+
+#endif // hugeholereusetests_h__
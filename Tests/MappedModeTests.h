@@ -0,0 +1,33 @@
+#pragma once
+#ifndef hugemappedmodetests_h__
+#define hugemappedmodetests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Cases of the Mapped storage mode, shared by the backends that have it:
+   the data file grows through the mapping and the mode switches both ways
+   with the content unchanged.
+*/
+namespace HugeTest
+{
+	//! Grows past the first extent of the mapping, then switches mode back and forth
+	template <class ValueType>
+	void testMappedMode()
+	{
+		HugeContainer<ValueType> container(StorageMode::Mapped);
+		HUGE_CHECK(container.storageMode() == StorageMode::Mapped);
+		QVector<ValueType> expected = makeValues<ValueType>(0, 60000);
+		container.append(expected);
+		applyEdits(container, expected, 2000, 2);
+		HUGE_CHECK(sameContent(container, expected));
+
+		HUGE_CHECK(container.setStorageMode(StorageMode::Buffered));
+		HUGE_CHECK(sameContent(container, expected));
+		applyEdits(container, expected, 500, 3);
+		HUGE_CHECK(container.setStorageMode(StorageMode::Mapped));
+		HUGE_CHECK(sameContent(container, expected));
+	}
+}
+
+#endif // hugemappedmodetests_h__
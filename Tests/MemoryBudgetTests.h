@@ -0,0 +1,49 @@
+#pragma once
+#ifndef hugememorybudgettests_h__
+#define hugememorybudgettests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Cases of the memory budget of TempFile: the newest elements stay in RAM
+   up to the budget and the rest spill to the files.
+*/
+namespace HugeTest
+{
+	//! Indices span the elements in RAM and those in the files
+	inline void testMemoryBudget()
+	{
+		const qint64 budget = 64 << 10;
+		HugeContainer<QString> container;
+		HUGE_CHECK(container.setMemoryBudget(budget));
+		QVector<QString> expected = makeValues<QString>(0, 20000);
+		container.append(expected);
+		HUGE_CHECK(container.residentBytes() > 0);
+		HUGE_CHECK(container.residentBytes() <= budget);
+		applyEdits(container, expected, 2000, 14);
+		HUGE_CHECK(sameContent(container, expected));
+
+		const HugeContainer<QString> copy(container);
+		HUGE_CHECK(container.setMemoryBudget(0));
+		HUGE_COMPARE(container.residentBytes(), qint64(0));
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(sameContent(copy, expected));
+
+		/* a spill failing on a write is reported, the elements stay in RAM */
+		HugeContainer<QString> full;
+		HUGE_CHECK(full.setMemoryBudget(budget));
+		full.setWriteBufferSize(0);
+		{
+			FileSizeLimit limit(0);
+			if (!limit.isActive())
+				return;
+			HUGE_CHECK(!full.append(expected));
+		}
+		HUGE_CHECK(full.residentBytes() > budget);
+		HUGE_CHECK(sameContent(full, expected));
+		HUGE_CHECK(full.append(expected.constData(), expected.constData() + 1));
+		HUGE_CHECK(full.residentBytes() <= budget);
+	}
+}
+
+#endif // hugememorybudgettests_h__
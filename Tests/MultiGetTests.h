@@ -0,0 +1,60 @@
+#pragma once
+#ifndef hugemultigettests_h__
+#define hugemultigettests_h__
+
+#include "ContainerTests.h"
+#include <future>
+#include <vector>
+
+/*
+   Cases of the batched reads: multiGet() and the asynchronous calls hand
+   back the values in the order of the indices, or fail as a whole.
+*/
+namespace HugeTest
+{
+	//! Values in the order asked for, duplicates and descending runs included
+	template <class ValueType>
+	void testMultiGet()
+	{
+		const QVector<ValueType> expected = makeValues<ValueType>(0, 20000);
+		const HugeContainer<ValueType> container = filled(expected);
+
+		std::mt19937 generator(8);
+		QVector<uint> indices;
+		for (int i = 0; i < 3000; ++i)
+			indices.append(uint(generator() % uint(expected.size())));
+		for (int i = 500; i > 400; --i)
+			indices.append(uint(i));
+		indices.append(indices.first());
+		indices.append(0);
+		indices.append(uint(expected.size() - 1));
+
+		QVector<ValueType> values;
+		HUGE_CHECK(container.multiGet(indices, std::back_inserter(values)));
+		bool inOrder = values.size() == indices.size();
+		for (int i = 0; inOrder && i < indices.size(); ++i)
+			inOrder = values.at(i) == expected.at(int(indices.at(i)));
+		HUGE_CHECK(inOrder);
+
+		HUGE_CHECK(container.multiGetAsync(indices).get() == values);
+		/* more requests than pool threads, each one spreading its reads over the same pool */
+		std::vector<std::future<QVector<ValueType> > > pending;
+		for (int i = 0; i < 4 * QThread::idealThreadCount(); ++i)
+			pending.push_back(container.multiGetAsync(indices));
+		bool allSame = true;
+		for (std::future<QVector<ValueType> >& result : pending)
+			allSame = result.get() == values && allSame;
+		HUGE_CHECK(allSame);
+		HUGE_CHECK(container.atAsync(17).get() == expected.at(17));
+		HUGE_CHECK(container.atAsync(uint(expected.size())).get() == ValueType());
+
+		QVector<ValueType> none;
+		HUGE_CHECK(container.multiGet(QVector<uint>(), std::back_inserter(none)));
+		HUGE_CHECK(none.isEmpty());
+		indices.append(uint(expected.size()));
+		HUGE_CHECK(!container.multiGet(indices, std::back_inserter(none)));
+		HUGE_CHECK(container.multiGetAsync(indices).get().isEmpty());
+	}
+}
+
+#endif // hugemultigettests_h__
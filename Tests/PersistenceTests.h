@@ -0,0 +1,59 @@
+#pragma once
+#ifndef hugepersistencetests_h__
+#define hugepersistencetests_h__
+
+#include "ContainerTests.h"
+#include <QFile>
+#include <QTemporaryDir>
+
+/*
+   Cases of the on-disk container format: save() writes a file that open()
+   attaches as it is, and a failed open leaves the container alone.
+*/
+namespace HugeTest
+{
+	//! Saves, opens, changes what was opened and opens the untouched file again
+	template <class ValueType>
+	void testSaveOpen()
+	{
+		QTemporaryDir dir;
+		HUGE_CHECK(dir.isValid());
+		const QString fileName = dir.filePath(QStringLiteral("saved.huge"));
+
+		QVector<ValueType> expected = makeValues<ValueType>(0, 4000);
+		HugeContainer<ValueType> container = filled(expected);
+		applyEdits(container, expected, 2000, 6);
+		HUGE_CHECK(container.save(fileName));
+
+		HugeContainer<ValueType> opened;
+		HUGE_CHECK(opened.open(fileName));
+		HUGE_CHECK(sameContent(opened, expected));
+
+		QVector<ValueType> openedExpected = expected;
+		applyEdits(opened, openedExpected, 500, 7);
+		HUGE_CHECK(sameContent(opened, openedExpected));
+
+		HugeContainer<ValueType> reopened(StorageMode::Mapped);
+		HUGE_CHECK(reopened.open(fileName));
+		HUGE_CHECK(sameContent(reopened, expected));
+
+		/* a failed open leaves the container as it was */
+		HUGE_CHECK(!reopened.open(dir.filePath(QStringLiteral("missing.huge"))));
+		QFile garbage(dir.filePath(QStringLiteral("garbage.huge")));
+		HUGE_CHECK(garbage.open(QIODevice::WriteOnly));
+		garbage.write(QByteArray(100, 'x'));
+		garbage.close();
+		HUGE_CHECK(!reopened.open(garbage.fileName()));
+		HUGE_CHECK(sameContent(reopened, expected));
+
+		HugeContainer<ValueType> empty;
+		const QString emptyName = dir.filePath(QStringLiteral("empty.huge"));
+		HUGE_CHECK(empty.save(emptyName));
+		HUGE_CHECK(reopened.open(emptyName));
+		HUGE_CHECK(reopened.isEmpty());
+		reopened.push_back(Values<ValueType>::make(1));
+		HUGE_CHECK(reopened.size() == 1);
+	}
+}
+
+#endif // hugepersistencetests_h__
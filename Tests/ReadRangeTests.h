@@ -0,0 +1,31 @@
+#pragma once
+#ifndef hugereadrangetests_h__
+#define hugereadrangetests_h__
+
+#include "ContainerTests.h"
+
+/*
+   Cases of the bulk reads: a range read either hands over every element
+   asked for or fails as a whole.
+*/
+namespace HugeTest
+{
+	//! A decode failing in the middle of a range fails the whole read
+	inline void testReadFailure()
+	{
+		QVector<Fragile> expected;
+		for (int i = 0; i < 5000; ++i)
+			expected.append(Fragile{ QString::number(i) });
+		HugeContainer<Fragile> container = filled(expected);
+		container.setCacheBudget(0);
+		QVector<Fragile> values;
+		decodesLeft() = 1000;
+		HUGE_CHECK(!container.readRange(0, expected.size(), std::back_inserter(values)));
+		decodesLeft() = -1;
+		values.clear();
+		HUGE_CHECK(container.readRange(0, expected.size(), std::back_inserter(values)));
+		HUGE_CHECK(values == expected);
+	}
+}
+
+#endif // hugereadrangetests_h__
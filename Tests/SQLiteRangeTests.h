@@ -0,0 +1,61 @@
+#pragma once
+#ifndef hugesqliterangetests_h__
+#define hugesqliterangetests_h__
+
+#include "SQLiteDataBase.h"
+#include "TestSuite.h"
+
+/*
+   Cases of the range queries of SQLiteDataBase, run against both of its
+   schemas: each query is a single statement and matches the values pushed.
+*/
+namespace HugeTest
+{
+	//! Every query of the range API against the values pushed, in one schema
+	inline void testRanges(SQLiteDataBase::Schema schema)
+	{
+		const int total = 3 * SQLiteDataBase::ChunkValues + 100;
+		SQLiteDataBase dataBase(schema);
+		HUGE_CHECK(dataBase.readRange(1, 10).isEmpty());
+		HUGE_CHECK(dataBase.sum(1, 10) == 0.0);
+		for (int i = 0; i < total; ++i)
+			dataBase.push_back(i * 0.5);
+		HUGE_CHECK(dataBase.commit());
+		HUGE_COMPARE(dataBase.size(), qint64(total));
+
+		bool same = true;
+		for (int rowId = 1; rowId <= total; rowId += 97)
+			same = same && dataBase.at(rowId) == (rowId - 1) * 0.5;
+		HUGE_CHECK(same);
+
+		bool ok = false;
+		const QVector<qreal> range = dataBase.readRange(SQLiteDataBase::ChunkValues - 5, 20, &ok);
+		HUGE_CHECK(ok);
+		HUGE_COMPARE(range.size(), 20);
+		HUGE_CHECK(range.first() == (SQLiteDataBase::ChunkValues - 6) * 0.5);
+		HUGE_COMPARE(dataBase.readRange(total - 4, 10).size(), 5);
+
+		ok = false;
+		HUGE_CHECK(dataBase.sum(1, 100, &ok) == 99 * 100 / 2 * 0.5);
+		HUGE_CHECK(ok);
+		qreal min = 0;
+		qreal max = 0;
+		HUGE_CHECK(dataBase.minMax(10, 5000, min, max));
+		HUGE_CHECK(min == 4.5 && max == 4999 * 0.5);
+		HUGE_CHECK(!dataBase.minMax(total + 1, total + 10, min, max));
+		ok = false;
+		HUGE_COMPARE(dataBase.countWhere(1, total, 10.0, 20.0, &ok), qint64(21));
+		HUGE_CHECK(ok);
+		HUGE_COMPARE(dataBase.countWhere(total + 1, total + 10, 0.0, 1e9), qint64(0));
+
+		/* every pushed-down query counts as one read, whatever the schema */
+		dataBase.setStatsEnabled(true);
+		const qint64 before = dataBase.stats().readCalls;
+		dataBase.countWhere(1, total, 10.0, 20.0);
+		HUGE_COMPARE(dataBase.stats().readCalls, before + 1);
+		dataBase.sum(1, 100);
+		HUGE_COMPARE(dataBase.stats().readCalls, before + 2);
+	}
+}
+
+#endif // hugesqliterangetests_h__
@@ -0,0 +1,11 @@
+#include "SQLiteRangeTests.h"
+
+using namespace HugeTest;
+
+int main()
+{
+	return HugeTest::run({
+		{ "ranges, a row per value", [] { testRanges(SQLiteDataBase::RowPerValue); } },
+		{ "ranges, chunked blobs", [] { testRanges(SQLiteDataBase::ChunkedBlob); } }
+	});
+}
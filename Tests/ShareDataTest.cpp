@@ -0,0 +1,43 @@
+#include "HugeVector.h"
+#include "ContainerTests.h"
+#include "MappedModeTests.h"
+#include "FixedWidthTests.h"
+#include "ReadRangeTests.h"
+#include "HoleReuseTests.h"
+#include "CopyOnWriteTests.h"
+#include "PersistenceTests.h"
+#include "ConcurrencyTests.h"
+#include "MultiGetTests.h"
+#include "SortTests.h"
+
+using namespace HugeTest;
+
+int main()
+{
+	return HugeTest::run({
+		{ "edits qreal", testEdits<qreal> },
+		{ "edits QString", testEdits<QString> },
+		{ "edits fixed-width records", testEdits<Record> },
+		{ "mapped mode qreal", testMappedMode<qreal> },
+		{ "mapped mode QString", testMappedMode<QString> },
+		{ "mapped mode fixed-width records", testMappedMode<Record> },
+		{ "copy detach qreal", testCopyDetach<qreal> },
+		{ "copy detach QString", testCopyDetach<QString> },
+		{ "copy cost qreal", testCopyCost<qreal> },
+		{ "copy cost QString", testCopyCost<QString> },
+		{ "shared index", testSharedIndex },
+		{ "save and open qreal", testSaveOpen<qreal> },
+		{ "save and open QString", testSaveOpen<QString> },
+		{ "save and open fixed-width records", testSaveOpen<Record> },
+		{ "fixed-width layout", testFixedWidth },
+		{ "multiGet qreal", testMultiGet<qreal> },
+		{ "multiGet QString", testMultiGet<QString> },
+		{ "read failure", testReadFailure },
+		{ "concurrent access", testConcurrentAccess },
+		{ "sort qreal", testSort<qreal> },
+		{ "sort QString", testSort<QString> },
+		{ "sort failure", testSortFailure },
+		{ "sort write failure", testSortWriteFailure },
+		{ "hole reuse", testHoleReuse }
+	});
+}
@@ -0,0 +1,138 @@
+#pragma once
+#ifndef hugesorttests_h__
+#define hugesorttests_h__
+
+#include "ContainerTests.h"
+#include <algorithm>
+
+/*
+   Cases of the out-of-core sort: the content ends up sorted, or stays as it
+   was when a read or a write fails.
+*/
+namespace HugeTest
+{
+	//! Sorts through several runs and in one, the stable sort keeping the order of equal keys
+	template <class ValueType>
+	void testSort()
+	{
+		std::mt19937 generator(9);
+		QVector<ValueType> expected;
+		for (int i = 0; i < 30000; ++i)
+			expected.append(Values<ValueType>::make(int(generator() % 5000)));
+
+		HugeContainer<ValueType> container = filled(expected);
+		HUGE_CHECK(HugeContainers::sort(container, std::less<ValueType>(), 32 << 10, 4));
+		std::sort(expected.begin(), expected.end());
+		HUGE_CHECK(sameContent(container, expected));
+
+		/* equal under the comparison, told apart by their position */
+		QVector<ValueType> keyed;
+		for (int i = 0; i < 20000; ++i)
+			keyed.append(Values<ValueType>::make(i));
+		auto byKey = [](const ValueType& left, const ValueType& right) {
+			return Values<ValueType>::key(left) < Values<ValueType>::key(right);
+		};
+		HugeContainer<ValueType> stable = filled(keyed);
+		HUGE_CHECK(HugeContainers::stableSort(stable, byKey, 16 << 10, 3));
+		std::stable_sort(keyed.begin(), keyed.end(), byKey);
+		HUGE_CHECK(sameContent(stable, keyed));
+
+		HugeContainer<ValueType> single = filled(makeValues<ValueType>(0, 1000));
+		QVector<ValueType> singleExpected = single.mid(0);
+		HUGE_CHECK(HugeContainers::sort(single, [](const ValueType& left, const ValueType& right) { return right < left; }));
+		std::sort(singleExpected.begin(), singleExpected.end(), [](const ValueType& left, const ValueType& right) { return right < left; });
+		HUGE_CHECK(sameContent(single, singleExpected));
+
+		HugeContainer<ValueType> empty;
+		HUGE_CHECK(HugeContainers::sort(empty));
+		HUGE_CHECK(empty.isEmpty());
+		HugeContainer<ValueType> one = filled(makeValues<ValueType>(3, 1));
+		HUGE_CHECK(HugeContainers::stableSort(one));
+		HUGE_CHECK(sameContent(one, makeValues<ValueType>(3, 1)));
+	}
+
+	//! A read failing late in the merge, or in the single run, leaves the content and settings alone
+	inline void testSortFailure()
+	{
+		QVector<Fragile> expected;
+		for (int i = 0; i < 20000; ++i)
+			expected.append(Fragile{ QString::number((i * 7919) % 20000).repeated(1 + i % 3) });
+		HugeContainer<Fragile> container = filled(expected);
+		container.setCacheBudget(0);
+		container.setStatsEnabled(true);
+
+		/* counts the decodes of a whole sort, then fails just before the last of them */
+		HugeContainer<Fragile> probe = filled(expected);
+		probe.setCacheBudget(0);
+		decodesLeft() = 1 << 30;
+		HUGE_CHECK(HugeContainers::sort(probe, std::less<Fragile>(), 16 << 10, 2));
+		const int decodes = (1 << 30) - decodesLeft().load();
+		HUGE_CHECK(decodes > expected.size());
+		for (const int budget : { decodes - 10, expected.size() + 100, expected.size() / 2 }) {
+			decodesLeft() = budget;
+			HUGE_CHECK(!HugeContainers::sort(container, std::less<Fragile>(), 16 << 10, 2));
+			decodesLeft() = -1;
+			HUGE_CHECK(sameContent(container, expected));
+		}
+		decodesLeft() = expected.size() / 2;
+		HUGE_CHECK(!HugeContainers::sort(container));
+		decodesLeft() = -1;
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(container.statsEnabled());
+		HUGE_COMPARE(container.cacheBudget(), qint64(0));
+
+		HUGE_CHECK(HugeContainers::sort(container, std::less<Fragile>(), 16 << 10, 2));
+		std::sort(expected.begin(), expected.end());
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(container.statsEnabled());
+		HUGE_COMPARE(container.cacheBudget(), qint64(0));
+	}
+
+	//! A write failing in a run, in the merge or in the single run leaves the content alone
+	inline void testSortWriteFailure()
+	{
+		QVector<qreal> expected = makeValues<qreal>(0, 400000);
+		std::reverse(expected.begin(), expected.end());
+		HugeContainer<qreal> container = filled(expected);
+		{
+			FileSizeLimit limit(2 << 20);
+			if (!limit.isActive())
+				return;
+			HUGE_CHECK(!HugeContainers::sort(container, std::less<qreal>(), 64 << 10, 2));
+			HUGE_CHECK(!HugeContainers::sort(container, std::less<qreal>(), 5 << 19, 2));
+			HUGE_CHECK(!HugeContainers::sort(container));
+		}
+		HUGE_CHECK(sameContent(container, expected));
+
+		HUGE_CHECK(HugeContainers::sort(container, std::less<qreal>(), 64 << 10, 2));
+		std::sort(expected.begin(), expected.end());
+		HUGE_CHECK(sameContent(container, expected));
+	}
+
+	//! The sorted content lands in storage set up like the original one, run by the backends with these settings
+	template <class ValueType>
+	void testSortSettings()
+	{
+		QVector<ValueType> expected = makeValues<ValueType>(0, 20000);
+		std::reverse(expected.begin(), expected.end());
+		HugeContainer<ValueType> container(StorageMode::Mapped);
+		container.append(expected);
+		HUGE_CHECK(container.setChunkedLayout(true));
+		container.setCompactionThreshold(0.3);
+		HUGE_CHECK(container.setMemoryBudget(32 << 10));
+		HUGE_CHECK(HugeContainers::sort(container, std::less<ValueType>(), 64 << 10, 2));
+		std::sort(expected.begin(), expected.end());
+		HUGE_CHECK(sameContent(container, expected));
+		HUGE_CHECK(container.storageMode() == StorageMode::Mapped);
+		HUGE_CHECK(container.chunkedLayout());
+		HUGE_CHECK(container.compactionThreshold() == 0.3);
+		HUGE_COMPARE(container.memoryBudget(), qint64(32 << 10));
+
+		HugeContainer<ValueType> packed = filled(makeValues<ValueType>(0, 3000));
+		HUGE_CHECK(packed.setCompression(true));
+		HUGE_CHECK(HugeContainers::stableSort(packed));
+		HUGE_CHECK(packed.compression());
+	}
+}
+
+#endif // hugesorttests_h__
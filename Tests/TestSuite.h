@@ -0,0 +1,54 @@
+#pragma once
+#ifndef hugetest_h__
+#define hugetest_h__
+
+#include <QDebug>
+#include <QString>
+#include <functional>
+#include <initializer_list>
+
+/*
+   What the test executables share. ctest runs one executable per backend,
+   each a list of cases run in order. A failed check is reported with the
+   place it failed and the case goes on, the executable then exits with 1.
+*/
+namespace HugeTest
+{
+	//! Checks failed so far by the running executable
+	inline int& failures()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	inline bool check(bool passed, const char* expression, const char* file, int line)
+	{
+		if (!passed) {
+			++failures();
+			qWarning().noquote() << QStringLiteral("FAIL %1:%2: %3").arg(QString(file)).arg(line).arg(QString(expression));
+		}
+		return passed;
+	}
+
+	struct Case
+	{
+		const char* m_name;
+		std::function<void()> m_run;
+	};
+
+	//! Runs every case in order, the result is the exit code of the executable
+	inline int run(std::initializer_list<Case> cases)
+	{
+		for (const Case& testCase : cases) {
+			const int before = failures();
+			testCase.m_run();
+			qInfo().noquote() << (failures() == before ? "PASS" : "FAIL") << testCase.m_name;
+		}
+		return failures() == 0 ? 0 : 1;
+	}
+}
+
+#define HUGE_CHECK(condition) HugeTest::check(bool(condition), #condition, __FILE__, __LINE__)
+#define HUGE_COMPARE(actual, expected) HugeTest::check((actual) == (expected), #actual " == " #expected, __FILE__, __LINE__)
+
+#endif // hugetest_h__
@@ -2,7 +2,8 @@
 #include "qdebug.h"
 
 
-MyHugeVector::MyHugeVector()
+MyHugeVector::MyHugeVector(SQLiteDataBase::Schema schema)
+	: dataBase(schema)
 {
 
 }
@@ -13,11 +14,45 @@ MyHugeVector::~MyHugeVector()
 }
 
 void MyHugeVector::push_back(qreal value) {
-	QString _val = QString::number(value);
-	dataBase.push_back(_val);  // return bool on successful 
+	dataBase.push_back(value);  // return bool on successful 
 }
 
 qreal MyHugeVector::at(uint index) {
-	QString _val = QString::number(index);
-	return dataBase.at(_val);
+	return dataBase.at(index);
+}
+
+qreal MyHugeVector::sum(uint first, uint last, bool* ok) {
+	return dataBase.sum(first, last, ok);
+}
+
+bool MyHugeVector::minMax(uint first, uint last, qreal& min, qreal& max) {
+	return dataBase.minMax(first, last, min, max);
+}
+
+qint64 MyHugeVector::countWhere(uint first, uint last, qreal lo, qreal hi, bool* ok) {
+	return dataBase.countWhere(first, last, lo, hi, ok);
+}
+
+QVector<qreal> MyHugeVector::readRange(uint first, int count, bool* ok) {
+	return dataBase.readRange(first, count, ok);
+}
+
+void MyHugeVector::setBatchSize(int size) {
+	dataBase.setBatchSize(size);
+}
+
+int MyHugeVector::batchSize() const {
+	return dataBase.batchSize();
+}
+
+bool MyHugeVector::flush() {
+	return dataBase.commit();
+}
+
+void MyHugeVector::setStatsEnabled(bool enable) {
+	dataBase.setStatsEnabled(enable);
+}
+
+SQLiteDataBase::Stats MyHugeVector::stats() const {
+	return dataBase.stats();
 }
\ No newline at end of file
@@ -10,7 +10,21 @@ public:
 	void push_back(qreal value);
 	qreal at(uint index);
 
-	MyHugeVector();
+	//! first and last are included and count like the index of at()
+	qreal sum(uint first, uint last, bool* ok = nullptr);
+	bool minMax(uint first, uint last, qreal& min, qreal& max);
+	qint64 countWhere(uint first, uint last, qreal lo, qreal hi, bool* ok = nullptr);
+	QVector<qreal> readRange(uint first, int count, bool* ok = nullptr);
+
+	//! Number of push_back() calls committed together, see SQLiteDataBase::setBatchSize()
+	void setBatchSize(int size);
+	int batchSize() const;
+	bool flush();
+
+	//! See SQLiteDataBase::setStatsEnabled()
+	void setStatsEnabled(bool enable);
+	SQLiteDataBase::Stats stats() const;
+
+	explicit MyHugeVector(SQLiteDataBase::Schema schema = SQLiteDataBase::RowPerValue);
 	~MyHugeVector();
 };
-
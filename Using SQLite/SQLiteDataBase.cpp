@@ -2,9 +2,57 @@
 #include "quuid.h"
 #include "qdebug.h"
 #include <QSqlRecord>
+#include <QtEndian>
 #include <qfile.h>
+#include <chrono>
+#include <cstring>
 
-SQLiteDataBase::SQLiteDataBase()
+namespace {
+	/* adds the time from construction to destruction to a Stats histogram, unless given none */
+	class LatencyTimer
+	{
+	public:
+		explicit LatencyTimer(QVector<qint64>* target)
+			: histogram(target)
+		{
+			if (histogram)
+				start = std::chrono::steady_clock::now();
+		}
+		~LatencyTimer() {
+			if (!histogram)
+				return;
+			const qint64 elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			const int bucket = 63 - qCountLeadingZeroBits(quint64(qMax<qint64>(elapsed, 1)));
+			++(*histogram)[qMin(bucket, int(SQLiteDataBase::Stats::LatencyBuckets) - 1)];
+		}
+	private:
+		QVector<qint64>* histogram;
+		std::chrono::steady_clock::time_point start;
+	};
+}
+
+SQLiteDataBase::Stats::Stats()
+	: readCalls(0)
+	, readBytes(0)
+	, writeCalls(0)
+	, writeBytes(0)
+	, commits(0)
+	, fileBytes(0)
+	, freeBytes(0)
+	, cacheHits(0)
+	, cacheMisses(0)
+	, atLatency(LatencyBuckets, 0)
+	, pushBackLatency(LatencyBuckets, 0)
+{
+}
+
+SQLiteDataBase::SQLiteDataBase(Schema schema)
+	: layout(schema)
+	, batchLimit(10000)
+	, pendingInserts(0)
+	, valueCount(0)
+	, cachedChunkId(-1)
+	, statsOn(false)
 {
 	uniqueName = QUuid::createUuid().toString();
 	
@@ -12,25 +60,69 @@ SQLiteDataBase::SQLiteDataBase()
 	mydb.setDatabaseName(uniqueName+".db");
 		
 	if (connOpen()) {
-		sendquery("create table Vector(value double)");
+		/*
+		  the file is scratch space deleted with the object, so nothing has
+		  to survive a crash: no fsync, and the journal stays out of the way
+		*/
+		sendquery("PRAGMA journal_mode=WAL");
+		sendquery("PRAGMA synchronous=OFF");
+		sendquery("PRAGMA cache_size=-65536");
+		sendquery("PRAGMA mmap_size=268435456");
+		sendquery("PRAGMA temp_store=MEMORY");
+
+		insertQuery = QSqlQuery(mydb);
+		selectQuery = QSqlQuery(mydb);
+		selectQuery.setForwardOnly(true);
+		rangeQuery = QSqlQuery(mydb);
+		rangeQuery.setForwardOnly(true);
+		if (layout == ChunkedBlob) {
+			sendquery("create table Chunks(id integer primary key, data blob)");
+			insertQuery.prepare("insert or replace into Chunks values(?, ?)");
+			selectQuery.prepare("SELECT data FROM Chunks WHERE id=?");
+			rangeQuery.prepare("SELECT id, data FROM Chunks WHERE id BETWEEN ? AND ? ORDER BY id");
+			tailChunk.reserve(ChunkValues);
+		}
+		else {
+			sendquery("create table Vector(value double)");
+			insertQuery.prepare("insert into Vector values(?)");
+			selectQuery.prepare("SELECT value FROM Vector WHERE ROWID=?");
+			rangeQuery.prepare("SELECT value FROM Vector WHERE ROWID BETWEEN ? AND ?");
+			sumQuery = QSqlQuery(mydb);
+			sumQuery.setForwardOnly(true);
+			sumQuery.prepare("SELECT total(value) FROM Vector WHERE ROWID BETWEEN ? AND ?");
+			minMaxQuery = QSqlQuery(mydb);
+			minMaxQuery.setForwardOnly(true);
+			minMaxQuery.prepare("SELECT min(value), max(value) FROM Vector WHERE ROWID BETWEEN ? AND ?");
+			countQuery = QSqlQuery(mydb);
+			countQuery.setForwardOnly(true);
+			countQuery.prepare("SELECT count(*) FROM Vector WHERE ROWID BETWEEN ? AND ? AND value BETWEEN ? AND ?");
+		}
 	}
 }
 
 
 SQLiteDataBase::~SQLiteDataBase()
 {
-	deleteTable("Vector");
+	commitBatch();
+	insertQuery.finish();
+	selectQuery.finish();
+	insertQuery = QSqlQuery();
+	selectQuery = QSqlQuery();
+	rangeQuery = QSqlQuery();
+	sumQuery = QSqlQuery();
+	minMaxQuery = QSqlQuery();
+	countQuery = QSqlQuery();
+	deleteTable(layout == ChunkedBlob ? "Chunks" : "Vector");
 	connClose();
 	cleanDBFile();
 }
 
 
 bool SQLiteDataBase::connOpen() {
-	bool ret = false;
-	if (mydb.open()) {
-		ret = true;
-	}
-	return ret;
+	/* opening again would close the connection and drop the prepared statements */
+	if (mydb.isOpen())
+		return true;
+	return mydb.open();
 }
 
 void SQLiteDataBase::connClose() {
@@ -52,36 +144,345 @@ bool SQLiteDataBase::sendquery(QString val="") {
 	return ok;
 }
 
-QByteArray SQLiteDataBase::readValue(QString val = "") {
-	QByteArray data;
-	if (connOpen()) {
-		QSqlQuery query(mydb);
+/* Insert the value at last in Vector table, or in the last chunk*/
+bool SQLiteDataBase::push_back(qreal val) {
+	LatencyTimer timer(statsOn ? &counts.pushBackLatency : nullptr);
+	if (layout == ChunkedBlob) {
+		/* a full chunk is written before the value counts, a failed write leaves the tail as it was */
+		tailChunk.append(val);
+		if (tailChunk.size() == ChunkValues && !writeTail(valueCount + 1)) {
+			tailChunk.removeLast();
+			return false;
+		}
+		++valueCount;
+		if (tailChunk.size() == ChunkValues)
+			tailChunk.clear();
+		return true;
+	}
+	insertQuery.bindValue(0, val);
+	if (statsOn)
+		counts.writeBytes += sizeof(double);
+	if (!execInsert())
+		return false;
+	++valueCount;
+	return true;
+}
 
-	    bool ok = query.exec(val);
-		if (!ok) {
-			qDebug() << "Error on sendquery" << query.lastError();
+/* runs the bound insert inside the running batch, starting one if needed */
+bool SQLiteDataBase::execInsert() {
+	if (batchLimit > 1 && pendingInserts == 0 && !mydb.transaction())
+		return false;
+	const bool ok = insertQuery.exec();
+	if (statsOn)
+		++counts.writeCalls;
+	if (!ok) {
+		qDebug() << "Error on push_back" << insertQuery.lastError();
+	}
+	if (batchLimit > 1 && ++pendingInserts >= batchLimit)
+		return commitBatch() && ok;
+	return ok;
+}
+
+/* count is the number of values up to the end of the tail; a chunk written before it was full is replaced once more values come */
+bool SQLiteDataBase::writeTail(qint64 count) {
+	insertQuery.bindValue(0, (count - tailChunk.size()) / ChunkValues);
+	insertQuery.bindValue(1, encodeChunk(tailChunk));
+	if (statsOn)
+		counts.writeBytes += tailChunk.size() * qint64(sizeof(double));
+	return execInsert();
+}
+
+
+/* rows written by the running transaction are visible to the same connection, no commit needed */
+qreal SQLiteDataBase::at(qint64 rowId) {
+	LatencyTimer timer(statsOn ? &counts.atLatency : nullptr);
+	if (layout == ChunkedBlob)
+		return chunkedAt(rowId - 1);
+	qreal result = 0;
+	selectQuery.bindValue(0, rowId);
+	if (statsOn) {
+		++counts.readCalls;
+		counts.readBytes += sizeof(double);
+	}
+	if (!selectQuery.exec()) {
+		qDebug() << "Error on at" << selectQuery.lastError();
+		return result;
+	}
+	if (selectQuery.next())
+		result = selectQuery.value(0).toDouble();
+	selectQuery.finish();
+	return result;
+}
+
+qreal SQLiteDataBase::chunkedAt(qint64 index) {
+	if (index < 0 || index >= valueCount)
+		return 0;
+	const qint64 tailStart = valueCount - tailChunk.size();
+	const qint64 chunkId = index / ChunkValues;
+	if (statsOn)
+		++((index >= tailStart || chunkId == cachedChunkId) ? counts.cacheHits : counts.cacheMisses);
+	if (index >= tailStart)
+		return tailChunk.at(int(index - tailStart));
+
+	/* full chunks never change, the one read last stays valid */
+	if (chunkId != cachedChunkId) {
+		cachedChunkId = -1;
+		selectQuery.bindValue(0, chunkId);
+		if (!selectQuery.exec() || !selectQuery.next()) {
+			qDebug() << "Error on at" << selectQuery.lastError();
+			selectQuery.finish();
+			return 0;
+		}
+		const QByteArray blob = selectQuery.value(0).toByteArray();
+		if (statsOn) {
+			++counts.readCalls;
+			counts.readBytes += blob.size();
+		}
+		decodeChunk(blob, cachedChunk);
+		selectQuery.finish();
+		cachedChunkId = chunkId;
+	}
+	return cachedChunk.value(int(index % ChunkValues));
+}
+
+/* values are stored little-endian whatever the machine, so the file can move */
+QByteArray SQLiteDataBase::encodeChunk(const QVector<double>& values) {
+	QByteArray blob;
+	blob.resize(values.size() * int(sizeof(double)));
+	char* out = blob.data();
+	for (const double val : values) {
+		quint64 bits;
+		std::memcpy(&bits, &val, sizeof(bits));
+		qToLittleEndian(bits, out);
+		out += sizeof(bits);
+	}
+	return blob;
+}
+
+void SQLiteDataBase::decodeChunk(const QByteArray& blob, QVector<double>& values) {
+	values.resize(blob.size() / int(sizeof(double)));
+	const char* in = blob.constData();
+	for (double& val : values) {
+		const quint64 bits = qFromLittleEndian<quint64>(in);
+		std::memcpy(&val, &bits, sizeof(val));
+		in += sizeof(bits);
+	}
+}
+
+bool SQLiteDataBase::clampRange(qint64& firstRowId, qint64& lastRowId) const {
+	firstRowId = qMax<qint64>(firstRowId, 1);
+	lastRowId = qMin(lastRowId, valueCount);
+	return firstRowId <= lastRowId;
+}
+
+/* runs one of the prepared range statements over [first, last], its other values already bound */
+bool SQLiteDataBase::execRange(QSqlQuery& query, qint64 first, qint64 last) {
+	query.bindValue(0, first);
+	query.bindValue(1, last);
+	if (statsOn)
+		++counts.readCalls;
+	if (!query.exec()) {
+		qDebug() << "Error on range query" << query.lastError();
+		return false;
+	}
+	return true;
+}
+
+/* hands visit(values, count) the values of the range, chunk by chunk, the last one from RAM */
+template <class Visit>
+bool SQLiteDataBase::scanChunks(qint64 firstRowId, qint64 lastRowId, Visit visit) {
+	const qint64 first = firstRowId - 1;
+	const qint64 last = lastRowId - 1;
+	const qint64 tailStart = valueCount - tailChunk.size();
+	if (first < tailStart) {
+		if (!execRange(rangeQuery, first / ChunkValues, qMin(last, tailStart - 1) / ChunkValues))
+			return false;
+		QVector<double> values;
+		while (rangeQuery.next()) {
+			const qint64 chunkStart = rangeQuery.value(0).toLongLong() * ChunkValues;
+			const QByteArray blob = rangeQuery.value(1).toByteArray();
+			if (statsOn)
+				counts.readBytes += blob.size();
+			decodeChunk(blob, values);
+			const int from = int(qMax(first, chunkStart) - chunkStart);
+			const int to = int(qMin(last, chunkStart + values.size() - 1) - chunkStart);
+			if (from <= to)
+				visit(values.constData() + from, to - from + 1);
+		}
+		rangeQuery.finish();
+	}
+	if (last >= tailStart) {
+		const int from = int(qMax(first, tailStart) - tailStart);
+		visit(tailChunk.constData() + from, int(last - tailStart) - from + 1);
+	}
+	return true;
+}
+
+qreal SQLiteDataBase::sum(qint64 firstRowId, qint64 lastRowId, bool* ok) {
+	qreal result = 0;
+	bool done = true;
+	if (clampRange(firstRowId, lastRowId)) {
+		if (layout == ChunkedBlob) {
+			done = scanChunks(firstRowId, lastRowId, [&result](const double* values, int count) {
+				for (int i = 0; i < count; ++i)
+					result += values[i];
+			});
 		}
 		else {
-			while (query.next()) {
-				QSqlRecord record = query.record();
-				int fieldNo = record.indexOf("value");
-				data = record.value(fieldNo).toByteArray();
+			done = execRange(sumQuery, firstRowId, lastRowId) && sumQuery.next();
+			if (done)
+				result = sumQuery.value(0).toDouble();
+			sumQuery.finish();
+		}
+	}
+	if (ok)
+		*ok = done;
+	return done ? result : 0;
+}
+
+bool SQLiteDataBase::minMax(qint64 firstRowId, qint64 lastRowId, qreal& min, qreal& max) {
+	if (!clampRange(firstRowId, lastRowId))
+		return false;
+	if (layout == ChunkedBlob) {
+		bool found = false;
+		const bool ok = scanChunks(firstRowId, lastRowId, [&](const double* values, int count) {
+			for (int i = 0; i < count; ++i) {
+				if (!found || values[i] < min)
+					min = values[i];
+				if (!found || values[i] > max)
+					max = values[i];
+				found = true;
 			}
+		});
+		return ok && found;
+	}
+	const bool found = execRange(minMaxQuery, firstRowId, lastRowId) && minMaxQuery.next();
+	if (found) {
+		min = minMaxQuery.value(0).toDouble();
+		max = minMaxQuery.value(1).toDouble();
+	}
+	minMaxQuery.finish();
+	return found;
+}
+
+qint64 SQLiteDataBase::countWhere(qint64 firstRowId, qint64 lastRowId, qreal lo, qreal hi, bool* ok) {
+	qint64 result = 0;
+	bool done = true;
+	if (clampRange(firstRowId, lastRowId)) {
+		if (layout == ChunkedBlob) {
+			done = scanChunks(firstRowId, lastRowId, [&](const double* values, int count) {
+				for (int i = 0; i < count; ++i) {
+					if (values[i] >= lo && values[i] <= hi)
+						++result;
+				}
+			});
+		}
+		else {
+			countQuery.bindValue(2, lo);
+			countQuery.bindValue(3, hi);
+			done = execRange(countQuery, firstRowId, lastRowId) && countQuery.next();
+			if (done)
+				result = countQuery.value(0).toLongLong();
+			countQuery.finish();
+		}
+	}
+	if (ok)
+		*ok = done;
+	return done ? result : 0;
+}
+
+QVector<qreal> SQLiteDataBase::readRange(qint64 firstRowId, qint64 count, bool* ok) {
+	QVector<qreal> result;
+	bool done = true;
+	qint64 lastRowId = firstRowId + count - 1;
+	if (count > 0 && clampRange(firstRowId, lastRowId)) {
+		result.reserve(int(lastRowId - firstRowId + 1));
+		if (layout == ChunkedBlob) {
+			done = scanChunks(firstRowId, lastRowId, [&result](const double* values, int len) {
+				for (int i = 0; i < len; ++i)
+					result.append(values[i]);
+			});
+		}
+		else {
+			done = execRange(rangeQuery, firstRowId, lastRowId);
+			while (done && rangeQuery.next())
+				result.append(rangeQuery.value(0).toDouble());
+			rangeQuery.finish();
+			if (statsOn)
+				counts.readBytes += result.size() * qint64(sizeof(double));
 		}
 	}
-	return data;
+	if (ok)
+		*ok = done;
+	if (!done)
+		result.clear();
+	return result;
+}
+
+qint64 SQLiteDataBase::size() const {
+	return valueCount;
+}
+
+SQLiteDataBase::Schema SQLiteDataBase::schema() const {
+	return layout;
+}
+
+void SQLiteDataBase::setBatchSize(int size) {
+	batchLimit = qMax(size, 1);
+	if (pendingInserts >= batchLimit)
+		commitBatch();
+}
+
+int SQLiteDataBase::batchSize() const {
+	return batchLimit;
 }
 
+bool SQLiteDataBase::commit() {
+	bool ok = true;
+	if (layout == ChunkedBlob && !tailChunk.isEmpty())
+		ok = writeTail(valueCount);
+	return commitBatch() && ok;
+}
 
+bool SQLiteDataBase::commitBatch() {
+	if (pendingInserts == 0)
+		return true;
+	pendingInserts = 0;
+	if (statsOn)
+		++counts.commits;
+	if (!mydb.commit()) {
+		qDebug() << "Error on commit" << mydb.lastError();
+		return false;
+	}
+	return true;
+}
 
-/* Insert the value at last in Vector table*/
-bool SQLiteDataBase::push_back(QString& val) {
-	return sendquery("insert into Vector values("+val+")");
+void SQLiteDataBase::setStatsEnabled(bool enable) {
+#ifndef HUGECONTAINER_NO_STATS
+	/* turning them on starts from zero */
+	if (enable && !statsOn)
+		counts = Stats();
+	statsOn = enable;
+#else
+	Q_UNUSED(enable);
+#endif
 }
 
+bool SQLiteDataBase::statsEnabled() const {
+	return statsOn;
+}
 
-qreal SQLiteDataBase::at(QString &index) {
-	return readValue("SELECT * FROM Vector WHERE ROWID=" + index).toDouble();
+SQLiteDataBase::Stats SQLiteDataBase::stats() const {
+	Stats result = statsOn ? counts : Stats();
+	QSqlQuery query(mydb);
+	if (query.exec("PRAGMA page_size") && query.next()) {
+		const qint64 pageSize = query.value(0).toLongLong();
+		if (query.exec("PRAGMA page_count") && query.next())
+			result.fileBytes = query.value(0).toLongLong() * pageSize;
+		if (query.exec("PRAGMA freelist_count") && query.next())
+			result.freeBytes = query.value(0).toLongLong() * pageSize;
+	}
+	return result;
 }
 
 bool SQLiteDataBase::deleteTable(QString tableName) {
@@ -91,4 +492,6 @@ bool SQLiteDataBase::deleteTable(QString tableName) {
 void SQLiteDataBase::cleanDBFile() {
 	auto ret = mydb.databaseName();
 		QFile::remove(mydb.databaseName());
+		QFile::remove(mydb.databaseName() + "-wal");
+		QFile::remove(mydb.databaseName() + "-shm");
 }
\ No newline at end of file
@@ -1,26 +1,113 @@
 #pragma once
 #include <qsqldatabase.h>
+#include <qvector.h>
 #include "qsqlquery.h"
 #include "qsqlerror.h"
 
 class SQLiteDataBase
 {
+public:
+	//! How the values are laid out in the database
+	enum Schema {
+		RowPerValue,	//!< one row of Vector(value double) per value
+		ChunkedBlob	//!< ChunkValues values per row of Chunks(id integer primary key, data blob)
+	};
+	enum { ChunkValues = 4096 };
+
+	/*
+	  Snapshot returned by stats(). The sizes are always filled in, the
+	  counts only while setStatsEnabled(true), and never once
+	  HUGECONTAINER_NO_STATS is defined.
+	*/
+	struct Stats
+	{
+		enum { LatencyBuckets = 40 };
+		Stats();
+
+		qint64 readCalls;	//!< statements reading values
+		qint64 readBytes;	//!< bytes of the values or chunks they returned
+		qint64 writeCalls;	//!< insert statements
+		qint64 writeBytes;
+		qint64 commits;
+		qint64 fileBytes;	//!< pages of the database file
+		qint64 freeBytes;	//!< pages freed and not reused yet
+		qint64 cacheHits;	//!< ChunkedBlob only: at() served by the last chunk read or the one being filled
+		qint64 cacheMisses;
+		/* bucket b counts the calls that took from 2^b up to 2^(b+1) nanoseconds, the last one anything longer */
+		QVector<qint64> atLatency;
+		QVector<qint64> pushBackLatency;
+	};
+
+private:
 	QSqlDatabase mydb;
 	QString uniqueName;
+	Schema layout;
+	/* prepared once, every call only binds its value */
+	QSqlQuery insertQuery;
+	QSqlQuery selectQuery;
+	/* the range statements: the values of a range, rows or chunks, and the RowPerValue aggregates */
+	QSqlQuery rangeQuery;
+	QSqlQuery sumQuery;
+	QSqlQuery minMaxQuery;
+	QSqlQuery countQuery;
+	int batchLimit;
+	int pendingInserts;
+	qint64 valueCount;
+	/* ChunkedBlob only: the last chunk is filled in RAM, the last chunk read is kept */
+	QVector<double> tailChunk;
+	qint64 cachedChunkId;
+	QVector<double> cachedChunk;
+	bool statsOn;
+	Stats counts;
 	bool connOpen();
 	void connClose();
 
 	inline bool sendquery(QString val);
-	inline QByteArray readValue(QString val);
 	bool deleteTable(QString tableName);
 	inline void cleanDBFile();
+	bool execInsert();
+	bool writeTail(qint64 count);
+	bool commitBatch();
+	qreal chunkedAt(qint64 index);
+	static QByteArray encodeChunk(const QVector<double>& values);
+	static void decodeChunk(const QByteArray& blob, QVector<double>& values);
+	bool clampRange(qint64& firstRowId, qint64& lastRowId) const;
+	bool execRange(QSqlQuery& query, qint64 first, qint64 last);
+	template <class Visit>
+	bool scanChunks(qint64 firstRowId, qint64 lastRowId, Visit visit);
 public:
 	
-	bool push_back(QString& val);
-	qreal at(QString &index);
+	bool push_back(qreal val);
+	//! rowId counts from 1, in either schema
+	qreal at(qint64 rowId);
+	qint64 size() const;
+	Schema schema() const;
 
+	/*
+	  Ranges go from firstRowId to lastRowId included, counting from 1 as at()
+	  does, and are clipped to the values stored. Each one is a single
+	  statement: an aggregate over the rowids, or a scan of the chunks.
+	  When a statement fails the result is 0 or empty and *ok, if given, is
+	  set to false.
+	*/
+	qreal sum(qint64 firstRowId, qint64 lastRowId, bool* ok = nullptr);
+	//! false when the range holds no value or a statement failed
+	bool minMax(qint64 firstRowId, qint64 lastRowId, qreal& min, qreal& max);
+	//! Values of the range between lo and hi, both included
+	qint64 countWhere(qint64 firstRowId, qint64 lastRowId, qreal lo, qreal hi, bool* ok = nullptr);
+	QVector<qreal> readRange(qint64 firstRowId, qint64 count, bool* ok = nullptr);
 
-	SQLiteDataBase();
+	//! Inserts are grouped in transactions of size statements, 1 commits each of them
+	void setBatchSize(int size);
+	int batchSize() const;
+	//! Commits the inserts of the running transaction, with a partly filled last chunk
+	bool commit();
+
+	//! Off by default, it then costs a test per call
+	void setStatsEnabled(bool enable);
+	bool statsEnabled() const;
+	Stats stats() const;
+
+	explicit SQLiteDataBase(Schema schema = RowPerValue);
 	~SQLiteDataBase();
 };
-
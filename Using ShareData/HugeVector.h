@@ -1,42 +1,275 @@
 #pragma once
-#ifndef hugecontainer_h__
-#define hugecontainer_h__
-
-#include <QDataStream>
-#include <QDir>
-#include <QDirIterator>
-#include <qvector.h>
-#include <QSharedData>
-#include <QSharedDataPointer>
-#include <QExplicitlySharedDataPointer>
-#include <QTemporaryFile>
-#include <QDebug>
-#include <memory>
-#include <initializer_list>
+#ifndef hugecontainer_sharedata_h__
+#define hugecontainer_sharedata_h__
+
+#include "../Common/HugeContainerCommon.h"
+#include <set>
 
 
 namespace HugeContainers {
-	template <class ValueType>
-	class HugeContainer;
-}
+	/*
+	   Free space of the data file. Only the free blocks are tracked, by
+	   position and by size, the used ones are known to the index of the
+	   elements. A write reuses the smallest hole it fits in and only the rest
+	   of that hole stays free. A released block is merged with the free
+	   blocks around it; when that reaches the end of the file the used part
+	   simply gets shorter.
+	   This backend deliberately has no chunked layout like the TempFile one.
+	   Here every element owns its own extent, a change writes that element
+	   only, and holes are refilled in place rather than compacted away.
+	   Chunks would rewrite up to a whole chunk per change and leave
+	   chunk-sized holes that few writes fit in. The index already takes one
+	   64-bit record per element, so chunks would save little of it, and
+	   scans already merge neighbouring extents into one read.
+	*/
+	class ExtentAllocator
+	{
+	public:
+		ExtentAllocator()
+			: m_end(0)
+			, m_freeBytes(0)
+		{
+		}
 
-template <class ValueType>
-QDataStream& operator<<(QDataStream &out, const HugeContainers::HugeContainer<ValueType>& cont);
+		//! Number of free blocks, the end of the file included
+		int size() const { return m_free.size() + 1; }
 
-template <class ValueType>
-QDataStream& operator>>(QDataStream &in, HugeContainers::HugeContainer<ValueType>& cont);
+		//! Where the used part of the file ends
+		qint64 end() const { return m_end; }
 
+		//! Bytes held by free blocks before the end of the file
+		qint64 freeBytes() const { return m_freeBytes; }
 
-namespace HugeContainers {
-	//! Removes any leftover data from previous crashes
-	inline void cleanUp() {
-		QDirIterator cleanIter{ QDir::tempPath(), QStringList(QStringLiteral("HugeContainerData*")), QDir::Files | QDir::Writable | QDir::CaseSensitive | QDir::NoDotAndDotDot };
-		while (cleanIter.hasNext()) {
-			cleanIter.next();
-			QFile::remove(cleanIter.filePath());
+		//! Reserves len bytes in the smallest free block that fits, or at the end of the file
+		qint64 allocate(qint64 len)
+		{
+			Q_ASSERT(len > 0);
+			auto fitIter = m_freeBySize.lower_bound(qMakePair(len, qint64(0)));
+			if (fitIter == m_freeBySize.end())
+				return append(len);
+
+			const qint64 holeSize = fitIter->first;
+			const qint64 pos = fitIter->second;
+			m_freeBySize.erase(fitIter);
+			m_free.remove(pos);
+			m_freeBytes -= holeSize;
+			if (holeSize > len)
+				addFree(pos + len, holeSize - len);
+			return pos;
+		}
+
+		//! Reserves len bytes at the end of the file
+		qint64 append(qint64 len)
+		{
+			Q_ASSERT(len > 0);
+			const qint64 pos = m_end;
+			m_end += len;
+			return pos;
+		}
+
+		//! Gives back the len bytes at pos, which allocate() or append() handed out
+		void release(qint64 pos, qint64 len)
+		{
+			Q_ASSERT(pos >= 0 && len > 0 && pos + len <= m_end);
+
+			/* absorb the free neighbours */
+			qint64 start = pos;
+			qint64 stop = pos + len;
+			auto nextIter = m_free.find(stop);
+			if (nextIter != m_free.end()) {
+				stop += nextIter.value();
+				removeFree(nextIter);
+			}
+			auto prevIter = m_free.lowerBound(pos);
+			if (prevIter != m_free.begin()) {
+				--prevIter;
+				if (prevIter.key() + prevIter.value() == pos) {
+					start = prevIter.key();
+					removeFree(prevIter);
+				}
+			}
+
+			if (stop == m_end)
+				m_end = start;
+			else
+				addFree(start, stop - start);
+		}
+
+		void clear()
+		{
+			m_free.clear();
+			m_freeBySize.clear();
+			m_end = 0;
+			m_freeBytes = 0;
+		}
+
+	private:
+		void addFree(qint64 pos, qint64 len)
+		{
+			m_free.insert(pos, len);
+			m_freeBySize.insert(qMakePair(len, pos));
+			m_freeBytes += len;
+		}
+
+		void removeFree(QMap<qint64, qint64>::iterator freeIter)
+		{
+			const std::size_t removed = m_freeBySize.erase(qMakePair(freeIter.value(), freeIter.key()));
+			Q_ASSERT(removed == 1);
+			Q_UNUSED(removed);
+			m_freeBytes -= freeIter.value();
+			m_free.erase(freeIter);
+		}
+
+		QMap<qint64, qint64> m_free;	//!< length of every free block, by position
+		std::set<QPair<qint64, qint64> > m_freeBySize;	//!< (size, position) of every free block
+		qint64 m_end;
+		qint64 m_freeBytes;
+	};
+
+	/*
+	   keeps pages of records in RAM. Pages are implicitly shared, so a copy of
+	   the store only duplicates the pages written after the copy.
+	*/
+	template <class Record>
+	class MemoryPageStore
+	{
+	public:
+		enum { PageRecords = 1024 };
+
+		qint64 allocatePage()
+		{
+			if (!m_freePages.isEmpty())
+				return m_freePages.takeLast();
+			m_pages.append(QVector<Record>(PageRecords));
+			return m_pages.size() - 1;
+		}
+
+		void releasePage(qint64 page)
+		{
+			m_freePages.append(page);
+		}
+
+		bool read(qint64 page, int first, int count, Record* out) const
+		{
+			std::copy_n(m_pages.at(int(page)).constData() + first, count, out);
+			return true;
+		}
+
+		bool write(qint64 page, int first, int count, const Record* in)
+		{
+			std::copy_n(in, count, m_pages[int(page)].data() + first);
+			return true;
+		}
+
+		void clear()
+		{
+			m_pages.clear();
+			m_freePages.clear();
+		}
+
+	private:
+		QVector<QVector<Record> > m_pages;
+		QVector<qint64> m_freePages;
+	};
+
+	/*
+	   Position and length of the block of every element, both packed in one
+	   64-bit record: PositionBits for the position, the rest for the length.
+	   Lengths too big for it are kept aside, by position, so only elements
+	   of 64 KB or more cost anything on top of their record. The records are
+	   paged in RAM under a counted B+tree, about 8 bytes per element in all.
+	*/
+	class BlockIndex
+	{
+	public:
+		enum { PositionBits = 48 };
+
+		qint64 size() const { return m_records.size(); }
+
+		bool get(qint64 index, qint64& pos, qint64& len) const
+		{
+			quint64 record;
+			if (!m_records.get(index, record))
+				return false;
+			unpack(record, pos, len);
+			return true;
+		}
+
+		//! Position and length of the count blocks starting at first
+		bool read(qint64 first, int count, QVector<QPair<qint64, qint64> >& extents) const
+		{
+			std::vector<quint64> records(count);
+			if (!m_records.read(first, count, records.data()))
+				return false;
+			extents.resize(count);
+			for (int i = 0; i < count; ++i)
+				unpack(records[i], extents[i].first, extents[i].second);
+			return true;
+		}
+
+		bool insert(qint64 index, qint64 pos, qint64 len)
+		{
+			quint64 record;
+			return pack(pos, len, record) && m_records.insert(index, record);
+		}
+
+		bool append(const QVector<QPair<qint64, qint64> >& extents)
+		{
+			std::vector<quint64> records(extents.size());
+			for (int i = 0; i < extents.size(); ++i) {
+				if (!pack(extents.at(i).first, extents.at(i).second, records[i]))
+					return false;
+			}
+			return m_records.append(records.data(), qint64(records.size()));
+		}
+
+		bool remove(qint64 index)
+		{
+			quint64 record;
+			if (!m_records.get(index, record))
+				return false;
+			if ((record & LengthMask) == quint64(LengthMask))
+				m_longBlocks.remove(qint64(record >> LengthBits));
+			return m_records.remove(index);
+		}
+
+		void clear()
+		{
+			m_records.clear();
+			m_longBlocks.clear();
 		}
 
-	}
+	private:
+		enum {
+			LengthBits = 64 - PositionBits,
+			LengthMask = (1 << LengthBits) - 1	//!< length field of a block kept in m_longBlocks
+		};
+
+		bool pack(qint64 pos, qint64 len, quint64& record)
+		{
+			if (Q_UNLIKELY(pos < 0 || pos >= (qint64(1) << PositionBits) || len <= 0))
+				return false;
+			if (len >= qint64(LengthMask)) {
+				m_longBlocks.insert(pos, len);
+				record = (quint64(pos) << LengthBits) | quint64(LengthMask);
+			}
+			else {
+				record = (quint64(pos) << LengthBits) | quint64(len);
+			}
+			return true;
+		}
+
+		void unpack(quint64 record, qint64& pos, qint64& len) const
+		{
+			pos = qint64(record >> LengthBits);
+			len = qint64(record & LengthMask);
+			if (len == qint64(LengthMask))
+				len = m_longBlocks.value(pos, -1);
+		}
+
+		PagedSequence<quint64, MemoryPageStore<quint64> > m_records;
+		QHash<qint64, qint64> m_longBlocks;	//!< length of the blocks too big for their record
+	};
 
 	template <class ValueType>
 	class HugeContainer
@@ -44,227 +277,676 @@ namespace HugeContainers {
 		static_assert(std::is_default_constructible<ValueType>::value, "ValueType must provide a default constructor");
 		static_assert(std::is_copy_constructible<ValueType>::value, "ValueType must provide a copy constructor");
 	private:
-		template <class ValueType>
-		struct ContainerObjectData : public QSharedData
+		typedef std::integral_constant<bool, UseFixedWidthStorage<ValueType>::value> FixedWidthTag;
+
+		enum {
+			RangeChunk = 1 << 16,	//!< elements decoded per read by readRange()
+			ReadAheadBytes = 4 << 20,	//!< window of fixed-width elements decoded at once by const_iterator
+			ReadAheadElements = 1 << 14,	//!< window of serialized elements decoded at once by const_iterator
+			MaxReadGap = 1 << 12,	//!< dead bytes readRange() reads through rather than issuing another read
+			MultiGetRunsPerThread = 16	//!< merged reads multiGet() gives each of its threads, at least
+		};
+
+		/*
+		  the storage lock is held for reading by every read and for writing by
+		  every change. Readers still share the element cache, which gets a
+		  mutex of its own.
+		*/
+		struct AccessLocks
 		{
-			bool m_isAvailable;
-			union ObjectData
-			{
-				explicit ObjectData(qint64 fp)
-					:m_fPos(fp)
-				{}
-				explicit ObjectData(ValueType* v)
-					:m_val(v)
-				{}
-				qint64 m_fPos;
-				ValueType* m_val;
-			} m_data;
-			explicit ContainerObjectData(qint64 fp)
-				:QSharedData()
-				, m_isAvailable(false)
-				, m_data(fp)
-			{}
-			explicit ContainerObjectData(ValueType* v)
-				:QSharedData()
-				, m_isAvailable(true)
-				, m_data(v)
-			{
-				Q_ASSERT(v);
-			}
-			~ContainerObjectData()
-			{
-				if (m_isAvailable)
-					delete m_data.m_val;
-			}
-			ContainerObjectData(const ContainerObjectData& other)
-				:QSharedData(other)
-				, m_isAvailable(other.m_isAvailable)
-				, m_data(other.m_data.m_fPos)
-			{
-				if (m_isAvailable)
-					m_data.m_val = new ValueType(*(other.m_data.m_val));
-			}
+			QReadWriteLock m_storage;
+			QMutex m_cache;
 		};
 
-		template <class ValueType>
-		class ContainerObject
+		/* what stats() reports besides the sizes, only while setStatsEnabled(true) */
+		struct ContainerCounters
 		{
-			QExplicitlySharedDataPointer<ContainerObjectData<ValueType> > m_d;
-		public:
-			explicit ContainerObject(qint64 fPos)
-				:m_d(new ContainerObjectData<ValueType>(fPos))
+			ContainerCounters()
+				: m_cacheHits(0), m_cacheMisses(0), m_detachCopies(0)
 			{}
-			explicit ContainerObject(ValueType* val)
-				:m_d(new ContainerObjectData<ValueType>(val))
-			{}
-			ContainerObject(const ContainerObject& other) = default;
-			bool isAvailable() const { return m_d->m_isAvailable; }
-			qint64 fPos() const { return m_d->m_data.m_fPos; }
-			const ValueType* val() const { Q_ASSERT(m_d->m_isAvailable); return m_d->m_data.m_val; }
-			ValueType* val() { Q_ASSERT(m_d->m_isAvailable); m_d.detach(); return m_d->m_data.m_val; }
-			void setFPos(qint64 fp)
-			{
-				if (!m_d->m_isAvailable && m_d->m_data.m_fPos == fp)
-					return;
-				m_d.detach();
-				if (m_d->m_isAvailable)
-					delete m_d->m_data.m_val;
-				m_d->m_data.m_fPos = fp;
-				m_d->m_isAvailable = false;
-			}
-			void setVal(ValueType* vl)
-			{
-				m_d.detach();
-				if (m_d->m_isAvailable)
-					delete m_d->m_data.m_val;
-				m_d->m_data.m_val = vl;
-				m_d->m_isAvailable = true;
-			}
+			FileCounters m_data;
+			std::atomic<qint64> m_cacheHits;
+			std::atomic<qint64> m_cacheMisses;
+			std::atomic<qint64> m_detachCopies;
+			LatencyRecorder m_at;
+			LatencyRecorder m_pushBack;
+			LatencyRecorder m_insert;
 		};
 
-
-		template <class ValueType>
+		template <class ElementType>
 		class HugeContainerData : public QSharedData
 		{
 		public:
-			using ItemMapType = QVector<ContainerObject<ValueType>>;
+			using ItemMapType = BlockIndex;	//!< block of every element
 			std::unique_ptr<ItemMapType> m_itemsMap;
-			std::unique_ptr<QMap<qint64, bool> > m_memoryMap;
-			std::unique_ptr<QTemporaryFile> m_device;
+			std::unique_ptr<ExtentAllocator> m_memoryMap;
+			std::unique_ptr<ContainerFile> m_device;
+			ElementCache<ElementType> m_cache;
+			/* decode buffer reused by every read, once grown reading an element allocates nothing */
+			QByteArray m_readBlock;
+			QBuffer m_readDevice;
+			QDataStream m_readStream;
+			std::unique_ptr<AccessLocks> m_locks;	//!< only while setConcurrentAccess(true)
+			std::unique_ptr<ContainerCounters> m_counters;	//!< only while setStatsEnabled(true)
 
-			HugeContainerData()
+			explicit HugeContainerData(StorageMode mode = StorageMode::Buffered)
 				: QSharedData()
-				, m_device(std::make_unique<QTemporaryFile>(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX")))
-				, m_memoryMap(std::make_unique<QMap<qint64, bool> >())
 				, m_itemsMap(std::make_unique<ItemMapType>())
+				, m_memoryMap(std::make_unique<ExtentAllocator>())
+				, m_device(std::make_unique<ContainerFile>(mode))
+				, m_readDevice(&m_readBlock)
+				, m_readStream(&m_readDevice)
 			{
-				if (!m_device->open())
-					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to create a temporary file");
-				m_memoryMap->insert(0, true);
+				m_readDevice.open(QIODevice::ReadOnly);
 			}
 			~HugeContainerData() = default;
-			
+
+			/*
+			  detaching. The index is copied in RAM, the data file is shared with
+			  other segment by segment, see ContainerFile::copyFrom(): either side
+			  then copies the segments it writes to.
+			*/
 			HugeContainerData(HugeContainerData& other)
 				: QSharedData(other)
-				, m_device(std::make_unique<QTemporaryFile>(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX")))
-				, m_memoryMap(std::make_unique<QMap<qint64, bool> >(*(other.m_memoryMap)))
 				, m_itemsMap(std::make_unique<ItemMapType>(*(other.m_itemsMap)))
+				, m_memoryMap(std::make_unique<ExtentAllocator>(*(other.m_memoryMap)))
+				, m_device(std::make_unique<ContainerFile>(other.m_device->mode()))
+				, m_readDevice(&m_readBlock)
+				, m_readStream(&m_readDevice)
 			{
-				if (!m_device->open())
-					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to create a temporary file");
-				other.m_device->seek(0);
-				qint64 totalSize = other.m_device->size();
-				for (; totalSize > 1024; totalSize -= 1024)
-					m_device->write(other.m_device->read(1024));
-				m_device->write(other.m_device->read(totalSize));
+				m_readDevice.open(QIODevice::ReadOnly);
+				m_device->setWriteBufferSize(other.m_device->writeBufferSize());
+				if (!m_device->copyFrom(*(other.m_device)))
+					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to copy the temporary file");
+				m_cache.setBudget(other.m_cache.budget());
+				if (other.m_locks)
+					m_locks = std::make_unique<AccessLocks>();
+				/* the copy counts from here, starting with itself */
+				if (other.m_counters) {
+					m_counters = std::make_unique<ContainerCounters>();
+					m_counters->m_detachCopies = 1;
+					m_device->setCounters(&m_counters->m_data);
+				}
 			}
 
 		};
 
 		QExplicitlySharedDataPointer<HugeContainerData<ValueType>> m_d;
 
+		/* both are null outside of concurrent access, the lockers then do nothing */
+		QReadWriteLock* storageLock() const
+		{
+			return m_d->m_locks ? &m_d->m_locks->m_storage : nullptr;
+		}
+
+		QMutex* cacheLock() const
+		{
+			return m_d->m_locks ? &m_d->m_locks->m_cache : nullptr;
+		}
+
+		//! Null while statistics are off or compiled out, nothing is counted then
+		ContainerCounters* counters() const
+		{
+#ifndef HUGECONTAINER_NO_STATS
+			return m_d->m_counters.get();
+#else
+			return nullptr;
+#endif
+		}
+
+		/*
+		  times a public call from its construction to its destruction. The
+		  counters are looked up at the end, the call may have detached.
+		*/
+		class LatencyTimer
+		{
+		public:
+			LatencyTimer(const HugeContainer* container, LatencyRecorder ContainerCounters::* recorder)
+				: m_container(container)
+				, m_recorder(recorder)
+				, m_timed(container->counters() != nullptr)
+			{
+				if (m_timed)
+					m_start = std::chrono::steady_clock::now();
+			}
+			~LatencyTimer()
+			{
+				if (!m_timed)
+					return;
+				if (ContainerCounters* counters = m_container->counters())
+					(counters->*m_recorder).record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+			}
+			LatencyTimer(const LatencyTimer&) = delete;
+			LatencyTimer& operator=(const LatencyTimer&) = delete;
+		private:
+			const HugeContainer* m_container;
+			LatencyRecorder ContainerCounters::* m_recorder;
+			bool m_timed;
+			std::chrono::steady_clock::time_point m_start;
+		};
+
+		/* QReadWriteLock is not recursive, so code running under the lock counts through this */
+		int storedCount() const
+		{
+			return int(elementCount(FixedWidthTag()));
+		}
+
+		bool cacheFind(qint64 key, ValueType& out) const
+		{
+			if (!m_d->m_cache.isEnabled())
+				return false;
+			QMutexLocker locker(cacheLock());
+			const bool found = m_d->m_cache.find(key, out);
+			if (ContainerCounters* counters = this->counters())
+				(found ? counters->m_cacheHits : counters->m_cacheMisses).fetch_add(1, std::memory_order_relaxed);
+			return found;
+		}
+
+		void cacheInsert(qint64 key, const ValueType& val, qint64 cost) const
+		{
+			if (!m_d->m_cache.isEnabled())
+				return;
+			QMutexLocker locker(cacheLock());
+			m_d->m_cache.insert(key, val, cost);
+		}
+
 
 		qint64 writeInMap(const QByteArray& block) const
 		{
 			if (!m_d->m_device->isWritable())
 				return -1;
 
-			auto i = m_d->m_memoryMap->end()-1; // last value iterator
-			if (i.value()) {
-				m_d->m_memoryMap->insert(i.key() + block.size(), true);		
-				i.value() = false;
-				m_d->m_device->seek(i.key());
-				if (m_d->m_device->write(block) >= 0)
-					return i.key();
-				return -1;
-			}
-			Q_UNREACHABLE();
-			return 0;
+			const qint64 pos = m_d->m_memoryMap->allocate(block.size());
+			if (m_d->m_device->write(pos, block.constData(), block.size()))
+				return pos;
+			m_d->m_memoryMap->release(pos, block.size());
+			return -1;
 		}
 
-		void removeFromMap(qint64 pos) const {
-			auto fileIter = m_d->m_memoryMap->find(pos);
-			Q_ASSERT(fileIter != m_d->m_memoryMap->end());
-			if (fileIter.value())
-				return;
-			fileIter.value() = true;
-			m_d->m_memoryMap->erase(fileIter);
+		void removeFromMap(qint64 pos, qint64 len) const {
+			m_d->m_memoryMap->release(pos, len);
+			/* give back the tail of the file once nothing is stored there any more */
+			if (m_d->m_memoryMap->end() < m_d->m_device->size())
+				m_d->m_device->resize(m_d->m_memoryMap->end());
 		}
 
 
 	
-		qint64 writeElementInMap(const ValueType& val) const
+		qint64 writeElementInMap(const ValueType& val, qint64& len) const
 		{
 			QByteArray block;
 			{
 				QDataStream writerStream(&block, QIODevice::WriteOnly);
 				writerStream << val;
 			}
+			/* every block needs a position of its own, the cache is keyed by it */
+			if (block.isEmpty())
+				block.append('\0');
 
+			len = block.size();
 			const qint64 result = writeInMap(block);
 			return result;
 		}
 
 
-		bool saveQueue(const uint& index) const {
-			bool allOk = false;
-			auto valToWrite = m_d->m_itemsMap->begin() + index; 
-			
-			const qint64 result = writeElementInMap(*(valToWrite->val()));
-			if (result >= 0) {
-				valToWrite->setFPos(result);
-				allOk = true;
-			}
-			return allOk;
+		bool enqueueValue(std::unique_ptr<ValueType>& val) const
+		{
+			return insertValue(storedCount(), val, FixedWidthTag());
 		}
 
-		bool enqueueValue(std::unique_ptr<ValueType>& val) const
+		bool insertValue(const uint& index, std::unique_ptr<ValueType>& val, std::true_type) const
 		{
-			m_d->m_itemsMap->push_back(ContainerObject<ValueType>(val.release()));
-			if (saveQueue(size()-1)) {
+			if (!m_d->m_device->isWritable())
+				return false;
+
+			/* make room by shifting the following records, there is nothing else to update */
+			const qint64 pos = qint64(index) * sizeof(ValueType);
+			m_d->m_cache.removeFrom(pos);
+			if (!m_d->m_device->move(pos, pos + sizeof(ValueType), m_d->m_device->size() - pos))
+				return false;
+			return m_d->m_device->write(pos, reinterpret_cast<const char*>(val.get()), sizeof(ValueType));
+		}
+
+		bool insertValue(const uint& index, std::unique_ptr<ValueType>& val, std::false_type) const
+		{
+			qint64 len;
+			const qint64 pos = writeElementInMap(*val, len);
+			if (pos < 0)
+				return false;
+			if (m_d->m_itemsMap->insert(index, pos, len))
 				return true;
+			removeFromMap(pos, len);
+			return false;
+		}
+
+		bool removeValue(const uint& index, std::true_type) const
+		{
+			const qint64 pos = qint64(index) * sizeof(ValueType);
+			const qint64 tailSize = m_d->m_device->size() - pos - qint64(sizeof(ValueType));
+			if (tailSize < 0)
+				return false;
+			m_d->m_cache.removeFrom(pos);
+			if (!m_d->m_device->move(pos + sizeof(ValueType), pos, tailSize))
+				return false;
+			return m_d->m_device->resize(pos + tailSize);
+		}
+
+		bool removeValue(const uint& index, std::false_type) const
+		{
+			qint64 pos, len;
+			if (!m_d->m_itemsMap->get(index, pos, len))
+				return false;
+			m_d->m_cache.remove(pos);
+			removeFromMap(pos, len);
+			return m_d->m_itemsMap->remove(index);
+		}
+
+		qint64 elementCount(std::true_type) const
+		{
+			return m_d->m_device->size() / qint64(sizeof(ValueType));
+		}
+
+		qint64 elementCount(std::false_type) const
+		{
+			return m_d->m_itemsMap->size();
+		}
+
+		/* the records are the data section as they are */
+		bool writeSections(QFileDevice& file, ContainerFileHeader& header, std::true_type) const
+		{
+			header.layOut(storedCount(), sizeof(ValueType));
+			header.m_dataBytes = m_d->m_device->size();
+			QByteArray block;
+			for (qint64 done = 0; done < header.m_dataBytes; done += block.size()) {
+				block.resize(int(qMin<qint64>(header.m_dataBytes - done, ReadAheadBytes)));
+				if (!m_d->m_device->read(done, block.data(), block.size()))
+					return false;
+				if (!file.seek(header.m_dataOffset + done) || file.write(block) != block.size())
+					return false;
 			}
-		    return false;
+			return true;
 		}
 
-		std::unique_ptr<ValueType> valueFromBlock(const uint& index) const
+		/*
+		  blocks are written one after the other in index order, whatever the
+		  holes of the data file, so the section is compact. Blocks that already
+		  follow each other are moved with a single read and write.
+		*/
+		bool writeSections(QFileDevice& file, ContainerFileHeader& header, std::false_type) const
 		{
-			QByteArray block = readBlock(index);
-			if (block.isEmpty())
-				return nullptr;
-			auto result = std::make_unique<ValueType>();
-			QDataStream readerStream(block);
-			readerStream >> *result;
-			return result;
+			header.layOut(storedCount(), 0);
+			header.m_dataBytes = 0;
+			const int total = storedCount();
+			QVector<QPair<qint64, qint64> > extents;
+			QVector<qint64> entries;	//!< position and size of every element, one after the other
+			QByteArray block;
+			for (int first = 0; first < total; first += RangeChunk) {
+				const int count = qMin(total - first, int(RangeChunk));
+				entries.resize(2 * count);
+				if (!m_d->m_itemsMap->read(first, count, extents))
+					return false;
+				for (int i = 0; i < count; ++i)
+					entries[2 * i + 1] = extents.at(i).second;
+
+				for (int runStart = 0; runStart < count;) {
+					const qint64 runBegin = extents.at(runStart).first;
+					qint64 runEnd = runBegin + extents.at(runStart).second;
+					int runStop = runStart + 1;
+					for (; runStop < count && extents.at(runStop).first == runEnd; ++runStop)
+						runEnd += extents.at(runStop).second;
+
+					block.resize(int(runEnd - runBegin));
+					if (!m_d->m_device->read(runBegin, block.data(), block.size()))
+						return false;
+					if (!file.seek(header.m_dataOffset + header.m_dataBytes) || file.write(block) != block.size())
+						return false;
+					for (; runStart < runStop; ++runStart)
+						entries[2 * runStart] = header.m_dataBytes + extents.at(runStart).first - runBegin;
+					header.m_dataBytes += block.size();
+				}
+				const qint64 len = qint64(entries.size()) * sizeof(qint64);
+				if (!file.seek(header.m_indexOffset + qint64(first) * ContainerFileHeader::IndexEntryBytes)
+					|| file.write(reinterpret_cast<const char*>(entries.constData()), len) != len)
+					return false;
+			}
+			const qint64 indexEnd = header.m_count * ContainerFileHeader::IndexEntryBytes;
+			const QByteArray padding(int(header.m_indexBytes - indexEnd), '\0');
+			return file.seek(header.m_indexOffset + indexEnd) && file.write(padding) == padding.size();
+		}
+
+		bool loadIndex(HugeContainerData<ValueType>& data, QFileDevice& file, const ContainerFileHeader& header, std::true_type) const
+		{
+			Q_UNUSED(data);
+			Q_UNUSED(file);
+			return header.m_recordSize == qint32(sizeof(ValueType)) && header.m_dataBytes == header.m_count * qint64(sizeof(ValueType));
+		}
+
+		/* the blocks of the data section follow each other in index order, the layout is rebuilt from their sizes */
+		bool loadIndex(HugeContainerData<ValueType>& data, QFileDevice& file, const ContainerFileHeader& header, std::false_type) const
+		{
+			if (header.m_recordSize != 0 || !file.seek(header.m_indexOffset))
+				return false;
+			QVector<qint64> entries;
+			QVector<QPair<qint64, qint64> > extents;
+			for (qint64 first = 0; first < header.m_count; first += RangeChunk) {
+				const int count = int(qMin<qint64>(header.m_count - first, RangeChunk));
+				entries.resize(2 * count);
+				extents.resize(count);
+				const qint64 len = qint64(entries.size()) * sizeof(qint64);
+				if (file.read(reinterpret_cast<char*>(entries.data()), len) != len)
+					return false;
+				for (int i = 0; i < count; ++i) {
+					if (entries.at(2 * i) != data.m_memoryMap->end() || entries.at(2 * i + 1) <= 0)
+						return false;
+					extents[i] = qMakePair(data.m_memoryMap->append(entries.at(2 * i + 1)), entries.at(2 * i + 1));
+				}
+				if (!data.m_itemsMap->append(extents))
+					return false;
+			}
+			return data.m_memoryMap->end() == header.m_dataBytes;
 		}
 
-		QByteArray readBlock(const uint& index ) const
+		/* decodes the len bytes at pos into out through the reusable read buffer */
+		bool decodeBlock(qint64 pos, qint64 len, ValueType& out) const
+		{
+			if (Q_UNLIKELY(!m_d->m_device->isReadable() || len <= 0))
+				return false;
+			if (m_d->m_locks) {
+				/* concurrent readers cannot share the buffer, each one decodes from its own */
+				QByteArray block;
+				if (const char* mapped = m_d->m_device->mappedData(pos, len))
+					block = QByteArray::fromRawData(mapped, int(len));
+				else
+					block = m_d->m_device->read(pos, len);
+				if (block.size() != len)
+					return false;
+				QDataStream readerStream(block);
+				readerStream >> out;
+				return readerStream.status() == QDataStream::Ok;
+			}
+			m_d->m_readBlock.resize(int(len));
+			if (!m_d->m_device->read(pos, m_d->m_readBlock.data(), len))
+				return false;
+			m_d->m_readDevice.seek(0);
+			m_d->m_readStream.resetStatus();
+			m_d->m_readStream >> out;
+			return m_d->m_readStream.status() == QDataStream::Ok;
+		}
+
+		bool readValue(const uint& index, ValueType& out, std::true_type) const
 		{
 			if (Q_UNLIKELY(!m_d->m_device->isReadable()))
-				return QByteArray();
-			m_d->m_device->setTextModeEnabled(false);
-			
-			auto itemIter = m_d->m_itemsMap->begin() + index;       //  get iterator at particular position
-			Q_ASSERT(itemIter != m_d->m_itemsMap->end());
-			Q_ASSERT(!itemIter->isAvailable());
-			
-			auto fileIter = m_d->m_memoryMap->constFind(itemIter->fPos());
-			Q_ASSERT(fileIter != m_d->m_memoryMap->constEnd());
-			if (fileIter.value())
-				return QByteArray();
-			
-			auto nextIter = fileIter + 1;
-			m_d->m_device->seek(fileIter.key());
-			
-			QByteArray result;
-			if (nextIter == m_d->m_memoryMap->constEnd())
-				result = m_d->m_device->readAll();
-			else
-				result = m_d->m_device->read(nextIter.key() - fileIter.key());
-			
-			return result;
+				return false;
+			const qint64 pos = qint64(index) * sizeof(ValueType);
+			if (cacheFind(pos, out))
+				return true;
+			if (!m_d->m_device->read(pos, reinterpret_cast<char*>(&out), sizeof(ValueType)))
+				return false;
+			cacheInsert(pos, out, ElementCache<ValueType>::cost(0));
+			return true;
+		}
+
+		bool readValue(const uint& index, ValueType& out, std::false_type) const
+		{
+			qint64 pos, len;
+			if (!blockExtent(index, pos, len))
+				return false;
+
+			if (cacheFind(pos, out))
+				return true;
+			if (!decodeBlock(pos, len, out))
+				return false;
+			cacheInsert(pos, out, ElementCache<ValueType>::cost(len));
+			return true;
 		}
 
+		//! Position and size of the block of an element
+		bool blockExtent(const uint& index, qint64& pos, qint64& len) const
+		{
+			return m_d->m_itemsMap->get(index, pos, len);
+		}
+
+		bool appendRange(const ValueType* begin, const ValueType* end, std::true_type) const
+		{
+			if (!m_d->m_device->isWritable())
+				return false;
+			return m_d->m_device->append(reinterpret_cast<const char*>(begin), qint64(end - begin) * sizeof(ValueType)) >= 0;
+		}
+
+		bool appendRange(const ValueType* begin, const ValueType* end, std::false_type) const
+		{
+			if (!m_d->m_device->isWritable())
+				return false;
+
+			/* serialize the whole batch, remembering where each element ends */
+			QByteArray block;
+			QVector<qint64> ends;
+			ends.reserve(int(end - begin));
+			{
+				QDataStream writerStream(&block, QIODevice::WriteOnly);
+				for (const ValueType* val = begin; val != end; ++val) {
+					writerStream << *val;
+					/* every block needs a position of its own, the cache is keyed by it */
+					if (writerStream.device()->pos() == (ends.isEmpty() ? 0 : ends.last()))
+						writerStream.writeRawData("", 1);
+					ends.append(writerStream.device()->pos());
+				}
+			}
+
+			/* the batch goes at the end of the file in one write, then it is split per element */
+			if (!m_d->m_device->write(m_d->m_memoryMap->end(), block.constData(), block.size()))
+				return false;
+
+			QVector<QPair<qint64, qint64> > extents;
+			extents.reserve(ends.size());
+			qint64 start = 0;
+			for (const qint64 elementEnd : ends) {
+				extents.append(qMakePair(m_d->m_memoryMap->append(elementEnd - start), elementEnd - start));
+				start = elementEnd;
+			}
+			return m_d->m_itemsMap->append(extents);
+		}
+
+		template <class OutputIt>
+		bool readChunk(const uint& first, const int count, OutputIt& out, std::true_type) const
+		{
+			const qint64 startPos = qint64(first) * sizeof(ValueType);
+			const qint64 len = qint64(count) * sizeof(ValueType);
+			QByteArray rawValues;
+			const char* source = m_d->m_device->mappedData(startPos, len);
+			if (!source) {
+				rawValues = m_d->m_device->read(startPos, len);
+				if (rawValues.size() != len)
+					return false;
+				source = rawValues.constData();
+			}
+			ValueType val;
+			for (int i = 0; i < count; ++i, source += sizeof(ValueType)) {
+				std::memcpy(&val, source, sizeof(ValueType));
+				*out = val;
+				++out;
+			}
+			return true;
+		}
+
+		template <class OutputIt>
+		bool readChunk(const uint& first, const int count, OutputIt& out, std::false_type) const
+		{
+			QVector<QPair<qint64, qint64> > extents;
+			if (!m_d->m_itemsMap->read(first, count, extents))
+				return false;
+
+			ValueType val;
+			for (int runStart = 0; runStart < extents.size();) {
+				/* blocks lying close together in the file are fetched with a single read */
+				const qint64 runBegin = extents.at(runStart).first;
+				qint64 runEnd = runBegin + extents.at(runStart).second;
+				int runStop = runStart + 1;
+				for (; runStop < extents.size(); ++runStop) {
+					const QPair<qint64, qint64>& next = extents.at(runStop);
+					if (next.first < runEnd || next.first - runEnd > MaxReadGap)
+						break;
+					runEnd = next.first + next.second;
+				}
+
+				QByteArray block;
+				if (const char* mapped = m_d->m_device->mappedData(runBegin, runEnd - runBegin))
+					block = QByteArray::fromRawData(mapped, int(runEnd - runBegin));
+				else
+					block = m_d->m_device->read(runBegin, runEnd - runBegin);
+				if (block.size() != runEnd - runBegin)
+					return false;
+
+				QDataStream readerStream(block);
+				for (; runStart < runStop; ++runStart) {
+					readerStream.device()->seek(extents.at(runStart).first - runBegin);
+					readerStream >> val;
+					if (readerStream.status() != QDataStream::Ok)
+						return false;
+					*out = val;
+					++out;
+				}
+			}
+			return true;
+		}
+
+
+		template <class OutputIt>
+		bool readElements(const uint& first, const int count, OutputIt out) const
+		{
+			if (count < 0 || qint64(first) + count > storedCount())
+				return false;
+			for (int done = 0; done < count;) {
+				const int step = qMin(count - done, int(RangeChunk));
+				if (!readChunk(first + done, step, out, FixedWidthTag()))
+					return false;
+				done += step;
+			}
+			return true;
+		}
+
+		//! Position and size of the bytes of the element at index in the file
+		bool elementExtent(const uint& index, qint64& pos, qint64& len, std::true_type) const
+		{
+			pos = qint64(index) * sizeof(ValueType);
+			len = sizeof(ValueType);
+			return true;
+		}
+
+		bool elementExtent(const uint& index, qint64& pos, qint64& len, std::false_type) const
+		{
+			return blockExtent(index, pos, len);
+		}
+
+
+		struct ReadRequest
+		{
+			qint64 m_pos;
+			qint64 m_size;
+			int m_slot;	//!< where the element goes in the result
+		};
+
+		struct ReadRun
+		{
+			qint64 m_begin;
+			qint64 m_end;
+			int m_first;	//!< requests of the run, in the order of the file
+			int m_stop;
+		};
+
+		static bool decodeRecord(const char* source, qint64 len, ValueType& out, std::true_type)
+		{
+			Q_ASSERT(len == qint64(sizeof(ValueType)));
+			std::memcpy(&out, source, sizeof(ValueType));
+			return true;
+		}
+
+		static bool decodeRecord(const char* source, qint64 len, ValueType& out, std::false_type)
+		{
+			QDataStream readerStream(QByteArray::fromRawData(source, int(len)));
+			readerStream >> out;
+			return readerStream.status() == QDataStream::Ok;
+		}
+
+		/*
+		  looks every index up first, in index order so that neighbouring ones
+		  share their page of the map, then sorts the reads by position, merges
+		  the ones lying close together and hands the merged reads to a pool of
+		  threads. Every thread decodes from its own buffer and the element cache
+		  is left alone, nothing shared is changed.
+		*/
+		bool fetchElements(const QVector<uint>& indices, QVector<ValueType>& values) const
+		{
+			QReadLocker locker(storageLock());
+			const qint64 total = storedCount();
+			QVector<int> order(indices.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [&indices](int left, int right) { return indices.at(left) < indices.at(right); });
+
+			QVector<ReadRequest> requests;
+			requests.reserve(indices.size());
+			for (const int slot : order) {
+				ReadRequest request;
+				request.m_slot = slot;
+				if (qint64(indices.at(slot)) >= total || !elementExtent(indices.at(slot), request.m_pos, request.m_size, FixedWidthTag()))
+					return false;
+				requests.append(request);
+			}
+			std::sort(requests.begin(), requests.end(), [](const ReadRequest& left, const ReadRequest& right) { return left.m_pos < right.m_pos; });
+
+			QVector<ReadRun> runs;
+			for (int runStart = 0; runStart < requests.size();) {
+				ReadRun run;
+				run.m_begin = requests.at(runStart).m_pos;
+				run.m_end = run.m_begin + requests.at(runStart).m_size;
+				run.m_first = runStart;
+				for (run.m_stop = runStart + 1; run.m_stop < requests.size(); ++run.m_stop) {
+					const ReadRequest& next = requests.at(run.m_stop);
+					if (next.m_pos - run.m_end > MaxReadGap)
+						break;
+					run.m_end = qMax(run.m_end, next.m_pos + next.m_size);
+				}
+				runs.append(run);
+				runStart = run.m_stop;
+			}
+
+			values.resize(indices.size());
+			ValueType* results = values.data();
+			const int threads = qBound(1, runs.size() / int(MultiGetRunsPerThread), QThread::idealThreadCount());
+			return runParallel(runs.size(), threads, [this, &runs, &requests, results](int runIndex) -> bool {
+				const ReadRun& run = runs.at(runIndex);
+				QByteArray block;
+				const char* source = m_d->m_device->mappedData(run.m_begin, run.m_end - run.m_begin);
+				if (!source) {
+					block = m_d->m_device->read(run.m_begin, run.m_end - run.m_begin);
+					if (block.size() != run.m_end - run.m_begin)
+						return false;
+					source = block.constData();
+				}
+				for (int i = run.m_first; i < run.m_stop; ++i) {
+					const ReadRequest& request = requests.at(i);
+					if (!decodeRecord(source + (request.m_pos - run.m_begin), request.m_size, results[request.m_slot], FixedWidthTag()))
+						return false;
+				}
+				return true;
+			});
+		}
+
+
+		/* empty storage with the settings of this container, statistics counted afresh */
+		QExplicitlySharedDataPointer<HugeContainerData<ValueType>> newDataLike() const
+		{
+			QExplicitlySharedDataPointer<HugeContainerData<ValueType>> newData(new HugeContainerData<ValueType>(storageMode()));
+			newData->m_device->setWriteBufferSize(writeBufferSize());
+			newData->m_cache.setBudget(cacheBudget());
+			if (m_d->m_locks)
+				newData->m_locks = std::make_unique<AccessLocks>();
+			if (m_d->m_counters) {
+				newData->m_counters = std::make_unique<ContainerCounters>();
+				newData->m_device->setCounters(&newData->m_counters->m_data);
+			}
+			return newData;
+		}
 
 	public:
 
@@ -273,6 +955,11 @@ namespace HugeContainers {
 		{
 		}
 
+		explicit HugeContainer(StorageMode mode)
+			:m_d(new HugeContainerData<ValueType>(mode))
+		{
+		}
+
 		HugeContainer(const HugeContainer& other) = default;
 		HugeContainer& operator=(const HugeContainer& other) = default;
 		HugeContainer& operator=(HugeContainer&& other) Q_DECL_NOTHROW {
@@ -285,9 +972,189 @@ namespace HugeContainers {
 			std::swap(m_d, other.m_d);
 		}
 
+		/*
+		  empty container with the settings of this one: storage mode, write
+		  buffer, cache budget, concurrent access and statistics, counted afresh
+		*/
+		HugeContainer emptyCopy() const
+		{
+			HugeContainer result;
+			result.m_d = newDataLike();
+			return result;
+		}
+
+		/*
+		  lets any number of threads read the container while one thread changes
+		  it. Reads (size, get, at, value, readRange, mid, the iterators, save)
+		  run side by side with positional reads of the files, changes (push_back,
+		  append, insert, removeAt, clear and the setters) wait for the reads in
+		  progress and hold the others back. Copying, assigning, swapping or
+		  calling open() is still left to a single thread, and so is turning the
+		  mode on or off. Off by default, single-threaded use pays no locking.
+		*/
+		void setConcurrentAccess(bool enable)
+		{
+			if (enable && !m_d->m_locks)
+				m_d->m_locks = std::make_unique<AccessLocks>();
+			else if (!enable)
+				m_d->m_locks.reset();
+		}
+
+		bool concurrentAccess() const
+		{
+			return bool(m_d->m_locks);
+		}
+
+		/*
+		  keeps up to bytes of recently read elements decoded in RAM, 0 disables the cache.
+		  The budget belongs to the storage, so copies still sharing it share the cache.
+		*/
+		void setCacheBudget(qint64 bytes)
+		{
+			QWriteLocker locker(storageLock());
+			m_d->m_cache.setBudget(bytes);
+		}
+
+		qint64 cacheBudget() const
+		{
+			return m_d->m_cache.budget();
+		}
+
+		StorageMode storageMode() const
+		{
+			return m_d->m_device->mode();
+		}
+
+		/* the mode belongs to the storage, so copies still sharing it switch as well */
+		bool setStorageMode(StorageMode mode)
+		{
+			QWriteLocker locker(storageLock());
+			return m_d->m_device->setMode(mode);
+		}
+
+		//! Appended elements are staged in RAM and written in one go every bytes, 0 writes each element as it comes
+		void setWriteBufferSize(qint64 bytes)
+		{
+			QWriteLocker locker(storageLock());
+			m_d->m_device->setWriteBufferSize(bytes);
+		}
+
+		qint64 writeBufferSize() const
+		{
+			return m_d->m_device->writeBufferSize();
+		}
+
+		//! Writes the staged elements to disk
+		bool flush()
+		{
+			QWriteLocker locker(storageLock());
+			return m_d->m_device->flush();
+		}
+
+		/*
+		  counts the calls reaching the data file, the lookups of the element
+		  cache, the copies made on detaching and the latencies of at(),
+		  push_back() and insert(), see stats(). Turning it on starts from
+		  zero, turning it off drops the counts. Off by default, when it costs
+		  a null check per call, and compiled out entirely with
+		  HUGECONTAINER_NO_STATS defined. Like the cache the counters belong
+		  to the storage, and like setConcurrentAccess() switching them is
+		  left to a single thread.
+		*/
+		void setStatsEnabled(bool enable)
+		{
+#ifndef HUGECONTAINER_NO_STATS
+			if (enable && !m_d->m_counters)
+				m_d->m_counters = std::make_unique<ContainerCounters>();
+			else if (!enable)
+				m_d->m_counters.reset();
+			m_d->m_device->setCounters(m_d->m_counters ? &m_d->m_counters->m_data : nullptr);
+#else
+			Q_UNUSED(enable);
+#endif
+		}
+
+		bool statsEnabled() const
+		{
+			return counters() != nullptr;
+		}
+
+		//! The sizes are always filled in, the counts only while statistics are on
+		ContainerStats stats() const
+		{
+			QReadLocker locker(storageLock());
+			ContainerStats result;
+			if (FixedWidthTag::value) {
+				result.m_liveBytes = m_d->m_device->size();
+			}
+			else {
+				result.m_indexBytes = m_d->m_itemsMap->size() * qint64(sizeof(quint64));
+				result.m_deadBytes = m_d->m_memoryMap->freeBytes();
+				result.m_liveBytes = m_d->m_memoryMap->end() - result.m_deadBytes;
+			}
+			const ContainerCounters* counters = this->counters();
+			if (!counters)
+				return result;
+			counters->m_data.addTo(result);
+			result.m_cacheHits = counters->m_cacheHits.load(std::memory_order_relaxed);
+			result.m_cacheMisses = counters->m_cacheMisses.load(std::memory_order_relaxed);
+			result.m_detachCopies = counters->m_detachCopies.load(std::memory_order_relaxed);
+			result.m_at = counters->m_at.snapshot();
+			result.m_pushBack = counters->m_pushBack.snapshot();
+			result.m_insert = counters->m_insert.snapshot();
+			return result;
+		}
+
+		/*
+		  writes the container to fileName, replacing it only once the whole
+		  file is written. The holes of the data file are left out, see
+		  ContainerFileHeader for the layout.
+		*/
+		bool save(const QString& fileName) const
+		{
+			QReadLocker locker(storageLock());
+			QSaveFile file(fileName);
+			if (!file.open(QIODevice::WriteOnly))
+				return false;
+			ContainerFileHeader header;
+			if (!writeSections(file, header, FixedWidthTag()) || !header.write(file)) {
+				file.cancelWriting();
+				return false;
+			}
+			return file.commit();
+		}
+
+		/*
+		  replaces the content with the one saved in fileName. The data is used
+		  in place, in the current storage mode, and fileName is never written:
+		  a change copies the segments it touches to a temporary file, see
+		  ContainerFile. No element is decoded,
+		  but the index lives in RAM: opening reads it in one pass and rebuilds
+		  the extent layout, which is O(n) in the number of elements (16 bytes
+		  read per serialized element, nothing for fixed-width records).
+		  On failure the container is left as it was.
+		*/
+		bool open(const QString& fileName)
+		{
+			QFile file(fileName);
+			ContainerFileHeader header;
+			if (!file.open(QIODevice::ReadOnly) || !header.read(file))
+				return false;
+
+			QExplicitlySharedDataPointer<HugeContainerData<ValueType>> newData = newDataLike();
+			if (!loadIndex(*newData, file, header, FixedWidthTag()))
+				return false;
+			if (!newData->m_device->attach(fileName, header.m_dataOffset, header.m_dataBytes))
+				return false;
+			m_d.swap(newData);
+			return true;
+		}
+
 		
 		void push_back(const ValueType &val) {
+			LatencyTimer timer(this, &ContainerCounters::m_pushBack);
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			auto tempval = std::make_unique<ValueType>(val);
 			enqueueValue(tempval);
 		}
@@ -296,22 +1163,248 @@ namespace HugeContainers {
 		{
 			if (!val)
 				return;
+			LatencyTimer timer(this, &ContainerCounters::m_pushBack);
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			std::unique_ptr<ValueType> tempval(val);
 			enqueueValue(tempval);
 			
 		}
 
+		//! Appends the elements in [begin, end) with a single write to the data file, false if it failed
+		bool append(const ValueType* begin, const ValueType* end)
+		{
+			if (begin == end)
+				return true;
+			m_d.detach();
+			QWriteLocker locker(storageLock());
+			return appendRange(begin, end, FixedWidthTag());
+		}
+
+		bool append(const QVector<ValueType>& values)
+		{
+			return append(values.constData(), values.constData() + values.size());
+		}
+
+		/*
+		  writes the count elements starting at first to out, fetching
+		  contiguous extents of the file with a single read
+		*/
+		template <class OutputIt>
+		bool readRange(const uint& first, const int count, OutputIt out) const
+		{
+			QReadLocker locker(storageLock());
+			return readElements(first, count, out);
+		}
+
+		//! Same as readRange() into a vector, count < 0 reads up to the end
+		QVector<ValueType> mid(const uint& first, int count = -1) const
+		{
+			QReadLocker locker(storageLock());
+			QVector<ValueType> result;
+			const int total = storedCount();
+			if (qint64(first) >= total)
+				return result;
+			if (count < 0 || qint64(first) + count > total)
+				count = total - first;
+			result.reserve(count);
+			readElements(first, count, std::back_inserter(result));
+			return result;
+		}
+
+		/*
+		  writes the elements at indices, in that order, to out. The reads are
+		  batched: all the lookups first, then the data in file order with
+		  neighbouring elements fetched together and many reads in flight on
+		  a pool of threads. Much faster than at() in a loop for random access.
+		  False if an index is out of range or a read fails.
+		*/
+		template <class OutputIt>
+		bool multiGet(const QVector<uint>& indices, OutputIt out) const
+		{
+			QVector<ValueType> values;
+			if (!fetchElements(indices, values))
+				return false;
+			std::copy(values.cbegin(), values.cend(), out);
+			return true;
+		}
+
+		/*
+		  runs multiGet() as a task of QThreadPool::globalInstance(), the
+		  result is empty if it fails. It bypasses the element cache, so plain
+		  reads can go on meanwhile; changes have to wait for the result unless
+		  concurrentAccess() is on. The container must outlive the future.
+		*/
+		std::future<QVector<ValueType> > multiGetAsync(const QVector<uint>& indices) const
+		{
+			const auto promise = std::make_shared<std::promise<QVector<ValueType> > >();
+			std::future<QVector<ValueType> > result = promise->get_future();
+			startInPool([this, indices, promise]() {
+				QVector<ValueType> values;
+				if (!fetchElements(indices, values))
+					values.clear();
+				promise->set_value(values);
+			});
+			return result;
+		}
+
+		//! Same as multiGetAsync() for one element, a default-constructed value if index is out of range
+		std::future<ValueType> atAsync(const uint& index) const
+		{
+			const auto promise = std::make_shared<std::promise<ValueType> >();
+			std::future<ValueType> result = promise->get_future();
+			startInPool([this, index, promise]() {
+				QVector<ValueType> values;
+				if (!fetchElements(QVector<uint>(1, index), values))
+					values = QVector<ValueType>(1, ValueType());
+				promise->set_value(values.first());
+			});
+			return result;
+		}
+
+		/*
+		  read-only random access iterator. Elements are decoded a window at a
+		  time with readRange(), so a pass over the container costs one read per
+		  window instead of one per element. Iterators copied from each other
+		  share the last window any of them decoded, which keeps the temporaries
+		  made by std::reverse_iterator cheap. A reference returned by operator*
+		  lives as long as an iterator on its window or the next window change.
+		  Any change to the container invalidates the iterator.
+		*/
+		class const_iterator
+		{
+		public:
+			typedef std::random_access_iterator_tag iterator_category;
+			typedef ValueType value_type;
+			typedef qptrdiff difference_type;
+			typedef const ValueType* pointer;
+			typedef const ValueType& reference;
+
+			const_iterator()
+				: m_container(nullptr)
+				, m_index(0)
+			{
+			}
+
+			const ValueType& operator*() const
+			{
+				loadWindow();
+				return m_window->m_values.at(m_index - m_window->m_first);
+			}
+			const ValueType* operator->() const { return &operator*(); }
+			ValueType operator[](difference_type n) const { return *(*this + n); }
+
+			const_iterator& operator++() { ++m_index; return *this; }
+			const_iterator operator++(int) { const_iterator result(*this); ++m_index; return result; }
+			const_iterator& operator--() { --m_index; return *this; }
+			const_iterator operator--(int) { const_iterator result(*this); --m_index; return result; }
+			const_iterator& operator+=(difference_type n) { m_index += int(n); return *this; }
+			const_iterator& operator-=(difference_type n) { m_index -= int(n); return *this; }
+			const_iterator operator+(difference_type n) const { const_iterator result(*this); return result += n; }
+			const_iterator operator-(difference_type n) const { const_iterator result(*this); return result -= n; }
+			friend const_iterator operator+(difference_type n, const const_iterator& iter) { return iter + n; }
+			difference_type operator-(const const_iterator& other) const { return difference_type(m_index) - other.m_index; }
+
+			bool operator==(const const_iterator& other) const { return m_index == other.m_index && m_container == other.m_container; }
+			bool operator!=(const const_iterator& other) const { return !operator==(other); }
+			bool operator<(const const_iterator& other) const { return m_index < other.m_index; }
+			bool operator>(const const_iterator& other) const { return m_index > other.m_index; }
+			bool operator<=(const const_iterator& other) const { return m_index <= other.m_index; }
+			bool operator>=(const const_iterator& other) const { return m_index >= other.m_index; }
+
+		private:
+			friend class HugeContainer;
+
+			struct Window
+			{
+				int m_first;
+				QVector<ValueType> m_values;
+			};
+			struct ReadAhead
+			{
+				std::shared_ptr<Window> m_window;
+			};
+
+			const_iterator(const HugeContainer* container, int index)
+				: m_container(container)
+				, m_index(index)
+				, m_readAhead(std::make_shared<ReadAhead>())
+			{
+			}
+
+			bool windowHolds(const std::shared_ptr<Window>& window) const
+			{
+				return window && m_index >= window->m_first && m_index < window->m_first + window->m_values.size();
+			}
+
+			void loadWindow() const
+			{
+				Q_ASSERT(m_container && m_index >= 0 && m_index < m_container->size());
+				if (windowHolds(m_window))
+					return;
+				if (windowHolds(m_readAhead->m_window)) {
+					m_window = m_readAhead->m_window;
+					return;
+				}
+
+				/* read ahead in the direction the iterator is moving */
+				const int windowSize = readAheadCount();
+				const std::shared_ptr<Window>& previous = m_window ? m_window : m_readAhead->m_window;
+				int first = m_index;
+				if (previous && m_index < previous->m_first)
+					first = qMax(0, m_index - windowSize + 1);
+				const int count = qMin(windowSize, m_container->size() - first);
+
+				/* decode in place when no other iterator is on the current window */
+				const long owners = (m_readAhead->m_window == m_window) ? 2 : 1;
+				if (!m_window || m_window.use_count() > owners)
+					m_window = std::make_shared<Window>();
+				m_readAhead->m_window = m_window;
+				m_window->m_first = first;
+				m_window->m_values.resize(count);
+				if (!m_container->readRange(first, count, m_window->m_values.data())) {
+					Q_ASSERT_X(false, "HugeContainer::const_iterator", "Unable to read from the data file");
+				}
+			}
+
+			static int readAheadCount()
+			{
+				return FixedWidthTag::value ? qMax(1, int(ReadAheadBytes / sizeof(ValueType))) : int(ReadAheadElements);
+			}
+
+			const HugeContainer* m_container;
+			int m_index;
+			mutable std::shared_ptr<Window> m_window;
+			std::shared_ptr<ReadAhead> m_readAhead;
+		};
+
+		const_iterator begin() const
+		{
+			QReadLocker locker(storageLock());
+			m_d->m_device->adviseSequential();
+			return const_iterator(this, 0);
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(this, size());
+		}
+
+		const_iterator constBegin() const { return begin(); }
+		const_iterator constEnd() const { return end(); }
+		const_iterator cbegin() const { return begin(); }
+		const_iterator cend() const { return end(); }
+
 		/*if index is not correct then append to the vector*/
 		void insert(uint index, const ValueType &val) {
-
+			LatencyTimer timer(this, &ContainerCounters::m_insert);
 			if (!correctIndex(index))
 				index = size();
 		
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			auto tempval = std::make_unique<ValueType>(val);
-			m_d->m_itemsMap->insert(index, ContainerObject<ValueType>(tempval.release()));
-			saveQueue(index);
+			insertValue(index, tempval, FixedWidthTag());
 		}
 
 
@@ -323,27 +1416,51 @@ namespace HugeContainers {
 			if (!correctIndex(index))
 				return;
 
+			LatencyTimer timer(this, &ContainerCounters::m_insert);
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			std::unique_ptr<ValueType> tempval(val);
+			insertValue(index, tempval, FixedWidthTag());
+		}
+
 
-			m_d->m_itemsMap->insert(index, ContainerObject<ValueType>(tempval.release()));
-			saveQueue(index);
+		//! Decodes the element at index into out, false if index is out of range or unreadable
+		bool get(const uint& index, ValueType& out) const
+		{
+			QReadLocker locker(storageLock());
+			if (qint64(index) >= storedCount())
+				return false;
+			return readValue(index, out, FixedWidthTag());
+		}
+
+		//! Returns the element at index, or a default-constructed value when there is none
+		ValueType value(const uint& index) const
+		{
+			ValueType result = ValueType();
+			get(index, result);
+			return result;
 		}
 
+		ValueType value(const uint& index, const ValueType& defaultValue) const
+		{
+			ValueType result;
+			if (!get(index, result))
+				return defaultValue;
+			return result;
+		}
 
 		/* Must be put correct index for finding value */
-		const ValueType& at(const uint& index)
+		ValueType at(const uint& index) const
 		{
-			Q_ASSERT(!isEmpty());
+			LatencyTimer timer(this, &ContainerCounters::m_at);
+			QReadLocker locker(storageLock());
+			Q_ASSERT(qint64(index) < storedCount());
 
-			auto valueIter = m_d->m_itemsMap->begin() + index;
-			Q_ASSERT(valueIter != m_d->m_itemsMap->end());
-			
-			auto result = valueFromBlock(index);
-			Q_ASSERT(result);
-			
-			m_d.detach();
-			return *(result.release());
+			ValueType result;
+			const bool found = readValue(index, result, FixedWidthTag());
+			Q_ASSERT(found);
+			Q_UNUSED(found);
+			return result;
 		}
 
 		bool removeAt(const uint& index)
@@ -351,11 +1468,8 @@ namespace HugeContainers {
 			if (!correctIndex(index))
 				return false;
 			m_d.detach();
-			auto itemIter = m_d->m_itemsMap->begin() + index;
-			Q_ASSERT(itemIter != m_d->m_itemsMap->end());
-			removeFromMap(itemIter->fPos());
-			m_d->m_itemsMap->erase(itemIter);
-			return true;
+			QWriteLocker locker(storageLock());
+			return removeValue(index, FixedWidthTag());
 		}
 
 		void clear()
@@ -363,12 +1477,13 @@ namespace HugeContainers {
 			if (isEmpty())
 				return;
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			if (!m_d->m_device->resize(0)) {
 				Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to resize temporary file");
 			}
+			m_d->m_cache.clear();
 			m_d->m_itemsMap->clear();
 			m_d->m_memoryMap->clear();
-			m_d->m_memoryMap->insert(0, true);
 		}
 
 		int count() const
@@ -377,47 +1492,39 @@ namespace HugeContainers {
 		}
 		int size() const
 		{
-			return m_d->m_itemsMap->size();
+			QReadLocker locker(storageLock());
+			return storedCount();
 		}
 		bool isEmpty() const
 		{
-			return m_d->m_itemsMap->isEmpty();
+			QReadLocker locker(storageLock());
+			return elementCount(FixedWidthTag()) == 0;
 		}
 
-		bool correctIndex(const uint& index) {
-			return ((index >= 0) && (m_d->m_itemsMap->size() > index));
+		bool correctIndex(const uint& index) const {
+			return ((index >= 0) && (this->size() > index));
 		}
 
 		int memMapsize() const
 		{
+			QReadLocker locker(storageLock());
 			return m_d->m_memoryMap->size();
 		}
 
-		inline const ValueType& first() const
+		inline ValueType first() const
 		{
 			Q_ASSERT(!isEmpty());
 			return at(0);
 		}
 
-		inline ValueType& first()
-		{
-			Q_ASSERT(!isEmpty());
-			return const_cast<ValueType&>(at(0));
-		}
-
-		inline const ValueType& last() const
+		inline ValueType last() const
 		{
 			Q_ASSERT(!isEmpty());
 			return at(size() - 1);
 		}
-
-		inline ValueType& last()
-		{
-			Q_ASSERT(!isEmpty());
-			return const_cast<ValueType&>(at(size() - 1));
-		}
 	    
 	};
-
 }
-#endif // hugecontainer_h__
\ No newline at end of file
+
+#include "../Common/HugeContainerAlgorithms.h"
+#endif // hugecontainer_sharedata_h__
@@ -1,43 +1,704 @@
 #pragma once
-#ifndef hugecontainer_h__
-#define hugecontainer_h__
+#ifndef hugecontainer_tempfile_h__
+#define hugecontainer_tempfile_h__
 
 
-#include <QDataStream>
-#include <QDir>
-#include <QDirIterator>
-#include <qvector.h>
-#include <QSharedData>
-#include <QSharedDataPointer>
-#include <QExplicitlySharedDataPointer>
-#include <QTemporaryFile>
-#include <QDebug>
-#include <memory>
-#include <initializer_list>
+#include "../Common/HugeContainerCommon.h"
+#include <QtEndian>
 
 
 namespace HugeContainers {
-	template <class ValueType>
-	class HugeContainer;
-}
+	/*
+	   Byte stream packed into blocks of BlockBytes, each compressed with zlib
+	   (qCompress) once it is full and appended to a ContainerFile. Positions
+	   are those of the uncompressed stream and the block directory tells
+	   where every block landed in the file. The block being filled stays in
+	   RAM, and the last blocks read are kept decompressed for the reads
+	   around them. Bytes are only ever appended, removing any means writing
+	   a new stream.
+	*/
+	class PackedFile
+	{
+	public:
+		enum {
+			BlockBytes = 64 << 10,
+			CachedBlocks = 16	//!< decompressed blocks kept in RAM
+		};
+
+		explicit PackedFile(StorageMode mode = StorageMode::Buffered)
+			: m_file(std::make_unique<ContainerFile>(mode))
+			, m_size(0)
+		{
+			m_blocks.setBudget(CachedBlocks * ElementCache<QByteArray>::cost(BlockBytes));
+		}
+		PackedFile(const PackedFile& other)
+			: m_file(std::make_unique<ContainerFile>(other.m_file->mode()))
+			, m_directory(other.m_directory)
+			, m_tail(other.m_tail)
+			, m_size(other.m_size)
+		{
+			m_blocks.setBudget(other.m_blocks.budget());
+			m_file->setWriteBufferSize(other.m_file->writeBufferSize());
+			if (!m_file->copyFrom(*(other.m_file)))
+				Q_ASSERT_X(false, "PackedFile::PackedFile", "Unable to copy the packed file");
+		}
+		PackedFile& operator=(const PackedFile&) = delete;
 
-template <class ValueType>
-QDataStream& operator<<(QDataStream &out, const HugeContainers::HugeContainer<ValueType>& cont);
+		ContainerFile& file() const { return *m_file; }
 
-template <class ValueType>
-QDataStream& operator>>(QDataStream &in, HugeContainers::HugeContainer<ValueType>& cont);
+		//! Size of the stream before compression
+		qint64 size() const { return m_size; }
 
+		//! Bytes the stream takes once compressed, the block being filled counted as it is
+		qint64 packedSize() const { return m_file->size() + m_tail.size(); }
 
-namespace HugeContainers {
-	//! Removes any leftover data from previous crashes
-	inline void cleanUp() {
-		QDirIterator cleanIter{ QDir::tempPath(), QStringList(QStringLiteral("HugeContainerData*")), QDir::Files | QDir::Writable | QDir::CaseSensitive | QDir::NoDotAndDotDot };
-		while (cleanIter.hasNext()) {
-			cleanIter.next();
-			QFile::remove(cleanIter.filePath());
+		//! Appends at the end of the stream and returns where the bytes start, -1 on failure
+		qint64 append(const char* data, qint64 len)
+		{
+			const qint64 pos = m_size;
+			while (len > 0) {
+				const int step = int(qMin<qint64>(len, BlockBytes - m_tail.size()));
+				m_tail.append(data, step);
+				m_size += step;
+				data += step;
+				len -= step;
+				if (m_tail.size() == BlockBytes && !packTail())
+					return -1;
+			}
+			return pos;
+		}
+		qint64 append(const QByteArray& block)
+		{
+			return append(block.constData(), block.size());
+		}
+
+		bool read(qint64 pos, char* data, qint64 len) const
+		{
+			if (Q_UNLIKELY(pos < 0 || pos + len > m_size))
+				return false;
+			while (len > 0) {
+				QByteArray content;
+				if (!blockContent(pos / BlockBytes, content))
+					return false;
+				const int offset = int(pos % BlockBytes);
+				const qint64 step = qMin<qint64>(len, content.size() - offset);
+				if (step <= 0)
+					return false;
+				std::memcpy(data, content.constData() + offset, step);
+				data += step;
+				pos += step;
+				len -= step;
+			}
+			return true;
+		}
+
+		QByteArray read(qint64 pos, qint64 len) const
+		{
+			QByteArray result;
+			result.resize(int(len));
+			if (!read(pos, result.data(), len))
+				result.clear();
+			return result;
+		}
+
+		//! Writes the packed blocks to disk, the block being filled stays in RAM
+		bool flush()
+		{
+			return m_file->flush();
+		}
+
+		void clear()
+		{
+			if (!m_file->resize(0))
+				Q_ASSERT_X(false, "PackedFile::clear", "Unable to resize the packed file");
+			m_directory.clear();
+			m_tail.clear();
+			m_size = 0;
+			QMutexLocker locker(&m_blocksLock);
+			m_blocks.clear();
+		}
+
+	private:
+		bool packTail()
+		{
+			const qint64 pos = m_file->append(qCompress(m_tail));
+			if (pos < 0)
+				return false;
+			m_directory.append(pos);
+			m_tail.clear();
+			return true;
+		}
+
+		/* the block being filled is shared as it is, the others go through the cache */
+		bool blockContent(qint64 block, QByteArray& content) const
+		{
+			if (block == m_directory.size()) {
+				content = m_tail;
+				return true;
+			}
+			{
+				QMutexLocker locker(&m_blocksLock);
+				if (m_blocks.find(block, content))
+					return true;
+			}
+			const qint64 begin = m_directory.at(int(block));
+			const qint64 end = (block + 1 < m_directory.size()) ? m_directory.at(int(block) + 1) : m_file->size();
+			content = qUncompress(m_file->read(begin, end - begin));
+			if (content.size() != BlockBytes)
+				return false;
+			QMutexLocker locker(&m_blocksLock);
+			m_blocks.insert(block, content, ElementCache<QByteArray>::cost(BlockBytes));
+			return true;
+		}
+
+		std::unique_ptr<ContainerFile> m_file;
+		QVector<qint64> m_directory;	//!< where every full block starts in the file
+		QByteArray m_tail;	//!< block being filled, not compressed yet
+		qint64 m_size;
+		mutable ElementCache<QByteArray> m_blocks;
+		mutable QMutex m_blocksLock;	//!< concurrent readers share the decompressed blocks
+	};
+
+	/*
+	   Counts of a sequence of slots in a Fenwick tree: the sum of the counts
+	   before a slot, the slot holding a given unit and a change to one count
+	   all take O(log n), where running sums kept per slot cost O(n) a change.
+	*/
+	class CountTree
+	{
+	public:
+		CountTree()
+			: m_tree(1, 0)
+			, m_total(0)
+		{
+		}
+
+		int size() const { return m_tree.size() - 1; }
+
+		qint64 total() const { return m_total; }
+
+		//! Sum of the counts of the slots before slot
+		qint64 before(int slot) const
+		{
+			qint64 sum = 0;
+			for (int i = slot; i > 0; i -= i & -i)
+				sum += m_tree.at(i);
+			return sum;
+		}
+
+		//! Slot holding unit index, counting from 0, past empty slots
+		int locate(qint64 index) const
+		{
+			int slot = 0;
+			int step = 1;
+			while (step * 2 <= size())
+				step *= 2;
+			for (; step > 0; step /= 2) {
+				if (slot + step <= size() && m_tree.at(slot + step) <= index) {
+					slot += step;
+					index -= m_tree.at(slot);
+				}
+			}
+			return slot;
+		}
+
+		void add(int slot, qint64 delta)
+		{
+			m_total += delta;
+			for (int i = slot + 1; i <= size(); i += i & -i)
+				m_tree[i] += delta;
+		}
+
+		void append(qint64 count)
+		{
+			const int i = size() + 1;
+			m_tree.append(count + before(i - 1) - before(i - (i & -i)));
+			m_total += count;
+		}
+
+		//! Replaces the counts in O(n)
+		void assign(const QVector<qint64>& counts)
+		{
+			m_tree.resize(counts.size() + 1);
+			m_tree[0] = 0;
+			std::copy(counts.cbegin(), counts.cend(), m_tree.begin() + 1);
+			for (int i = 1; i <= size(); ++i) {
+				const int parent = i + (i & -i);
+				if (parent <= size())
+					m_tree[parent] += m_tree.at(i);
+			}
+			m_total = std::accumulate(counts.cbegin(), counts.cend(), qint64(0));
+		}
+
+		void clear()
+		{
+			m_tree = QVector<qint64>(1, 0);
+			m_total = 0;
+		}
+
+	private:
+		QVector<qint64> m_tree;	//!< m_tree[i] sums the counts of the slots from i - (i & -i) to i - 1
+		qint64 m_total;
+	};
+
+	/*
+	   Serialized elements grouped in chunks of up to ChunkElements elements
+	   or ChunkBytes bytes. A chunk is written in one piece: the number of its
+	   elements, where each of them ends, then their bytes. Only the directory
+	   of the chunks stays in RAM, one entry per chunk, so reading an element
+	   is a lookup in it plus one read of its chunk, and a scan reads whole
+	   chunks. The last chunk is filled in RAM. A chunk that changes is
+	   written again at the end of the file, its old bytes stay dead until
+	   compact().
+	*/
+	class ChunkedFile
+	{
+	public:
+		enum {
+			ChunkElements = 1024,
+			ChunkBytes = 256 << 10,
+			CachedChunks = 16	//!< decoded chunks kept in RAM
+		};
+
+		explicit ChunkedFile(StorageMode mode = StorageMode::Buffered)
+			: m_file(std::make_unique<ContainerFile>(mode))
+			, m_count(0)
+			, m_deadBytes(0)
+		{
+			m_chunks.setBudget(CachedChunks * ElementCache<Content>::cost(ChunkBytes));
+		}
+		ChunkedFile(const ChunkedFile& other)
+			: m_file(std::make_unique<ContainerFile>(other.m_file->mode()))
+			, m_directory(other.m_directory)
+			, m_counts(other.m_counts)
+			, m_tail(other.m_tail)
+			, m_count(other.m_count)
+			, m_deadBytes(other.m_deadBytes)
+		{
+			m_chunks.setBudget(other.m_chunks.budget());
+			m_file->setWriteBufferSize(other.m_file->writeBufferSize());
+			if (!m_file->copyFrom(*(other.m_file)))
+				Q_ASSERT_X(false, "ChunkedFile::ChunkedFile", "Unable to copy the chunk file");
+		}
+		ChunkedFile& operator=(const ChunkedFile&) = delete;
+
+		ContainerFile& file() const { return *m_file; }
+
+		//! Number of elements
+		qint64 size() const { return m_count; }
+
+		int chunkCount() const { return m_directory.size(); }
+
+		//! Bytes of the file, chunks written again since included
+		qint64 fileBytes() const { return m_file->size(); }
+
+		//! Bytes of the file left behind by chunks written again
+		qint64 deadBytes() const { return m_deadBytes; }
+
+		//! Copies the bytes of the element at index to element
+		bool get(qint64 index, QByteArray& element) const
+		{
+			if (Q_UNLIKELY(index < 0 || index >= m_count))
+				return false;
+			const int chunk = locate(index);
+			Content content;
+			if (!load(chunk, content))
+				return false;
+			const int local = int(index - m_counts.before(chunk));
+			element = content.m_bytes.mid(int(content.begin(local)), int(content.length(local)));
+			return true;
+		}
+
+		//! Calls visit(data, len) for the count elements starting at first, one chunk read at a time
+		template <class Visit>
+		bool read(qint64 first, qint64 count, Visit visit) const
+		{
+			if (count <= 0)
+				return true;
+			if (Q_UNLIKELY(first < 0 || first + count > m_count))
+				return false;
+			Content content;
+			int chunk = locate(first);
+			for (int local = int(first - m_counts.before(chunk)); count > 0; ++chunk, local = 0) {
+				if (!load(chunk, content))
+					return false;
+				for (; local < content.count() && count > 0; ++local, --count) {
+					if (!visit(content.m_bytes.constData() + content.begin(local), content.length(local)))
+						return false;
+				}
+			}
+			return true;
+		}
+
+		//! Appends the elements whose bytes end at ends in block, one after the other
+		bool append(const QByteArray& block, const QVector<qint64>& ends)
+		{
+			qint64 start = 0;
+			for (const qint64 end : ends) {
+				if (!appendElement(block.constData() + start, end - start))
+					return false;
+				start = end;
+			}
+			return true;
+		}
+
+		bool insert(qint64 index, const QByteArray& element)
+		{
+			if (Q_UNLIKELY(index < 0 || index > m_count))
+				return false;
+			if (index == m_count)
+				return appendElement(element.constData(), element.size());
+			const int chunk = locate(index);
+			Content content;
+			if (!load(chunk, content))
+				return false;
+			content.insert(int(index - m_counts.before(chunk)), element);
+			return store(chunk, content);
+		}
+
+		bool remove(qint64 index)
+		{
+			if (Q_UNLIKELY(index < 0 || index >= m_count))
+				return false;
+			const int chunk = locate(index);
+			Content content;
+			if (!load(chunk, content))
+				return false;
+			content.remove(int(index - m_counts.before(chunk)));
+			return store(chunk, content);
+		}
+
+		//! Writes the live chunks, full again, to a new file which takes over
+		bool compact()
+		{
+			ChunkedFile compacted(m_file->mode());
+			compacted.m_file->setWriteBufferSize(m_file->writeBufferSize());
+			const bool copied = read(0, m_count, [&compacted](const char* data, qint64 len) {
+				return compacted.appendElement(data, len);
+			});
+			if (!copied)
+				return false;
+			m_file.swap(compacted.m_file);
+			m_directory.swap(compacted.m_directory);
+			std::swap(m_counts, compacted.m_counts);
+			m_tail = compacted.m_tail;
+			m_deadBytes = 0;
+			QMutexLocker locker(&m_chunksLock);
+			m_chunks.clear();
+			return true;
+		}
+
+		//! Writes the staged chunks to disk, the chunk being filled stays in RAM
+		bool flush()
+		{
+			return m_file->flush();
+		}
+
+		void clear()
+		{
+			if (!m_file->resize(0))
+				Q_ASSERT_X(false, "ChunkedFile::clear", "Unable to resize the chunk file");
+			m_directory.clear();
+			m_counts.clear();
+			m_tail = Content();
+			m_count = 0;
+			m_deadBytes = 0;
+			QMutexLocker locker(&m_chunksLock);
+			m_chunks.clear();
+		}
+
+	private:
+		struct Chunk
+		{
+			Chunk()
+				: m_pos(-1), m_bytes(0), m_count(0)
+			{}
+			qint64 m_pos;	//!< -1 while the chunk is only in RAM
+			qint64 m_bytes;
+			int m_count;
+		};
+
+		struct Content
+		{
+			int count() const { return m_ends.size(); }
+			qint64 begin(int i) const { return i > 0 ? m_ends.at(i - 1) : 0; }
+			qint64 length(int i) const { return m_ends.at(i) - begin(i); }
+
+			void append(const char* data, qint64 len)
+			{
+				m_bytes.append(data, int(len));
+				m_ends.append(quint32(m_bytes.size()));
+			}
+
+			void insert(int i, const QByteArray& element)
+			{
+				const qint64 at = begin(i);
+				m_bytes.insert(int(at), element);
+				m_ends.insert(i, quint32(at));
+				for (int j = i; j < count(); ++j)
+					m_ends[j] += element.size();
+			}
+
+			void remove(int i)
+			{
+				const qint64 at = begin(i);
+				const qint64 len = length(i);
+				m_bytes.remove(int(at), int(len));
+				m_ends.remove(i);
+				for (int j = i; j < count(); ++j)
+					m_ends[j] -= quint32(len);
+			}
+
+			//! Moves the elements from i on to a new content
+			Content takeFrom(int i)
+			{
+				Content upper;
+				const qint64 at = begin(i);
+				upper.m_bytes = m_bytes.mid(int(at));
+				for (int j = i; j < count(); ++j)
+					upper.m_ends.append(quint32(m_ends.at(j) - at));
+				m_bytes.truncate(int(at));
+				m_ends.resize(i);
+				return upper;
+			}
+
+			QByteArray encode() const
+			{
+				const quint32 elements = quint32(count());
+				QByteArray raw;
+				raw.reserve(int(sizeof(quint32) * (elements + 1)) + m_bytes.size());
+				raw.append(reinterpret_cast<const char*>(&elements), sizeof(quint32));
+				raw.append(reinterpret_cast<const char*>(m_ends.constData()), int(sizeof(quint32) * elements));
+				raw.append(m_bytes);
+				return raw;
+			}
+
+			bool decode(const QByteArray& raw)
+			{
+				quint32 elements = 0;
+				if (raw.size() < int(sizeof(quint32)))
+					return false;
+				std::memcpy(&elements, raw.constData(), sizeof(quint32));
+				const qint64 headerBytes = qint64(sizeof(quint32)) * (elements + 1);
+				if (raw.size() < headerBytes)
+					return false;
+				m_ends.resize(int(elements));
+				std::memcpy(m_ends.data(), raw.constData() + sizeof(quint32), sizeof(quint32) * elements);
+				m_bytes = raw.mid(int(headerBytes));
+				return elements > 0 && m_ends.last() == quint32(m_bytes.size());
+			}
+
+			QByteArray m_bytes;
+			QVector<quint32> m_ends;	//!< where every element ends in m_bytes
+		};
+
+		int locate(qint64 index) const
+		{
+			return m_counts.locate(index);
+		}
+
+		/* the chunk being filled is shared as it is, the others go through the cache */
+		bool load(int chunk, Content& content) const
+		{
+			const Chunk& entry = m_directory.at(chunk);
+			if (entry.m_pos < 0) {
+				content = m_tail;
+				return true;
+			}
+			{
+				QMutexLocker locker(&m_chunksLock);
+				if (m_chunks.find(entry.m_pos, content))
+					return true;
+			}
+			if (!content.decode(m_file->read(entry.m_pos, entry.m_bytes)) || content.count() != entry.m_count)
+				return false;
+			QMutexLocker locker(&m_chunksLock);
+			m_chunks.insert(entry.m_pos, content, ElementCache<Content>::cost(entry.m_bytes));
+			return true;
+		}
+
+		bool appendElement(const char* data, qint64 len)
+		{
+			if (m_directory.isEmpty() || m_directory.last().m_pos >= 0) {
+				m_directory.append(Chunk());
+				m_counts.append(0);
+			}
+			m_tail.append(data, len);
+			++m_directory.last().m_count;
+			m_counts.add(m_directory.size() - 1, 1);
+			++m_count;
+			return !tailFull() || writeChunk(m_directory.size() - 1, takeTail());
+		}
+
+		/*
+		  puts back a chunk that changed: dropped once empty, split in two once
+		  too big. Only these two rebuild the counts, an edit within the chunk
+		  updates them in O(log chunks).
+		*/
+		bool store(int chunk, Content& content)
+		{
+			const bool isTail = m_directory.at(chunk).m_pos < 0;
+			const int oldCount = m_directory.at(chunk).m_count;
+			if (content.count() == 0) {
+				if (isTail)
+					m_tail = Content();
+				else
+					m_deadBytes += m_directory.at(chunk).m_bytes;
+				m_directory.remove(chunk);
+				rebuildCounts();
+				return true;
+			}
+			bool stored = true;
+			if (content.count() > ChunkElements || (content.m_bytes.size() > ChunkBytes && content.count() > 1)) {
+				Content upper = content.takeFrom(content.count() / 2);
+				m_directory.insert(chunk + 1, Chunk());
+				stored = writeChunk(chunk, content);
+				if (isTail) {
+					m_tail = upper;
+					m_directory[chunk + 1].m_count = upper.count();
+				}
+				else {
+					stored = stored && writeChunk(chunk + 1, upper);
+				}
+				rebuildCounts();
+				return stored;
+			}
+			else if (isTail) {
+				m_tail = content;
+				m_directory[chunk].m_count = content.count();
+				if (tailFull())
+					stored = writeChunk(chunk, takeTail());
+			}
+			else {
+				stored = writeChunk(chunk, content);
+			}
+			m_counts.add(chunk, m_directory.at(chunk).m_count - oldCount);
+			m_count = m_counts.total();
+			return stored;
+		}
+
+		bool writeChunk(int chunk, const Content& content)
+		{
+			const QByteArray raw = content.encode();
+			const qint64 pos = m_file->append(raw);
+			if (pos < 0)
+				return false;
+			Chunk& entry = m_directory[chunk];
+			if (entry.m_pos >= 0)
+				m_deadBytes += entry.m_bytes;
+			entry.m_pos = pos;
+			entry.m_bytes = raw.size();
+			entry.m_count = content.count();
+			return true;
+		}
+
+		bool tailFull() const
+		{
+			return m_tail.count() >= ChunkElements || m_tail.m_bytes.size() >= ChunkBytes;
+		}
+
+		Content takeTail()
+		{
+			Content tail;
+			std::swap(tail, m_tail);
+			return tail;
+		}
+
+		void rebuildCounts()
+		{
+			QVector<qint64> counts;
+			counts.reserve(m_directory.size());
+			for (const Chunk& entry : m_directory)
+				counts.append(entry.m_count);
+			m_counts.assign(counts);
+			m_count = m_counts.total();
+		}
+
+		std::unique_ptr<ContainerFile> m_file;
+		QVector<Chunk> m_directory;
+		CountTree m_counts;	//!< elements of every chunk, for the chunk holding an index
+		Content m_tail;	//!< last chunk while it is filled, not written yet
+		qint64 m_count;
+		qint64 m_deadBytes;
+		mutable ElementCache<Content> m_chunks;	//!< decoded chunks, by position in the file
+		mutable QMutex m_chunksLock;	//!< concurrent readers share the decoded chunks
+	};
+
+	/*
+	   Keeps pages of records in a ContainerFile, released pages are handed
+	   out again. A copy shares the file, a page changed afterwards only costs
+	   a copy of the segment holding it, see ContainerFile.
+	*/
+	template <class Record>
+	class FilePageStore
+	{
+		static_assert(std::is_trivially_copyable<Record>::value, "records are copied to the file byte by byte");
+	public:
+		enum { PageRecords = 1024 };
+
+		explicit FilePageStore(StorageMode mode = StorageMode::Buffered)
+			: m_file(std::make_unique<ContainerFile>(mode))
+		{
+		}
+		//! Takes over the pages already in file, page i starts at i times the size of a page
+		explicit FilePageStore(std::unique_ptr<ContainerFile> file)
+			: m_file(std::move(file))
+		{
+			Q_ASSERT(m_file->size() % pageBytes() == 0);
+		}
+		FilePageStore(const FilePageStore& other)
+			: m_file(std::make_unique<ContainerFile>(other.m_file->mode()))
+			, m_freePages(other.m_freePages)
+		{
+			m_file->setWriteBufferSize(other.m_file->writeBufferSize());
+			if (!m_file->copyFrom(*(other.m_file)))
+				Q_ASSERT_X(false, "FilePageStore::FilePageStore", "Unable to copy the page file");
+		}
+		FilePageStore(FilePageStore&& other) = default;
+		FilePageStore& operator=(FilePageStore&& other) = default;
+
+		ContainerFile& file() const { return *m_file; }
+
+		qint64 allocatePage()
+		{
+			if (!m_freePages.isEmpty())
+				return m_freePages.takeLast();
+			/* appending a blank page keeps it in the write buffer, where the records written next land too */
+			if (m_blankPage.isEmpty())
+				m_blankPage = QByteArray(int(pageBytes()), '\0');
+			const qint64 pos = m_file->append(m_blankPage);
+			return pos < 0 ? -1 : pos / pageBytes();
 		}
 
-	}
+		void releasePage(qint64 page)
+		{
+			m_freePages.append(page);
+		}
+
+		bool read(qint64 page, int first, int count, Record* out) const
+		{
+			return m_file->read(page * pageBytes() + qint64(first) * sizeof(Record), reinterpret_cast<char*>(out), qint64(count) * sizeof(Record));
+		}
+
+		bool write(qint64 page, int first, int count, const Record* in)
+		{
+			return m_file->write(page * pageBytes() + qint64(first) * sizeof(Record), reinterpret_cast<const char*>(in), qint64(count) * sizeof(Record));
+		}
+
+		void clear()
+		{
+			m_freePages.clear();
+			if (!m_file->resize(0))
+				Q_ASSERT_X(false, "FilePageStore::clear", "Unable to resize the page file");
+		}
+
+	private:
+		static qint64 pageBytes() { return qint64(PageRecords) * sizeof(Record); }
+
+		std::unique_ptr<ContainerFile> m_file;
+		QVector<qint64> m_freePages;
+		QByteArray m_blankPage;
+	};
 
 	template <class ValueType>
 	class HugeContainer
@@ -45,10 +706,30 @@ namespace HugeContainers {
 		static_assert(std::is_default_constructible<ValueType>::value, "ValueType must provide a default constructor");
 		static_assert(std::is_copy_constructible<ValueType>::value, "ValueType must provide a copy constructor");
 	private:
+		typedef std::integral_constant<bool, UseFixedWidthStorage<ValueType>::value> FixedWidthTag;
+
+		enum {
+			RangeChunk = 1 << 16,	//!< elements decoded per read by readRange()
+			ReadAheadBytes = 4 << 20,	//!< window of fixed-width elements decoded at once by const_iterator
+			ReadAheadElements = 1 << 14,	//!< window of serialized elements decoded at once by const_iterator
+			MaxReadGap = 1 << 12,	//!< dead bytes readRange() reads through rather than issuing another read
+			MinCompactBytes = 1 << 20,	//!< dead bytes below which compactionDue() does not ask for a rewrite
+			MultiGetRunsPerThread = 16	//!< merged reads multiGet() gives each of its threads, at least
+		};
+
+		//! Where the serialized elements live
+		enum class DataLayout {
+			Frames,		//!< data file plus one frame per element in the map
+			Packed,		//!< same with the data file compressed, see setCompression()
+			Chunked		//!< chunks of elements, see setChunkedLayout()
+		};
 		
 		typedef struct Frame
 		{
-			explicit Frame::Frame(qint64 fp, qint64 fs)
+			Frame()
+				: m_fPos(-1), m_fSize(-1)
+			{};
+			explicit Frame(qint64 fp, qint64 fs)
 				: m_fPos(fp), m_fSize(fs)
 			{};
 			qint64 m_fPos;
@@ -56,7 +737,7 @@ namespace HugeContainers {
 		} Frame;
 
 
-		template <class ValueType>
+		template <class ElementType>
 		struct ContainerObjectData : public QSharedData
 		{
 			bool m_isAvailable;
@@ -65,19 +746,19 @@ namespace HugeContainers {
 				explicit ObjectData(qint64 fp, qint64 fs)
 					:m_frame(fp,fs)
 				{}
-				explicit ObjectData(ValueType* v)
+				explicit ObjectData(ElementType* v)
 					:m_val(v)
 				{}
 
 				Frame m_frame;
-				ValueType* m_val;
+				ElementType* m_val;
 			} m_data;
 			explicit ContainerObjectData(qint64 fp, qint64 fs)
 				:QSharedData()
 				, m_isAvailable(false)
 				, m_data(fp,fs)
 			{}
-			explicit ContainerObjectData(ValueType* v)
+			explicit ContainerObjectData(ElementType* v)
 				:QSharedData()
 				, m_isAvailable(true)
 				, m_data(v)
@@ -95,20 +776,20 @@ namespace HugeContainers {
 				, m_data(other.m_data.m_frame.m_fPos, other.m_data.m_frame.m_fSize)
 			{
 				if (m_isAvailable)
-					m_data.m_val = new ValueType(*(other.m_data.m_val));
+					m_data.m_val = new ElementType(*(other.m_data.m_val));
 			}
 		};
 
-		template <class ValueType>
+		template <class ElementType>
 		class ContainerObject
 		{
-			QExplicitlySharedDataPointer<ContainerObjectData<ValueType> > m_d;
+			QExplicitlySharedDataPointer<ContainerObjectData<ElementType> > m_d;
 		public:
 			explicit ContainerObject(qint64 fPos, qint64 fSize)
-				:m_d(new ContainerObjectData<ValueType>(fPos, fSize))
+				:m_d(new ContainerObjectData<ElementType>(fPos, fSize))
 			{}
-			explicit ContainerObject(ValueType* val)
-				:m_d(new ContainerObjectData<ValueType>(val))
+			explicit ContainerObject(ElementType* val)
+				:m_d(new ContainerObjectData<ElementType>(val))
 			{}
 
 			ContainerObject(const ContainerObject& other) = default;
@@ -117,8 +798,8 @@ namespace HugeContainers {
 			qint64 fPos() const { return m_d->m_data.m_frame.m_fPos; }
 			qint64 fSize() const { return m_d->m_data.m_frame.m_fSize; }
 
-			const ValueType* val() const { Q_ASSERT(m_d->m_isAvailable); return m_d->m_data.m_val; }
-			ValueType* val() { Q_ASSERT(m_d->m_isAvailable); m_d.detach(); return m_d->m_data.m_val; }
+			const ElementType* val() const { Q_ASSERT(m_d->m_isAvailable); return m_d->m_data.m_val; }
+			ElementType* val() { Q_ASSERT(m_d->m_isAvailable); m_d.detach(); return m_d->m_data.m_val; }
 			
 
 			void setFPos(const Frame& m_frame) {
@@ -136,7 +817,7 @@ namespace HugeContainers {
 				m_d->m_data.m_frame.m_fSize = fs;
 				m_d->m_isAvailable = false;
 			}
-			void setVal(ValueType* vl)
+			void setVal(ElementType* vl)
 			{
 				m_d.detach();
 				if (m_d->m_isAvailable)
@@ -147,68 +828,217 @@ namespace HugeContainers {
 		};
 
 
-		template <class ValueType>
+		/*
+		  the storage lock is held for reading by every read and for writing by
+		  every change. Readers still share the element cache, which gets a
+		  mutex of its own.
+		*/
+		struct AccessLocks
+		{
+			QReadWriteLock m_storage;
+			QMutex m_cache;
+		};
+
+		/* what stats() reports besides the sizes, only while setStatsEnabled(true) */
+		struct ContainerCounters
+		{
+			ContainerCounters()
+				: m_cacheHits(0), m_cacheMisses(0), m_detachCopies(0)
+			{}
+			FileCounters m_data;	//!< the data file, packed or chunked as it may be
+			FileCounters m_index;	//!< the pages of the map
+			std::atomic<qint64> m_cacheHits;
+			std::atomic<qint64> m_cacheMisses;
+			std::atomic<qint64> m_detachCopies;
+			LatencyRecorder m_at;
+			LatencyRecorder m_pushBack;
+			LatencyRecorder m_insert;
+		};
+
+		template <class ElementType>
 		class HugeContainerData : public QSharedData
 		{
 		public:
-			using ItemMapType = QVector<ContainerObject<ValueType>>;
-			std::unique_ptr<QTemporaryFile> m_memoryMap;
-			std::unique_ptr<QTemporaryFile> m_device;
-
-			HugeContainerData()
+			using ItemMapType = QVector<ContainerObject<ElementType>>;
+			using FrameIndex = PagedSequence<Frame, FilePageStore<Frame> >;
+			std::unique_ptr<FrameIndex> m_memoryMap;
+			std::unique_ptr<ContainerFile> m_device;
+			std::unique_ptr<PackedFile> m_packed;	//!< holds the data instead of m_device while compression is on
+			std::unique_ptr<ChunkedFile> m_chunked;	//!< holds the elements instead of m_device and the map in the chunked layout
+			ElementCache<ElementType> m_cache;
+			/* decode buffer reused by every read, once grown reading an element allocates nothing */
+			QByteArray m_readBlock;
+			QBuffer m_readDevice;
+			QDataStream m_readStream;
+			std::unique_ptr<AccessLocks> m_locks;	//!< only while setConcurrentAccess(true)
+			qint64 m_liveBytes;	//!< bytes of the data file still referenced by the map
+			double m_compactThreshold;
+			QVector<ElementType> m_hot;	//!< newest elements, in RAM after the ones in the files
+			qint64 m_hotBytes;	//!< footprint of m_hot
+			qint64 m_memoryBudget;	//!< 0 sends every element to the files
+			std::unique_ptr<ContainerCounters> m_counters;	//!< only while setStatsEnabled(true)
+
+			explicit HugeContainerData(StorageMode mode = StorageMode::Buffered)
 				: QSharedData()
-				, m_device(std::make_unique<QTemporaryFile>(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX")))
-				, m_memoryMap(std::make_unique<QTemporaryFile>(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX")))
+				, m_memoryMap(std::make_unique<FrameIndex>(FilePageStore<Frame>(mode)))
+				, m_device(std::make_unique<ContainerFile>(mode))
+				, m_readDevice(&m_readBlock)
+				, m_readStream(&m_readDevice)
+				, m_liveBytes(0)
+				, m_compactThreshold(0.5)
+				, m_hotBytes(0)
+				, m_memoryBudget(0)
 			{
-				if (!m_device->open())
-					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to create a data file");
-				m_device->seek(0);
-				if (!m_memoryMap->open())
-					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to create a memoryMap file");
-				m_memoryMap->seek(0);
+				m_readDevice.open(QIODevice::ReadOnly);
 			}
 			~HugeContainerData() = default;
-			
+
+			/*
+			  detaching. The data files and the pages of the map are shared with
+			  other segment by segment, see ContainerFile::copyFrom(): the copy
+			  costs no I/O, either side then copies the segments it writes to.
+			*/
 			HugeContainerData(HugeContainerData& other)
 				: QSharedData(other)
-				, m_device(std::make_unique<QTemporaryFile>(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX")))
-				, m_memoryMap(std::make_unique<QTemporaryFile>(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX")))
+				, m_memoryMap(std::make_unique<FrameIndex>(*(other.m_memoryMap)))
+				, m_device(std::make_unique<ContainerFile>(other.m_device->mode()))
+				, m_packed(other.m_packed ? std::make_unique<PackedFile>(*(other.m_packed)) : nullptr)
+				, m_chunked(other.m_chunked ? std::make_unique<ChunkedFile>(*(other.m_chunked)) : nullptr)
+				, m_readDevice(&m_readBlock)
+				, m_readStream(&m_readDevice)
+				, m_liveBytes(other.m_liveBytes)
+				, m_compactThreshold(other.m_compactThreshold)
+				, m_hot(other.m_hot)
+				, m_hotBytes(other.m_hotBytes)
+				, m_memoryBudget(other.m_memoryBudget)
 			{
-				if (!m_device->open())
-					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to create a data file");
-				other.m_device->seek(0);
-				qint64 totalSize = other.m_device->size();
-				for (; totalSize > 1024; totalSize -= 1024)
-					m_device->write(other.m_device->read(1024));
-				m_device->write(other.m_device->read(totalSize));
-
-				if (!m_memoryMap->open())
-					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to create a memoryMap file");
-				other.m_memoryMap->seek(0);
-				totalSize = other.m_memoryMap->size();
-				for (; totalSize > 1024; totalSize -= 1024)
-					m_memoryMap->write(other.m_memoryMap->read(1024));
-				m_memoryMap->write(other.m_memoryMap->read(totalSize));
+				m_readDevice.open(QIODevice::ReadOnly);
+				m_device->setWriteBufferSize(other.m_device->writeBufferSize());
+				if (!m_device->copyFrom(*(other.m_device)))
+					Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to copy the data file");
+				m_cache.setBudget(other.m_cache.budget());
+				if (other.m_locks)
+					m_locks = std::make_unique<AccessLocks>();
+				/* the copy counts from here, starting with itself */
+				if (other.m_counters) {
+					m_counters = std::make_unique<ContainerCounters>();
+					m_counters->m_detachCopies = 1;
+					attachCounters();
+				}
+			}
 
+			//! Points the files at the counters, or at nothing once they are gone
+			void attachCounters()
+			{
+				FileCounters* data = m_counters ? &m_counters->m_data : nullptr;
+				m_device->setCounters(data);
+				if (m_packed)
+					m_packed->file().setCounters(data);
+				if (m_chunked)
+					m_chunked->file().setCounters(data);
+				m_memoryMap->store().file().setCounters(m_counters ? &m_counters->m_index : nullptr);
 			}
 
 		};
 
 		QExplicitlySharedDataPointer<HugeContainerData<ValueType>> m_d;
 
+		/* both are null outside of concurrent access, the lockers then do nothing */
+		QReadWriteLock* storageLock() const
+		{
+			return m_d->m_locks ? &m_d->m_locks->m_storage : nullptr;
+		}
+
+		QMutex* cacheLock() const
+		{
+			return m_d->m_locks ? &m_d->m_locks->m_cache : nullptr;
+		}
+
+		//! Null while statistics are off or compiled out, nothing is counted then
+		ContainerCounters* counters() const
+		{
+#ifndef HUGECONTAINER_NO_STATS
+			return m_d->m_counters.get();
+#else
+			return nullptr;
+#endif
+		}
+
+		/*
+		  times a public call from its construction to its destruction. The
+		  counters are looked up at the end, the call may have detached.
+		*/
+		class LatencyTimer
+		{
+		public:
+			LatencyTimer(const HugeContainer* container, LatencyRecorder ContainerCounters::* recorder)
+				: m_container(container)
+				, m_recorder(recorder)
+				, m_timed(container->counters() != nullptr)
+			{
+				if (m_timed)
+					m_start = std::chrono::steady_clock::now();
+			}
+			~LatencyTimer()
+			{
+				if (!m_timed)
+					return;
+				if (ContainerCounters* counters = m_container->counters())
+					(counters->*m_recorder).record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+			}
+			LatencyTimer(const LatencyTimer&) = delete;
+			LatencyTimer& operator=(const LatencyTimer&) = delete;
+		private:
+			const HugeContainer* m_container;
+			LatencyRecorder ContainerCounters::* m_recorder;
+			bool m_timed;
+			std::chrono::steady_clock::time_point m_start;
+		};
+
+		/* QReadWriteLock is not recursive, so code running under the lock counts through this */
+		int storedCount() const
+		{
+			return int(spilledCount() + m_d->m_hot.size());
+		}
+
+		//! Elements in the files, the ones in RAM come after them
+		qint64 spilledCount() const
+		{
+			return elementCount(FixedWidthTag());
+		}
+
+		bool cacheFind(qint64 key, ValueType& out) const
+		{
+			if (!m_d->m_cache.isEnabled())
+				return false;
+			QMutexLocker locker(cacheLock());
+			const bool found = m_d->m_cache.find(key, out);
+			if (ContainerCounters* counters = this->counters())
+				(found ? counters->m_cacheHits : counters->m_cacheMisses).fetch_add(1, std::memory_order_relaxed);
+			return found;
+		}
+
+		void cacheInsert(qint64 key, const ValueType& val, qint64 cost) const
+		{
+			if (!m_d->m_cache.isEnabled())
+				return;
+			QMutexLocker locker(cacheLock());
+			m_d->m_cache.insert(key, val, cost);
+		}
+
+		//! Pages of the map, in a file the copies of the storage share
+		ContainerFile& mapFile() const
+		{
+			return m_d->m_memoryMap->store().file();
+		}
 
 		qint64 writeInData(const QByteArray& block) const
 		{
 			if (!m_d->m_device->isWritable())
 				return -1;
-
-			auto pos = m_d->m_device->pos();
-			m_d->m_device->seek(pos);
-			if (m_d->m_device->write(block) >= 0) {
-				return pos;
-			}
-			return -1;
-			
+			if (m_d->m_packed)
+				return m_d->m_packed->append(block);
+			return m_d->m_device->append(block);
 		}
 
 		
@@ -240,221 +1070,1457 @@ namespace HugeContainers {
 			return result;
 		}
 
-		bool writeInMap(const QByteArray& block) const
+		/* appends the frame to the map, or inserts it at index when one is given */
+		bool writeElementInMap(const Frame& val, const int index = -1) const
+		{
+			if (!mapFile().isWritable())
+				return false;
+			if (index < 0)
+				return m_d->m_memoryMap->append(&val, 1);
+			return m_d->m_memoryMap->insert(index, val);
+		}
+
+
+		bool saveQueue(std::unique_ptr<ContainerObject<ValueType>>& valToWrite, const int &index) const {
+			return saveQueue(*(valToWrite->val()), index, FixedWidthTag());
+		}
+
+		bool saveQueue(const ValueType& val, const int &index, std::true_type) const {
+			if (!m_d->m_device->isWritable())
+				return false;
+
+			const char* raw = reinterpret_cast<const char*>(&val);
+			if (index < 0)
+				return m_d->m_device->append(raw, sizeof(ValueType)) >= 0;
+
+			/* make room by shifting the following records, there is no index to rewrite */
+			const qint64 pos = qint64(index) * sizeof(ValueType);
+			m_d->m_cache.removeFrom(pos);
+			if (!m_d->m_device->move(pos, pos + sizeof(ValueType), m_d->m_device->size() - pos))
+				return false;
+			return m_d->m_device->write(pos, raw, sizeof(ValueType));
+		}
+
+		bool saveQueue(const ValueType& val, const int &index, std::false_type) const {
+			bool allOk = false;
+			if (m_d->m_chunked) {
+				QByteArray block;
+				{
+					QDataStream writerStream(&block, QIODevice::WriteOnly);
+					writerStream << val;
+				}
+				return m_d->m_chunked->insert(index < 0 ? m_d->m_chunked->size() : index, block);
+			}
+			
+			/*Write the value in DataFile*/
+			const Frame result = writeElementInData(val);
+			if (result.m_fPos >= 0) {
+				m_d->m_liveBytes += result.m_fSize;
+				/*
+				    Whenever push_back funcation is called at that time 
+				    elements is append in file. 
+				*/
+				if (index < 0) {
+				   allOk = writeElementInMap(result); 
+				}
+				else {
+				 /* 
+				    Whenever insert funcation is called at that time 
+				    the frame is inserted in its page of the map
+				 */
+					allOk = writeElementInMap(result, index);
+				}
+			}
+
+			return allOk;
+		}
+
+		bool enqueueValue(std::unique_ptr<ValueType>& val,const int index = -1) const
+		{
+			auto tempVal = std::make_unique<ContainerObject<ValueType>>(val.release());
+			if (saveQueue(tempVal, index)) {
+				return true;
+			}
+		    return false;
+		}
+
+		/* goes to RAM when index falls among the elements kept there, to the files otherwise */
+		bool insertElement(const uint& index, std::unique_ptr<ValueType>& val) const
+		{
+			const qint64 spilled = spilledCount();
+			if (m_d->m_memoryBudget > 0 && qint64(index) >= spilled) {
+				m_d->m_hotBytes += ElementFootprint<ValueType>::bytes(*val);
+				m_d->m_hot.insert(int(index - spilled), *val);
+				val.reset();
+				return enforceMemoryBudget();
+			}
+			return enqueueValue(val, qint64(index) == spilled ? -1 : int(index));
+		}
+
+		bool readElement(const uint& index, ValueType& out) const
+		{
+			const qint64 spilled = spilledCount();
+			if (qint64(index) >= spilled) {
+				out = m_d->m_hot.at(int(index - spilled));
+				return true;
+			}
+			return readValue(index, out, FixedWidthTag());
+		}
+
+		bool eraseElement(const uint& index) const
+		{
+			const qint64 spilled = spilledCount();
+			if (qint64(index) < spilled)
+				return removeElement(index, FixedWidthTag());
+			if (qint64(index) >= storedCount())
+				return false;
+			const int local = int(index - spilled);
+			m_d->m_hotBytes -= ElementFootprint<ValueType>::bytes(m_d->m_hot.at(local));
+			m_d->m_hot.remove(local);
+			return true;
+		}
+
+		/*
+		  past the budget the oldest elements in RAM move to the files, down to
+		  half the budget so the next ones are spilled in a batch as well
+		*/
+		bool enforceMemoryBudget() const
+		{
+			if (m_d->m_hotBytes <= m_d->m_memoryBudget)
+				return true;
+			return spillElements(m_d->m_memoryBudget / 2);
+		}
+
+		//! Appends the oldest elements in RAM to the files until the rest takes at most keepBytes
+		bool spillElements(qint64 keepBytes) const
+		{
+			int count = 0;
+			qint64 bytes = m_d->m_hotBytes;
+			for (; count < m_d->m_hot.size() && bytes > keepBytes; ++count)
+				bytes -= ElementFootprint<ValueType>::bytes(m_d->m_hot.at(count));
+			if (count == 0)
+				return true;
+			if (!appendRange(m_d->m_hot.constData(), m_d->m_hot.constData() + count, FixedWidthTag()))
+				return false;
+			m_d->m_hot.remove(0, count);
+			m_d->m_hotBytes = bytes;
+			return true;
+		}
+
+		/* decodes the len bytes at pos into out through the reusable read buffer */
+		bool decodeBlock(qint64 pos, qint64 len, ValueType& out) const
+		{
+			if (Q_UNLIKELY(!m_d->m_device->isReadable() || len <= 0))
+				return false;
+			if (m_d->m_locks) {
+				/* concurrent readers cannot share the buffer, each one decodes from its own */
+				QByteArray block;
+				if (const char* mapped = mappedData(pos, len))
+					block = QByteArray::fromRawData(mapped, int(len));
+				else
+					block = readData(Frame(pos, len));
+				if (block.size() != len)
+					return false;
+				QDataStream readerStream(block);
+				readerStream >> out;
+				return readerStream.status() == QDataStream::Ok;
+			}
+			m_d->m_readBlock.resize(int(len));
+			if (!readData(pos, m_d->m_readBlock.data(), len))
+				return false;
+			m_d->m_readDevice.seek(0);
+			m_d->m_readStream.resetStatus();
+			m_d->m_readStream >> out;
+			return m_d->m_readStream.status() == QDataStream::Ok;
+		}
+
+		bool readValue(const uint& index, ValueType& out, std::true_type) const
+		{
+			if (Q_UNLIKELY(!m_d->m_device->isReadable()))
+				return false;
+			const qint64 pos = qint64(index) * sizeof(ValueType);
+			if (cacheFind(pos, out))
+				return true;
+			if (!m_d->m_device->read(pos, reinterpret_cast<char*>(&out), sizeof(ValueType)))
+				return false;
+			cacheInsert(pos, out, ElementCache<ValueType>::cost(0));
+			return true;
+		}
+
+		bool readValue(const uint& index, ValueType& out, std::false_type) const
+		{
+			/* chunks are cached whole, the elements are not cached on their own */
+			if (m_d->m_chunked) {
+				QByteArray block;
+				return m_d->m_chunked->get(index, block) && decodeRecord(block.constData(), block.size(), out, FixedWidthTag());
+			}
+
+			/*read address of data*/
+			Frame frame(-1, -1);
+			if (!readMap(index, frame))
+				return false;
+
+			if (cacheFind(frame.m_fPos, out))
+				return true;
+			if (!decodeBlock(frame.m_fPos, frame.m_fSize, out))
+				return false;
+			cacheInsert(frame.m_fPos, out, ElementCache<ValueType>::cost(frame.m_fSize));
+			return true;
+		}
+
+
+		QByteArray readData(const Frame& dataFrame) const
+		{
+			if (Q_UNLIKELY(!m_d->m_device->isReadable()))
+				return QByteArray();
+			if (m_d->m_packed)
+				return m_d->m_packed->read(dataFrame.m_fPos, dataFrame.m_fSize);
+			return m_d->m_device->read(dataFrame.m_fPos, dataFrame.m_fSize);
+		}
+
+		bool readData(qint64 pos, char* data, qint64 len) const
+		{
+			if (m_d->m_packed)
+				return m_d->m_packed->read(pos, data, len);
+			return m_d->m_device->read(pos, data, len);
+		}
+
+		//! Direct pointer to the len bytes at pos, nullptr unless the data file is mapped
+		const char* mappedData(qint64 pos, qint64 len) const
+		{
+			return m_d->m_packed ? nullptr : m_d->m_device->mappedData(pos, len);
+		}
+
+		//! Bytes of the data, live or dead, before any compression
+		qint64 dataBytes() const
+		{
+			if (m_d->m_chunked)
+				return m_d->m_chunked->fileBytes();
+			return m_d->m_packed ? m_d->m_packed->size() : m_d->m_device->size();
+		}
+
+		DataLayout dataLayout() const
+		{
+			if (m_d->m_chunked)
+				return DataLayout::Chunked;
+			return m_d->m_packed ? DataLayout::Packed : DataLayout::Frames;
+		}
+
+
+		bool removeElement(const uint& index, std::true_type) const {
+			const qint64 pos = qint64(index) * sizeof(ValueType);
+			m_d->m_cache.removeFrom(pos);
+			const qint64 tailSize = m_d->m_device->size() - pos - qint64(sizeof(ValueType));
+			if (tailSize < 0)
+				return false;
+			if (!m_d->m_device->move(pos + sizeof(ValueType), pos, tailSize))
+				return false;
+			return m_d->m_device->resize(pos + tailSize);
+		}
+
+		bool removeElement(const uint& index, std::false_type) const {
+			if (m_d->m_chunked) {
+				return m_d->m_chunked->remove(index);
+			}
+			Frame frame(-1, -1);
+			if (!readMap(index, frame))
+				return false;
+			if (!m_d->m_memoryMap->remove(index))
+				return false;
+
+			/* the data bytes stay where they are until the next compaction */
+			m_d->m_cache.remove(frame.m_fPos);
+			m_d->m_liveBytes -= frame.m_fSize;
+			return true;
+		}
+
+		/* fixed-width records are shifted on removal, there is never anything to reclaim */
+		bool compactData(std::true_type) const
+		{
+			return true;
+		}
+
+		bool compactData(std::false_type) const
+		{
+			if (m_d->m_chunked)
+				return m_d->m_chunked->compact();
+			return rewriteData(dataLayout());
+		}
+
+		/*
+		  copies the live elements, in index order, to new storage in layout
+		  and swaps it in. Nothing is touched until the copy is complete, so a
+		  failure leaves the container as it was.
+		*/
+		bool rewriteData(DataLayout layout) const
+		{
+			const StorageMode mode = m_d->m_device->mode();
+			const qint64 bufferSize = m_d->m_device->writeBufferSize();
+			auto newDevice = std::make_unique<ContainerFile>(mode);
+			std::unique_ptr<PackedFile> newPacked;
+			std::unique_ptr<ChunkedFile> newChunked;
+			if (layout == DataLayout::Packed)
+				newPacked = std::make_unique<PackedFile>(mode);
+			else if (layout == DataLayout::Chunked)
+				newChunked = std::make_unique<ChunkedFile>(mode);
+			auto newMap = std::make_unique<typename HugeContainerData<ValueType>::FrameIndex>(FilePageStore<Frame>(mapFile().mode()));
+			newDevice->setWriteBufferSize(bufferSize);
+			if (newPacked)
+				newPacked->file().setWriteBufferSize(bufferSize);
+			if (newChunked)
+				newChunked->file().setWriteBufferSize(bufferSize);
+			newMap->store().file().setWriteBufferSize(mapFile().writeBufferSize());
+
+			/* chunks take the bytes of the elements in order, they are gathered here first */
+			QByteArray staged;
+			const bool copied = copyLiveData(
+				[&newDevice, &newPacked, &newChunked, &staged](const QByteArray& block) -> qint64 {
+					if (newChunked) {
+						const qint64 pos = staged.size();
+						staged.append(block);
+						return pos;
+					}
+					return newPacked ? newPacked->append(block) : newDevice->append(block);
+				},
+				[&newMap, &newChunked, &staged](qint64, const QVector<Frame>& frames) -> bool {
+					if (!newChunked)
+						return newMap->append(frames.constData(), frames.size());
+					QVector<qint64> ends;
+					ends.reserve(frames.size());
+					for (const Frame& frame : frames)
+						ends.append(frame.m_fPos + frame.m_fSize);
+					const bool appended = newChunked->append(staged, ends);
+					staged.clear();
+					return appended;
+				}
+			);
+			if (!copied)
+				return false;
+
+			m_d->m_device.swap(newDevice);
+			m_d->m_packed.swap(newPacked);
+			m_d->m_chunked.swap(newChunked);
+			m_d->m_memoryMap.swap(newMap);
+			m_d->attachCounters();
+			m_d->m_cache.clear();
+			m_d->m_liveBytes = m_d->m_chunked ? 0 : dataBytes();
+			return true;
+		}
+
+		/*
+		  hands the live frames, a chunk at a time in index order, to
+		  writeFrames(first, frames) once appendData(block) stored their bytes
+		  and returned where they landed (-1 on failure). Frames written one
+		  after the other are moved with a single read and write.
+		*/
+		template <class AppendData, class WriteFrames>
+		bool copyLiveData(AppendData appendData, WriteFrames writeFrames) const
+		{
+			const int total = int(spilledCount());
+			QVector<Frame> frames;
+			QByteArray block;
+			if (m_d->m_chunked) {
+				/* the elements of a chunk already follow each other, they are moved together */
+				for (int first = 0; first < total; first += RangeChunk) {
+					const int count = qMin(total - first, int(RangeChunk));
+					block.clear();
+					frames.clear();
+					const bool read = m_d->m_chunked->read(first, count, [&block, &frames](const char* data, qint64 len) {
+						frames.append(Frame(block.size(), len));
+						block.append(data, int(len));
+						return true;
+					});
+					if (!read)
+						return false;
+					const qint64 newBegin = appendData(block);
+					if (newBegin < 0)
+						return false;
+					for (Frame& frame : frames)
+						frame.m_fPos += newBegin;
+					if (!writeFrames(first, frames))
+						return false;
+				}
+				return true;
+			}
+			for (int first = 0; first < total; first += RangeChunk) {
+				const int count = qMin(total - first, int(RangeChunk));
+				if (!readMap(first, count, frames))
+					return false;
+
+				for (int runStart = 0; runStart < count;) {
+					const qint64 runBegin = frames.at(runStart).m_fPos;
+					qint64 runEnd = runBegin + frames.at(runStart).m_fSize;
+					int runStop = runStart + 1;
+					for (; runStop < count && frames.at(runStop).m_fPos == runEnd; ++runStop)
+						runEnd += frames.at(runStop).m_fSize;
+
+					block.resize(int(runEnd - runBegin));
+					if (!readData(runBegin, block.data(), block.size()))
+						return false;
+					const qint64 newBegin = appendData(block);
+					if (newBegin < 0)
+						return false;
+					for (; runStart < runStop; ++runStart)
+						frames[runStart].m_fPos += newBegin - runBegin;
+				}
+				if (!writeFrames(first, frames))
+					return false;
+			}
+			return true;
+		}
+
+		/* the records are the data section as they are, followed by the ones in RAM */
+		bool writeSections(QFileDevice& file, ContainerFileHeader& header, std::true_type) const
+		{
+			header.layOut(storedCount(), sizeof(ValueType));
+			const qint64 fileBytes = m_d->m_device->size();
+			const qint64 hotBytes = qint64(m_d->m_hot.size()) * sizeof(ValueType);
+			header.m_dataBytes = fileBytes + hotBytes;
+			QByteArray block;
+			for (qint64 done = 0; done < fileBytes; done += block.size()) {
+				block.resize(int(qMin<qint64>(fileBytes - done, ReadAheadBytes)));
+				if (!m_d->m_device->read(done, block.data(), block.size()))
+					return false;
+				if (!file.seek(header.m_dataOffset + done) || file.write(block) != block.size())
+					return false;
+			}
+			return file.seek(header.m_dataOffset + fileBytes)
+				&& file.write(reinterpret_cast<const char*>(m_d->m_hot.constData()), hotBytes) == hotBytes;
+		}
+
+		/* live frames only, so what save() writes is compact whatever the state of the data file */
+		bool writeSections(QFileDevice& file, ContainerFileHeader& header, std::false_type) const
+		{
+			static_assert(sizeof(Frame) == ContainerFileHeader::IndexEntryBytes, "frames are the entries of the index");
+			static_assert(int(FilePageStore<Frame>::PageRecords) == int(ContainerFileHeader::IndexRecords), "the index is used as the pages of the map");
+			header.layOut(storedCount(), 0);
+			header.m_dataBytes = 0;
+			const bool copied = copyLiveData(
+				[&file, &header](const QByteArray& block) -> qint64 {
+					const qint64 pos = header.m_dataBytes;
+					if (!file.seek(header.m_dataOffset + pos) || file.write(block) != block.size())
+						return -1;
+					header.m_dataBytes += block.size();
+					return pos;
+				},
+				[&file, &header](qint64 first, const QVector<Frame>& frames) {
+					const qint64 len = qint64(frames.size()) * sizeof(Frame);
+					return file.seek(header.m_indexOffset + first * sizeof(Frame))
+						&& file.write(reinterpret_cast<const char*>(frames.constData()), len) == len;
+				}
+			);
+			if (!copied)
+				return false;
+			if (!m_d->m_hot.isEmpty()) {
+				/* the elements in RAM are serialized after the others */
+				QByteArray block;
+				QVector<qint64> ends;
+				encodeRange(m_d->m_hot.constData(), m_d->m_hot.constData() + m_d->m_hot.size(), block, ends);
+				const qint64 pos = header.m_dataBytes;
+				if (!file.seek(header.m_dataOffset + pos) || file.write(block) != block.size())
+					return false;
+				header.m_dataBytes += block.size();
+				const QVector<Frame> frames = framesOf(pos, ends);
+				const qint64 len = qint64(frames.size()) * sizeof(Frame);
+				if (!file.seek(header.m_indexOffset + spilledCount() * sizeof(Frame))
+					|| file.write(reinterpret_cast<const char*>(frames.constData()), len) != len)
+					return false;
+			}
+			/* the last page of the index is padded so the map can keep on growing page by page */
+			const qint64 indexEnd = header.m_count * qint64(sizeof(Frame));
+			const QByteArray padding(int(header.m_indexBytes - indexEnd), '\0');
+			return file.seek(header.m_indexOffset + indexEnd) && file.write(padding) == padding.size();
+		}
+
+		bool attachIndex(HugeContainerData<ValueType>& data, const QString& fileName, const ContainerFileHeader& header, std::true_type) const
+		{
+			Q_UNUSED(data);
+			Q_UNUSED(fileName);
+			return header.m_recordSize == qint32(sizeof(ValueType)) && header.m_dataBytes == header.m_count * qint64(sizeof(ValueType));
+		}
+
+		bool attachIndex(HugeContainerData<ValueType>& data, const QString& fileName, const ContainerFileHeader& header, std::false_type) const
+		{
+			if (header.m_recordSize != 0)
+				return false;
+			auto indexFile = std::make_unique<ContainerFile>(mapFile().mode());
+			indexFile->setWriteBufferSize(mapFile().writeBufferSize());
+			if (!indexFile->attach(fileName, header.m_indexOffset, header.m_indexBytes))
+				return false;
+			data.m_memoryMap = std::make_unique<typename HugeContainerData<ValueType>::FrameIndex>(FilePageStore<Frame>(std::move(indexFile)));
+			data.m_memoryMap->adopt(header.m_count);
+			data.m_liveBytes = header.m_dataBytes;
+			return true;
+		}
+
+		qint64 storedLiveBytes() const
+		{
+			if (m_d->m_chunked)
+				return m_d->m_chunked->fileBytes() - m_d->m_chunked->deadBytes();
+			return FixedWidthTag::value ? m_d->m_device->size() : m_d->m_liveBytes;
+		}
+
+		qint64 elementCount(std::true_type) const
+		{
+			return m_d->m_device->size() / qint64(sizeof(ValueType));
+		}
+
+		qint64 elementCount(std::false_type) const
+		{
+			return m_d->m_chunked ? m_d->m_chunked->size() : m_d->m_memoryMap->size();
+		}
+
+
+		bool readMap(const uint& index, Frame& frame) const {
+
+			if (Q_UNLIKELY(!mapFile().isReadable()))
+				return false;
+			return m_d->m_memoryMap->get(index, frame);
+		}
+
+		/* reads the count frames starting at first, one call per page of the map */
+		bool readMap(const uint& first, const int count, QVector<Frame>& frames) const {
+
+			if (Q_UNLIKELY(!mapFile().isReadable()))
+				return false;
+			frames.resize(count);
+			return m_d->m_memoryMap->read(first, count, frames.data());
+		}
+
+		bool appendRange(const ValueType* begin, const ValueType* end, std::true_type) const
+		{
+			if (!m_d->m_device->isWritable())
+				return false;
+			return m_d->m_device->append(reinterpret_cast<const char*>(begin), qint64(end - begin) * sizeof(ValueType)) >= 0;
+		}
+
+		bool appendRange(const ValueType* begin, const ValueType* end, std::false_type) const
+		{
+			if (!m_d->m_device->isWritable() || !mapFile().isWritable())
+				return false;
+
+			QByteArray block;
+			QVector<qint64> ends;
+			encodeRange(begin, end, block, ends);
+			if (m_d->m_chunked)
+				return m_d->m_chunked->append(block, ends);
+			const qint64 pos = writeInData(block);
+			if (pos < 0)
+				return false;
+			m_d->m_liveBytes += block.size();
+
+			const QVector<Frame> frames = framesOf(pos, ends);
+			return m_d->m_memoryMap->append(frames.constData(), frames.size());
+		}
+
+		//! Serializes the whole batch into block, remembering where each element ends
+		static void encodeRange(const ValueType* begin, const ValueType* end, QByteArray& block, QVector<qint64>& ends)
+		{
+			ends.reserve(int(end - begin));
+			QDataStream writerStream(&block, QIODevice::WriteOnly);
+			for (const ValueType* val = begin; val != end; ++val) {
+				writerStream << *val;
+				ends.append(writerStream.device()->pos());
+			}
+		}
+
+		//! Frames of the elements of a block written at pos, given where each one ends
+		static QVector<Frame> framesOf(qint64 pos, const QVector<qint64>& ends)
+		{
+			QVector<Frame> frames;
+			frames.reserve(ends.size());
+			qint64 start = 0;
+			for (const qint64 elementEnd : ends) {
+				frames.append(Frame(pos + start, elementEnd - start));
+				start = elementEnd;
+			}
+			return frames;
+		}
+
+		template <class OutputIt>
+		bool readChunk(const uint& first, const int count, OutputIt& out, std::true_type) const
+		{
+			const qint64 startPos = qint64(first) * sizeof(ValueType);
+			const qint64 len = qint64(count) * sizeof(ValueType);
+			QByteArray rawValues;
+			const char* source = m_d->m_device->mappedData(startPos, len);
+			if (!source) {
+				rawValues = m_d->m_device->read(startPos, len);
+				if (rawValues.size() != len)
+					return false;
+				source = rawValues.constData();
+			}
+			ValueType val;
+			for (int i = 0; i < count; ++i, source += sizeof(ValueType)) {
+				std::memcpy(&val, source, sizeof(ValueType));
+				*out = val;
+				++out;
+			}
+			return true;
+		}
+
+		template <class OutputIt>
+		bool readChunk(const uint& first, const int count, OutputIt& out, std::false_type) const
+		{
+			if (m_d->m_chunked) {
+				ValueType val;
+				return m_d->m_chunked->read(first, count, [&out, &val](const char* data, qint64 len) {
+					if (!decodeRecord(data, len, val, FixedWidthTag()))
+						return false;
+					*out = val;
+					++out;
+					return true;
+				});
+			}
+			QVector<Frame> frames;
+			if (!readMap(first, count, frames))
+				return false;
+
+			ValueType val;
+			for (int runStart = 0; runStart < frames.size();) {
+				/* frames lying close together in the data file are fetched with a single read */
+				const qint64 runBegin = frames.at(runStart).m_fPos;
+				qint64 runEnd = runBegin + frames.at(runStart).m_fSize;
+				int runStop = runStart + 1;
+				for (; runStop < frames.size(); ++runStop) {
+					const Frame& next = frames.at(runStop);
+					if (next.m_fPos < runEnd || next.m_fPos - runEnd > MaxReadGap)
+						break;
+					runEnd = next.m_fPos + next.m_fSize;
+				}
+
+				QByteArray block;
+				if (const char* mapped = mappedData(runBegin, runEnd - runBegin))
+					block = QByteArray::fromRawData(mapped, int(runEnd - runBegin));
+				else
+					block = readData(Frame(runBegin, runEnd - runBegin));
+				if (block.size() != runEnd - runBegin)
+					return false;
+
+				QDataStream readerStream(block);
+				for (; runStart < runStop; ++runStart) {
+					readerStream.device()->seek(frames.at(runStart).m_fPos - runBegin);
+					readerStream >> val;
+					if (readerStream.status() != QDataStream::Ok)
+						return false;
+					*out = val;
+					++out;
+				}
+			}
+			return true;
+		}
+
+
+		template <class OutputIt>
+		bool readElements(const uint& first, const int count, OutputIt out) const
+		{
+			if (count < 0 || qint64(first) + count > storedCount())
+				return false;
+			const qint64 spilled = spilledCount();
+			const int fromFiles = int(qBound<qint64>(0, spilled - first, count));
+			for (int done = 0; done < fromFiles;) {
+				const int step = qMin(fromFiles - done, int(RangeChunk));
+				if (!readChunk(first + done, step, out, FixedWidthTag()))
+					return false;
+				done += step;
+			}
+			/* the rest is in RAM */
+			for (int done = fromFiles; done < count; ++done) {
+				*out = m_d->m_hot.at(int(qint64(first) + done - spilled));
+				++out;
+			}
+			return true;
+		}
+
+		//! Position and size of the bytes of the element at index in the data file
+		bool elementExtent(const uint& index, qint64& pos, qint64& len, std::true_type) const
+		{
+			pos = qint64(index) * sizeof(ValueType);
+			len = sizeof(ValueType);
+			return true;
+		}
+
+		bool elementExtent(const uint& index, qint64& pos, qint64& len, std::false_type) const
+		{
+			Frame frame(-1, -1);
+			if (!readMap(index, frame))
+				return false;
+			pos = frame.m_fPos;
+			len = frame.m_fSize;
+			return true;
+		}
+
+
+		struct ReadRequest
+		{
+			qint64 m_pos;
+			qint64 m_size;
+			int m_slot;	//!< where the element goes in the result
+		};
+
+		struct ReadRun
+		{
+			qint64 m_begin;
+			qint64 m_end;
+			int m_first;	//!< requests of the run, in the order of the file
+			int m_stop;
+		};
+
+		static bool decodeRecord(const char* source, qint64 len, ValueType& out, std::true_type)
+		{
+			Q_ASSERT(len == qint64(sizeof(ValueType)));
+			std::memcpy(&out, source, sizeof(ValueType));
+			return true;
+		}
+
+		static bool decodeRecord(const char* source, qint64 len, ValueType& out, std::false_type)
+		{
+			QDataStream readerStream(QByteArray::fromRawData(source, int(len)));
+			readerStream >> out;
+			return readerStream.status() == QDataStream::Ok;
+		}
+
+		/*
+		  looks every index up first, in index order so that neighbouring ones
+		  share their page of the map, then sorts the reads by position, merges
+		  the ones lying close together and hands the merged reads to a pool of
+		  threads. Every thread decodes from its own buffer and the element cache
+		  is left alone, nothing shared is changed.
+		*/
+		bool fetchElements(const QVector<uint>& indices, QVector<ValueType>& values) const
+		{
+			QReadLocker locker(storageLock());
+			const qint64 total = spilledCount();
+			QVector<int> order(indices.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [&indices](int left, int right) { return indices.at(left) < indices.at(right); });
+
+			/* the elements in RAM come last in index order, they are copied and left out of the reads */
+			values.resize(indices.size());
+			while (!order.isEmpty() && qint64(indices.at(order.last())) >= total) {
+				const qint64 local = qint64(indices.at(order.last())) - total;
+				if (local >= m_d->m_hot.size())
+					return false;
+				values[order.last()] = m_d->m_hot.at(int(local));
+				order.removeLast();
+			}
+
+			/* in index order, elements of the same chunk come out of a single read */
+			if (m_d->m_chunked) {
+				QByteArray block;
+				for (const int slot : order) {
+					if (!m_d->m_chunked->get(indices.at(slot), block) || !decodeRecord(block.constData(), block.size(), values[slot], FixedWidthTag()))
+						return false;
+				}
+				return true;
+			}
+
+			QVector<ReadRequest> requests;
+			requests.reserve(indices.size());
+			for (const int slot : order) {
+				ReadRequest request;
+				request.m_slot = slot;
+				if (qint64(indices.at(slot)) >= total || !elementExtent(indices.at(slot), request.m_pos, request.m_size, FixedWidthTag()))
+					return false;
+				requests.append(request);
+			}
+			std::sort(requests.begin(), requests.end(), [](const ReadRequest& left, const ReadRequest& right) { return left.m_pos < right.m_pos; });
+
+			QVector<ReadRun> runs;
+			for (int runStart = 0; runStart < requests.size();) {
+				ReadRun run;
+				run.m_begin = requests.at(runStart).m_pos;
+				run.m_end = run.m_begin + requests.at(runStart).m_size;
+				run.m_first = runStart;
+				for (run.m_stop = runStart + 1; run.m_stop < requests.size(); ++run.m_stop) {
+					const ReadRequest& next = requests.at(run.m_stop);
+					if (next.m_pos - run.m_end > MaxReadGap)
+						break;
+					run.m_end = qMax(run.m_end, next.m_pos + next.m_size);
+				}
+				runs.append(run);
+				runStart = run.m_stop;
+			}
+
+			ValueType* results = values.data();
+			const int threads = qBound(1, runs.size() / int(MultiGetRunsPerThread), QThread::idealThreadCount());
+			return runParallel(runs.size(), threads, [this, &runs, &requests, results](int runIndex) -> bool {
+				const ReadRun& run = runs.at(runIndex);
+				QByteArray block;
+				const char* source = mappedData(run.m_begin, run.m_end - run.m_begin);
+				if (!source) {
+					block = readData(Frame(run.m_begin, run.m_end - run.m_begin));
+					if (block.size() != run.m_end - run.m_begin)
+						return false;
+					source = block.constData();
+				}
+				for (int i = run.m_first; i < run.m_stop; ++i) {
+					const ReadRequest& request = requests.at(i);
+					if (!decodeRecord(source + (request.m_pos - run.m_begin), request.m_size, results[request.m_slot], FixedWidthTag()))
+						return false;
+				}
+				return true;
+			});
+		}
+
+
+		/* empty storage with the settings of this container, statistics counted afresh */
+		QExplicitlySharedDataPointer<HugeContainerData<ValueType>> newDataLike() const
+		{
+			QExplicitlySharedDataPointer<HugeContainerData<ValueType>> newData(new HugeContainerData<ValueType>(storageMode()));
+			newData->m_device->setWriteBufferSize(writeBufferSize());
+			newData->m_cache.setBudget(cacheBudget());
+			if (m_d->m_locks)
+				newData->m_locks = std::make_unique<AccessLocks>();
+			newData->m_compactThreshold = m_d->m_compactThreshold;
+			newData->m_memoryBudget = m_d->m_memoryBudget;
+			if (m_d->m_counters)
+				newData->m_counters = std::make_unique<ContainerCounters>();
+			newData->attachCounters();
+			return newData;
+		}
+
+	public:
+
+		HugeContainer()
+			:m_d(new HugeContainerData<ValueType>{})
+		{
+		}
+
+		explicit HugeContainer(StorageMode mode)
+			:m_d(new HugeContainerData<ValueType>(mode))
+		{
+		}
+
+		HugeContainer(const HugeContainer& other) = default;
+		HugeContainer& operator=(const HugeContainer& other) = default;
+		HugeContainer& operator=(HugeContainer&& other) Q_DECL_NOTHROW {
+			swap(other);
+			return *this;
+		}
+
+
+		void swap(HugeContainer<ValueType>& other) Q_DECL_NOTHROW {
+			std::swap(m_d, other.m_d);
+		}
+
+		/*
+		  empty container with the settings of this one: storage mode, write
+		  buffer, cache and memory budgets, compaction threshold, concurrent
+		  access, element layout and statistics, counted afresh
+		*/
+		HugeContainer emptyCopy() const
 		{
-			if (!m_d->m_memoryMap->isWritable())
-				return false;
-			
-			if (m_d->m_memoryMap->write(block) >= 0) {
-				return true;
-			}
-			return false;
+			HugeContainer result;
+			result.m_d = newDataLike();
+			result.setCompression(compression());
+			result.setChunkedLayout(chunkedLayout());
+			return result;
+		}
 
+		/*
+		  lets any number of threads read the container while one thread changes
+		  it. Reads (size, get, at, value, readRange, mid, the iterators, save)
+		  run side by side with positional reads of the files, changes (push_back,
+		  append, insert, removeAt, clear and the setters) wait for the reads in
+		  progress and hold the others back. Copying, assigning, swapping or
+		  calling open() is still left to a single thread, and so is turning the
+		  mode on or off. Off by default, single-threaded use pays no locking.
+		*/
+		void setConcurrentAccess(bool enable)
+		{
+			if (enable && !m_d->m_locks)
+				m_d->m_locks = std::make_unique<AccessLocks>();
+			else if (!enable)
+				m_d->m_locks.reset();
 		}
 
-		bool writeElementInMap(const Frame& val) const
+		bool concurrentAccess() const
 		{
-			QByteArray block;
-			{
-				QDataStream writerStream(&block, QIODevice::WriteOnly);
-				writerStream << val.m_fPos;
-				writerStream << val.m_fSize;
-			}
+			return bool(m_d->m_locks);
+		}
 
-			const bool result = writeInMap(block);
-			return result;
+		/*
+		  keeps up to bytes of recently read elements decoded in RAM, 0 disables the cache.
+		  The budget belongs to the storage, so copies still sharing it share the cache.
+		*/
+		void setCacheBudget(qint64 bytes)
+		{
+			QWriteLocker locker(storageLock());
+			m_d->m_cache.setBudget(bytes);
 		}
 
+		qint64 cacheBudget() const
+		{
+			return m_d->m_cache.budget();
+		}
 
-		/* rewrite is very expensive functionality */
-		bool reWriteMap(const uint& index, const uint& at) const {
-			auto readPos = index * sizeof(Frame);
-			auto writePos = at * sizeof(Frame);
+		/*
+		  appended elements and their map entries are staged in RAM and written
+		  in one go every bytes, 0 writes each element as it comes
+		*/
+		void setWriteBufferSize(qint64 bytes)
+		{
+			QWriteLocker locker(storageLock());
+			m_d->m_device->setWriteBufferSize(bytes);
+			if (m_d->m_packed)
+				m_d->m_packed->file().setWriteBufferSize(bytes);
+			if (m_d->m_chunked)
+				m_d->m_chunked->file().setWriteBufferSize(bytes);
+			mapFile().setWriteBufferSize(bytes);
+		}
 
-			std::unique_ptr<QTemporaryFile> tempFile;
-			tempFile = std::make_unique<QTemporaryFile>(QDir::tempPath() + QDir::separator() + QStringLiteral("HugeContainerDataXXXXXX"));
+		qint64 writeBufferSize() const
+		{
+			return m_d->m_device->writeBufferSize();
+		}
 
-			if (!tempFile->open())
-				Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to create a temporary file");
+		//! Writes the staged elements to disk
+		bool flush()
+		{
+			QWriteLocker locker(storageLock());
+			const bool dataOk = m_d->m_device->flush() && (!m_d->m_packed || m_d->m_packed->flush()) && (!m_d->m_chunked || m_d->m_chunked->flush());
+			const bool mapOk = mapFile().flush();
+			return dataOk && mapOk;
+		}
 
-			/* write the all address from particular location into temp file */
-			m_d->m_memoryMap->seek(readPos);
-			qint64 totalSize = m_d->m_memoryMap->size() - readPos;
-			for (; totalSize > 1024; totalSize -= 1024)
-				tempFile->write(m_d->m_memoryMap->read(1024));
-			tempFile->write(m_d->m_memoryMap->read(totalSize));
+		StorageMode storageMode() const
+		{
+			return m_d->m_device->mode();
+		}
 
-			/* write the all address from temp file to new location in memoryMap file */
-			tempFile->seek(0);
-			m_d->m_memoryMap->seek(writePos);
+		/* the mode belongs to the storage, so copies still sharing it switch as well */
+		bool setStorageMode(StorageMode mode)
+		{
+			QWriteLocker locker(storageLock());
+			const bool dataOk = m_d->m_device->setMode(mode) && (!m_d->m_packed || m_d->m_packed->file().setMode(mode))
+				&& (!m_d->m_chunked || m_d->m_chunked->file().setMode(mode));
+			const bool mapOk = mapFile().setMode(mode);
+			return dataOk && mapOk;
+		}
 
-			totalSize = tempFile->size();
-			for (; totalSize > 1024; totalSize -= 1024)
-				m_d->m_memoryMap->write(tempFile->read(1024));
-			m_d->m_memoryMap->write(tempFile->read(totalSize));
+		//! Bytes of the data file holding elements of the container
+		qint64 liveBytes() const
+		{
+			QReadLocker locker(storageLock());
+			return storedLiveBytes();
+		}
 
-			auto lastPos = m_d->m_memoryMap->pos();
-			m_d->m_memoryMap->resize(lastPos);
+		//! Bytes of the data file left behind by removed elements
+		qint64 deadBytes() const
+		{
+			QReadLocker locker(storageLock());
+			return dataBytes() - storedLiveBytes();
+		}
 
-			return true;
+		//! Share of the data file taken by dead bytes, between 0 and 1
+		double fragmentation() const
+		{
+			QReadLocker locker(storageLock());
+			const qint64 fileSize = dataBytes();
+			return fileSize > 0 ? double(fileSize - storedLiveBytes()) / fileSize : 0.0;
 		}
 
+		/*
+		  share of the data file dead bytes must exceed (and at least
+		  MinCompactBytes) for compactionDue() to report true, 0 never does.
+		  Removals only record dead bytes, the rewrite is left to compact()
+		  so that removeAt() stays cheap whatever the size of the container.
+		*/
+		void setCompactionThreshold(double ratio)
+		{
+			QWriteLocker locker(storageLock());
+			m_d->m_compactThreshold = qMax(ratio, 0.0);
+		}
 
-		bool saveQueue(std::unique_ptr<ContainerObject<ValueType>>& valToWrite, const int &index) const {
-			bool allOk = false;
-			
-			/*Write the value in DataFile*/
-			const Frame result = writeElementInData(*(valToWrite->val()));
-			if (result.m_fPos >= 0) {
-				/*
-				    Whenever push_back funcation is called at that time 
-				    elements is append in file. 
-				*/
-				if (index < 0) {
-				   allOk = writeElementInMap(result); 
-				}
-				else {
-				 /* 
-				    Whenever insert funcation is called at that time 
-				    Address file will rewrite and elements is write at 
-					particular location. 
-				 */
-					if (reWriteMap(index, index + 1)) {
-						auto pos = m_d->m_memoryMap->pos();
-						m_d->m_memoryMap->seek(index * sizeof(Frame));
-						allOk = writeElementInMap(result);
-						m_d->m_memoryMap->seek(pos);
-					}
-				}
-			}
+		double compactionThreshold() const
+		{
+			return m_d->m_compactThreshold;
+		}
 
-			return allOk;
+		/*
+		  whether dead bytes passed the compaction threshold, for callers to
+		  run compact() at a time of their choosing, e.g. when idle or from a
+		  worker thread once setConcurrentAccess(true) is on
+		*/
+		bool compactionDue() const
+		{
+			QReadLocker locker(storageLock());
+			const qint64 fileSize = dataBytes();
+			const qint64 dead = fileSize - storedLiveBytes();
+			return m_d->m_compactThreshold > 0
+				&& dead >= qint64(MinCompactBytes)
+				&& dead > m_d->m_compactThreshold * fileSize;
 		}
 
-		bool enqueueValue(std::unique_ptr<ValueType>& val,const int index = -1) const
+		/*
+		  rewrites the live elements into a new data file and swaps it in.
+		  The content does not change, so copies still sharing the storage
+		  benefit as well.
+		*/
+		bool compact()
 		{
-			auto tempVal = std::make_unique<ContainerObject<ValueType>>(val.release());
-			if (saveQueue(tempVal, index)) {
+			QWriteLocker locker(storageLock());
+			if (dataBytes() == storedLiveBytes())
 				return true;
-			}
-		    return false;
+			return compactData(FixedWidthTag());
 		}
 
-		std::unique_ptr<ValueType> valueFromBlock(const uint& index) const
+		/*
+		  packs the serialized elements in blocks of PackedFile::BlockBytes
+		  compressed with zlib, which for redundant data takes a fraction of the
+		  disk space and of the reads. Decompressed blocks are cached, so reads
+		  next to each other cost one decompression. Turning it on or off
+		  rewrites the live elements once. Fixed-width elements are never
+		  compressed, enabling it for them fails, and so does the chunked
+		  layout. Files written by save() hold the elements uncompressed,
+		  open() leaves them that way.
+		*/
+		bool setCompression(bool enable)
 		{
-			/*read address of data*/
-			QByteArray rawFram = readMap(index);
-			if (rawFram.isEmpty()) {
-				return nullptr;
-			}
-
-			/* decode address and size */
-			auto frame = std::make_unique<Frame>(-1,-1);
-			QDataStream Stream(rawFram);
-			Stream >> frame->m_fPos;
-			Stream >> frame->m_fSize;
-
-			/*read data*/
-			QByteArray block = readData(*frame);
-			if (block.isEmpty())
-				return nullptr;
-
-			/*decode data*/
-			auto result = std::make_unique<ValueType>();
-			QDataStream readerStream(block);
-			readerStream >> *result;
-			return result;
+			if (enable == compression())
+				return true;
+			if (FixedWidthTag::value || chunkedLayout())
+				return false;
+			m_d.detach();
+			QWriteLocker locker(storageLock());
+			return rewriteData(enable ? DataLayout::Packed : DataLayout::Frames);
 		}
 
+		bool compression() const
+		{
+			return bool(m_d->m_packed);
+		}
 
-		QByteArray readData(const Frame& dataFrame) const
+		//! Bytes the data takes on disk, after compression when it is on
+		qint64 storedBytes() const
 		{
-			if (Q_UNLIKELY(!m_d->m_device->isReadable()))
-				return QByteArray();
-			m_d->m_device->setTextModeEnabled(false);
-			
-			auto tempPos = m_d->m_device->pos();
-			m_d->m_device->seek(dataFrame.m_fPos);
-			
-			QByteArray result;
-			result = m_d->m_device->read(dataFrame.m_fSize);
-			
-			m_d->m_device->seek(tempPos);
-			return result;
+			QReadLocker locker(storageLock());
+			if (m_d->m_chunked)
+				return m_d->m_chunked->fileBytes();
+			return m_d->m_packed ? m_d->m_packed->packedSize() : m_d->m_device->size();
 		}
 
+		/*
+		  groups the serialized elements in chunks of ChunkedFile::ChunkElements
+		  elements or ChunkedFile::ChunkBytes bytes, with a directory of one
+		  entry per chunk in place of the map. Reading an element costs one read
+		  of its chunk, scans read whole chunks, and the index shrinks by the
+		  size of a chunk, which suits billions of small elements. Changing an
+		  element rewrites its chunk, so inserts and removals in the middle cost
+		  more. Switching rewrites the live elements once. Fixed-width elements
+		  have no index to shrink and compression is not combined with it, both
+		  make it fail. save() writes the usual layout and open() reads it back as it is.
+		*/
+		bool setChunkedLayout(bool enable)
+		{
+			if (enable == chunkedLayout())
+				return true;
+			if (FixedWidthTag::value || compression())
+				return false;
+			m_d.detach();
+			QWriteLocker locker(storageLock());
+			return rewriteData(enable ? DataLayout::Chunked : DataLayout::Frames);
+		}
 
-		QByteArray readMap(const uint& index) const {
+		bool chunkedLayout() const
+		{
+			return bool(m_d->m_chunked);
+		}
 
-			if (Q_UNLIKELY(!m_d->m_device->isReadable()))
-				return QByteArray();
-			m_d->m_memoryMap->setTextModeEnabled(false);
-			
-			auto tempPos = m_d->m_memoryMap->pos();
+		/*
+		  keeps the newest elements in RAM for as long as they take no more
+		  than bytes, as counted by ElementFootprint. Past the budget the
+		  oldest of them move to the files, down to half the budget, so small
+		  containers never touch the disk and big ones stay bounded in memory.
+		  Indices span both tiers and reads work the same on each, inserts and
+		  removals among the elements in RAM cost no I/O. 0, the default,
+		  sends every element to the files at once, and lowering the budget
+		  spills what no longer fits. Like the cache budget it belongs to the
+		  storage and moving elements leaves the content alone.
+		*/
+		bool setMemoryBudget(qint64 bytes)
+		{
+			QWriteLocker locker(storageLock());
+			m_d->m_memoryBudget = qMax<qint64>(bytes, 0);
+			return enforceMemoryBudget();
+		}
 
-			auto startPos = index * sizeof(Frame);
-			m_d->m_memoryMap->seek(startPos);
+		qint64 memoryBudget() const
+		{
+			return m_d->m_memoryBudget;
+		}
 
-			QByteArray result; 
-			result = m_d->m_memoryMap->read(sizeof(Frame)); 
-			
-			m_d->m_memoryMap->seek(tempPos);
-			return result;
+		//! Footprint of the elements currently held in RAM
+		qint64 residentBytes() const
+		{
+			QReadLocker locker(storageLock());
+			return m_d->m_hotBytes;
 		}
 
+		/*
+		  counts the calls reaching the files, the lookups of the element cache,
+		  the copies made on detaching and the latencies of at(), push_back()
+		  and insert(), see stats(). Turning it on starts from zero, turning it
+		  off drops the counts. Off by default, when it costs a null check per
+		  call, and compiled out entirely with HUGECONTAINER_NO_STATS defined.
+		  The counters belong to the storage, like the cache, and turning them
+		  on or off is left to a single thread, like setConcurrentAccess().
+		*/
+		void setStatsEnabled(bool enable)
+		{
+#ifndef HUGECONTAINER_NO_STATS
+			if (enable && !m_d->m_counters)
+				m_d->m_counters = std::make_unique<ContainerCounters>();
+			else if (!enable)
+				m_d->m_counters.reset();
+			m_d->attachCounters();
+#else
+			Q_UNUSED(enable);
+#endif
+		}
 
-	public:
+		bool statsEnabled() const
+		{
+			return counters() != nullptr;
+		}
 
-		HugeContainer()
-			:m_d(new HugeContainerData<ValueType>{})
+		//! The sizes are always filled in, the counts only while statistics are on
+		ContainerStats stats() const
 		{
+			QReadLocker locker(storageLock());
+			ContainerStats result;
+			result.m_indexBytes = mapFile().size();
+			result.m_liveBytes = storedLiveBytes();
+			result.m_deadBytes = dataBytes() - result.m_liveBytes;
+			const ContainerCounters* counters = this->counters();
+			if (!counters)
+				return result;
+			counters->m_data.addTo(result);
+			counters->m_index.addTo(result);
+			result.m_indexReadBytes = counters->m_index.readBytes();
+			result.m_indexWriteBytes = counters->m_index.writeBytes();
+			result.m_cacheHits = counters->m_cacheHits.load(std::memory_order_relaxed);
+			result.m_cacheMisses = counters->m_cacheMisses.load(std::memory_order_relaxed);
+			result.m_detachCopies = counters->m_detachCopies.load(std::memory_order_relaxed);
+			result.m_at = counters->m_at.snapshot();
+			result.m_pushBack = counters->m_pushBack.snapshot();
+			result.m_insert = counters->m_insert.snapshot();
+			return result;
 		}
 
-		HugeContainer(const HugeContainer& other) = default;
-		HugeContainer& operator=(const HugeContainer& other) = default;
-		HugeContainer& operator=(HugeContainer&& other) Q_DECL_NOTHROW {
-			swap(other);
-			return *this;
+		/*
+		  writes the container to fileName, replacing it only once the whole
+		  file is written. Removed elements are left out, see ContainerFileHeader
+		  for the layout.
+		*/
+		bool save(const QString& fileName) const
+		{
+			QReadLocker locker(storageLock());
+			QSaveFile file(fileName);
+			if (!file.open(QIODevice::WriteOnly))
+				return false;
+			ContainerFileHeader header;
+			if (!writeSections(file, header, FixedWidthTag()) || !header.write(file)) {
+				file.cancelWriting();
+				return false;
+			}
+			return file.commit();
 		}
 
+		/*
+		  replaces the content with the one saved in fileName. Nothing is read
+		  but the header: the index and the data are used in place, in the
+		  current storage mode, and fileName is never written. A change copies
+		  the segments it touches to a temporary file, see ContainerFile.
+		  On failure the container is left as it was.
+		*/
+		bool open(const QString& fileName)
+		{
+			QFile file(fileName);
+			ContainerFileHeader header;
+			if (!file.open(QIODevice::ReadOnly) || !header.read(file))
+				return false;
 
-		void swap(HugeContainer<ValueType>& other) Q_DECL_NOTHROW {
-			std::swap(m_d, other.m_d);
+			QExplicitlySharedDataPointer<HugeContainerData<ValueType>> newData = newDataLike();
+			if (!newData->m_device->attach(fileName, header.m_dataOffset, header.m_dataBytes))
+				return false;
+			if (!attachIndex(*newData, fileName, header, FixedWidthTag()))
+				return false;
+			newData->attachCounters();
+			m_d.swap(newData);
+			return true;
 		}
 
 		
 		void push_back(const ValueType &val) {
+			LatencyTimer timer(this, &ContainerCounters::m_pushBack);
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			auto tempval = std::make_unique<ValueType>(val);
-			enqueueValue(tempval);
+			insertElement(storedCount(), tempval);
 		}
 		
 		void push_back(ValueType* val)
 		{
 			if (!val)
 				return;
+			LatencyTimer timer(this, &ContainerCounters::m_pushBack);
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			std::unique_ptr<ValueType> tempval(val);
-			enqueueValue(tempval);
+			insertElement(storedCount(), tempval);
 			
 		}
 
+		//! Appends the elements in [begin, end) with one write to the data file and one to the map, false if it failed
+		bool append(const ValueType* begin, const ValueType* end)
+		{
+			if (begin == end)
+				return true;
+			m_d.detach();
+			QWriteLocker locker(storageLock());
+			if (m_d->m_memoryBudget > 0) {
+				for (const ValueType* val = begin; val != end; ++val)
+					m_d->m_hotBytes += ElementFootprint<ValueType>::bytes(*val);
+				m_d->m_hot.reserve(m_d->m_hot.size() + int(end - begin));
+				std::copy(begin, end, std::back_inserter(m_d->m_hot));
+				return enforceMemoryBudget();
+			}
+			return appendRange(begin, end, FixedWidthTag());
+		}
+
+		bool append(const QVector<ValueType>& values)
+		{
+			return append(values.constData(), values.constData() + values.size());
+		}
+
+		/*
+		  writes the count elements starting at first to out, fetching
+		  contiguous extents of the files with a single read
+		*/
+		template <class OutputIt>
+		bool readRange(const uint& first, const int count, OutputIt out) const
+		{
+			QReadLocker locker(storageLock());
+			return readElements(first, count, out);
+		}
+
+		//! Same as readRange() into a vector, count < 0 reads up to the end
+		QVector<ValueType> mid(const uint& first, int count = -1) const
+		{
+			QReadLocker locker(storageLock());
+			QVector<ValueType> result;
+			const int total = storedCount();
+			if (qint64(first) >= total)
+				return result;
+			if (count < 0 || qint64(first) + count > total)
+				count = total - first;
+			result.reserve(count);
+			readElements(first, count, std::back_inserter(result));
+			return result;
+		}
+
+		/*
+		  writes the elements at indices, in that order, to out. The reads are
+		  batched: all the lookups first, then the data in file order with
+		  neighbouring elements fetched together and many reads in flight on
+		  a pool of threads. Much faster than at() in a loop for random access.
+		  False if an index is out of range or a read fails.
+		*/
+		template <class OutputIt>
+		bool multiGet(const QVector<uint>& indices, OutputIt out) const
+		{
+			QVector<ValueType> values;
+			if (!fetchElements(indices, values))
+				return false;
+			std::copy(values.cbegin(), values.cend(), out);
+			return true;
+		}
+
+		/*
+		  runs multiGet() as a task of QThreadPool::globalInstance(), the
+		  result is empty if it fails. It bypasses the element cache, so plain
+		  reads can go on meanwhile; changes have to wait for the result unless
+		  concurrentAccess() is on. The container must outlive the future.
+		*/
+		std::future<QVector<ValueType> > multiGetAsync(const QVector<uint>& indices) const
+		{
+			const auto promise = std::make_shared<std::promise<QVector<ValueType> > >();
+			std::future<QVector<ValueType> > result = promise->get_future();
+			startInPool([this, indices, promise]() {
+				QVector<ValueType> values;
+				if (!fetchElements(indices, values))
+					values.clear();
+				promise->set_value(values);
+			});
+			return result;
+		}
+
+		//! Same as multiGetAsync() for one element, a default-constructed value if index is out of range
+		std::future<ValueType> atAsync(const uint& index) const
+		{
+			const auto promise = std::make_shared<std::promise<ValueType> >();
+			std::future<ValueType> result = promise->get_future();
+			startInPool([this, index, promise]() {
+				QVector<ValueType> values;
+				if (!fetchElements(QVector<uint>(1, index), values))
+					values = QVector<ValueType>(1, ValueType());
+				promise->set_value(values.first());
+			});
+			return result;
+		}
+
+		/*
+		  read-only random access iterator. Elements are decoded a window at a
+		  time with readRange(), so a pass over the container costs one read per
+		  window instead of one per element. Iterators copied from each other
+		  share the last window any of them decoded, which keeps the temporaries
+		  made by std::reverse_iterator cheap. A reference returned by operator*
+		  lives as long as an iterator on its window or the next window change.
+		  Any change to the container invalidates the iterator.
+		*/
+		class const_iterator
+		{
+		public:
+			typedef std::random_access_iterator_tag iterator_category;
+			typedef ValueType value_type;
+			typedef qptrdiff difference_type;
+			typedef const ValueType* pointer;
+			typedef const ValueType& reference;
+
+			const_iterator()
+				: m_container(nullptr)
+				, m_index(0)
+			{
+			}
+
+			const ValueType& operator*() const
+			{
+				loadWindow();
+				return m_window->m_values.at(m_index - m_window->m_first);
+			}
+			const ValueType* operator->() const { return &operator*(); }
+			ValueType operator[](difference_type n) const { return *(*this + n); }
+
+			const_iterator& operator++() { ++m_index; return *this; }
+			const_iterator operator++(int) { const_iterator result(*this); ++m_index; return result; }
+			const_iterator& operator--() { --m_index; return *this; }
+			const_iterator operator--(int) { const_iterator result(*this); --m_index; return result; }
+			const_iterator& operator+=(difference_type n) { m_index += int(n); return *this; }
+			const_iterator& operator-=(difference_type n) { m_index -= int(n); return *this; }
+			const_iterator operator+(difference_type n) const { const_iterator result(*this); return result += n; }
+			const_iterator operator-(difference_type n) const { const_iterator result(*this); return result -= n; }
+			friend const_iterator operator+(difference_type n, const const_iterator& iter) { return iter + n; }
+			difference_type operator-(const const_iterator& other) const { return difference_type(m_index) - other.m_index; }
+
+			bool operator==(const const_iterator& other) const { return m_index == other.m_index && m_container == other.m_container; }
+			bool operator!=(const const_iterator& other) const { return !operator==(other); }
+			bool operator<(const const_iterator& other) const { return m_index < other.m_index; }
+			bool operator>(const const_iterator& other) const { return m_index > other.m_index; }
+			bool operator<=(const const_iterator& other) const { return m_index <= other.m_index; }
+			bool operator>=(const const_iterator& other) const { return m_index >= other.m_index; }
+
+		private:
+			friend class HugeContainer;
+
+			struct Window
+			{
+				int m_first;
+				QVector<ValueType> m_values;
+			};
+			struct ReadAhead
+			{
+				std::shared_ptr<Window> m_window;
+			};
+
+			const_iterator(const HugeContainer* container, int index)
+				: m_container(container)
+				, m_index(index)
+				, m_readAhead(std::make_shared<ReadAhead>())
+			{
+			}
+
+			bool windowHolds(const std::shared_ptr<Window>& window) const
+			{
+				return window && m_index >= window->m_first && m_index < window->m_first + window->m_values.size();
+			}
+
+			void loadWindow() const
+			{
+				Q_ASSERT(m_container && m_index >= 0 && m_index < m_container->size());
+				if (windowHolds(m_window))
+					return;
+				if (windowHolds(m_readAhead->m_window)) {
+					m_window = m_readAhead->m_window;
+					return;
+				}
+
+				/* read ahead in the direction the iterator is moving */
+				const int windowSize = readAheadCount();
+				const std::shared_ptr<Window>& previous = m_window ? m_window : m_readAhead->m_window;
+				int first = m_index;
+				if (previous && m_index < previous->m_first)
+					first = qMax(0, m_index - windowSize + 1);
+				const int count = qMin(windowSize, m_container->size() - first);
+
+				/* decode in place when no other iterator is on the current window */
+				const long owners = (m_readAhead->m_window == m_window) ? 2 : 1;
+				if (!m_window || m_window.use_count() > owners)
+					m_window = std::make_shared<Window>();
+				m_readAhead->m_window = m_window;
+				m_window->m_first = first;
+				m_window->m_values.resize(count);
+				if (!m_container->readRange(first, count, m_window->m_values.data())) {
+					Q_ASSERT_X(false, "HugeContainer::const_iterator", "Unable to read from the data file");
+				}
+			}
+
+			static int readAheadCount()
+			{
+				return FixedWidthTag::value ? qMax(1, int(ReadAheadBytes / sizeof(ValueType))) : int(ReadAheadElements);
+			}
+
+			const HugeContainer* m_container;
+			int m_index;
+			mutable std::shared_ptr<Window> m_window;
+			std::shared_ptr<ReadAhead> m_readAhead;
+		};
+
+		const_iterator begin() const
+		{
+			QReadLocker locker(storageLock());
+			m_d->m_device->adviseSequential();
+			if (m_d->m_packed)
+				m_d->m_packed->file().adviseSequential();
+			if (m_d->m_chunked)
+				m_d->m_chunked->file().adviseSequential();
+			mapFile().adviseSequential();
+			return const_iterator(this, 0);
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(this, size());
+		}
+
+		const_iterator constBegin() const { return begin(); }
+		const_iterator constEnd() const { return end(); }
+		const_iterator cbegin() const { return begin(); }
+		const_iterator cend() const { return end(); }
+
 		/*
 		  if index is same as size() then value append to the file
 		  if index is correct then insert the value at particular location.  
 		*/
 		void insert(uint index, const ValueType &val) {
-			
+			LatencyTimer timer(this, &ContainerCounters::m_insert);
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			auto tempval = std::make_unique<ValueType>(val);
 			
-			if (index != size()) {
-				Q_ASSERT(correctIndex(index));
-				enqueueValue(tempval, index);
-			}
-			else {
-				enqueueValue(tempval);
-			}
+			Q_ASSERT(qint64(index) <= storedCount());
+			insertElement(index, tempval);
 		}
 
 
@@ -463,36 +2529,60 @@ namespace HugeContainers {
 			if (!val)
 				return;
 
+			LatencyTimer timer(this, &ContainerCounters::m_insert);
 			m_d.detach();
+			QWriteLocker locker(storageLock());
 			std::unique_ptr<ValueType> tempval(val);
 
-			if (index != size()) {
-				Q_ASSERT(correctIndex(index));
-				enqueueValue(tempval, index);
-			}
-			else {
-				enqueueValue(tempval);
-			}
+			Q_ASSERT(qint64(index) <= storedCount());
+			insertElement(index, tempval);
 		}
 
 
-		/* Must be put correct index for finding value */
-		const ValueType& at(const uint& index)
+		//! Decodes the element at index into out, false if index is out of range or unreadable
+		bool get(const uint& index, ValueType& out) const
 		{
-			Q_ASSERT(correctIndex(index));
+			QReadLocker locker(storageLock());
+			if (qint64(index) >= storedCount())
+				return false;
+			return readElement(index, out);
+		}
 
-			auto result = valueFromBlock(index);
-			Q_ASSERT(result);
-			
-			m_d.detach();
-			return *(result.release());
+		//! Returns the element at index, or a default-constructed value when there is none
+		ValueType value(const uint& index) const
+		{
+			ValueType result = ValueType();
+			get(index, result);
+			return result;
+		}
+
+		ValueType value(const uint& index, const ValueType& defaultValue) const
+		{
+			ValueType result;
+			if (!get(index, result))
+				return defaultValue;
+			return result;
+		}
+
+		/* Must be put correct index for finding value */
+		ValueType at(const uint& index) const
+		{
+			LatencyTimer timer(this, &ContainerCounters::m_at);
+			QReadLocker locker(storageLock());
+			Q_ASSERT(qint64(index) < storedCount());
+
+			ValueType result;
+			const bool found = readElement(index, result);
+			Q_ASSERT(found);
+			Q_UNUSED(found);
+			return result;
 		}
 
 		bool removeAt(const uint& index)
 		{
 			m_d.detach();
-			reWriteMap(index+1, index);
-			return true;
+			QWriteLocker locker(storageLock());
+			return eraseElement(index);
 		}
 
 		void clear()
@@ -500,12 +2590,19 @@ namespace HugeContainers {
 			if (isEmpty())
 				return;
 			m_d.detach();
+			QWriteLocker locker(storageLock());
+			m_d->m_cache.clear();
+			m_d->m_liveBytes = 0;
+			m_d->m_hot.clear();
+			m_d->m_hotBytes = 0;
+			if (m_d->m_packed)
+				m_d->m_packed->clear();
+			if (m_d->m_chunked)
+				m_d->m_chunked->clear();
 			if (!m_d->m_device->resize(0)) {
 				Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to resize data file");
 			}
-			if (!m_d->m_memoryMap->resize(0)) {
-				Q_ASSERT_X(false, "HugeContainer::HugeContainer", "Unable to resize memoryMap file");
-			}
+			m_d->m_memoryMap->clear();
 			
 		}
 
@@ -515,46 +2612,33 @@ namespace HugeContainers {
 		}
 		int size() const
 		{
-			return (m_d->m_memoryMap->size()/sizeof(Frame));
+			QReadLocker locker(storageLock());
+			return storedCount();
 		}
 		bool isEmpty() const
 		{
-			bool ret = true;
-			if (m_d->m_memoryMap->pos() != 0) {
-				ret = false;
-			}
-			return ret;
+			QReadLocker locker(storageLock());
+			return storedCount() == 0;
 		}
 
-		bool correctIndex(const uint& index) {
+		bool correctIndex(const uint& index) const {
 			return ((index >= 0) && (this->size() > index));
 		}
 
-		inline const ValueType& first() const
+		inline ValueType first() const
 		{
 			Q_ASSERT(!isEmpty());
 			return at(0);
 		}
 
-		inline ValueType& first()
-		{
-			Q_ASSERT(!isEmpty());
-			return const_cast<ValueType&>(at(0));
-		}
-
-		inline const ValueType& last() const
+		inline ValueType last() const
 		{
 			Q_ASSERT(!isEmpty());
 			return at(size() - 1);
 		}
-
-		inline ValueType& last()
-		{
-			Q_ASSERT(!isEmpty());
-			return const_cast<ValueType&>(at(size() - 1));
-		}
 	    
 	};
-
 }
-#endif // hugecontainer_h__
\ No newline at end of file
+
+#include "../Common/HugeContainerAlgorithms.h"
+#endif // hugecontainer_tempfile_h__